@@ -0,0 +1,34 @@
+// Benchmark.h
+//
+// Headless benchmarks run from the command line with --benchmark <name>. They print their results and exit without
+// creating a window, so they can be run on build machines and compared between versions.
+//
+// Copyright (c) 2021 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <Foundation/tString.h>
+namespace Benchmark
+{
+
+
+// Runs the named benchmark, or all of them if name is "all". Expects the worker pool to be started. Returns the
+// process exit code.
+int Run(const tString& name);
+
+// Individual benchmarks.
+int ThumbnailCompression();									// "thumbcache"
+int ImageDownscale();										// "downscale"
+int ImageResample();										// "resample"
+int ImageRotate();											// "rotate"
+int ImageRotateCrop();										// "rotatecrop"
+
+
+}
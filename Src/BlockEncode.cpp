@@ -0,0 +1,246 @@
+// BlockEncode.cpp
+//
+// Fast BC1 (DXT1) and BC3 (DXT5) encoders for display textures. They fit each 4x4 block's colours along the diagonal
+// of its bounding box, flipped to follow the block's dominant colour direction, and pick the nearest palette entry for
+// every texel. Quality is below an offline encoder but good enough for viewing, and each core encodes tens of
+// megapixels a second.
+//
+// Copyright (c) 2021 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <Foundation/tFundamentals.h>
+#include "BlockEncode.h"
+#include "WorkerPool.h"
+using namespace tImage;
+namespace Viewer { extern Worker::Pool WorkerPool; }
+
+
+namespace BlockEncode
+{
+	// Enough block rows per chunk that the job overhead is small next to the work.
+	const int MinBlocksPerChunk = 4*1024;
+
+	void LoadBlock(tPixel block[16], const tPixel* src, int width, int height, int bx, int by);
+	void EncodeColourBlock(uint8* dst, const tPixel block[16]);
+	void EncodeAlphaBlock(uint8* dst, const tPixel block[16]);
+	void EncodeBlocks(uint8* dst, const tPixel* src, int width, int height, int blockBytes, bool alpha);
+
+	uint16 To565(int r, int g, int b)																					{ return uint16(((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3)); }
+	void From565(uint16 c, int rgb[3])																					{ int r = (c >> 11) & 0x1F; int g = (c >> 5) & 0x3F; int b = c & 0x1F; rgb[0] = (r << 3) | (r >> 2); rgb[1] = (g << 2) | (g >> 4); rgb[2] = (b << 3) | (b >> 2); }
+}
+
+
+int BlockEncode::GetEncodedSize(tPixelFormat format, int width, int height)
+{
+	int numBlocks = ((width + 3) / 4) * ((height + 3) / 4);
+	switch (format)
+	{
+		case tPixelFormat::BC1_DXT1:	return numBlocks * 8;
+		case tPixelFormat::BC3_DXT5:	return numBlocks * 16;
+		default:						return 0;
+	}
+}
+
+
+void BlockEncode::LoadBlock(tPixel block[16], const tPixel* src, int width, int height, int bx, int by)
+{
+	for (int y = 0; y < 4; y++)
+	{
+		const tPixel* row = src + tMath::tMin(by*4 + y, height-1)*width;
+		for (int x = 0; x < 4; x++)
+			block[y*4 + x] = row[tMath::tMin(bx*4 + x, width-1)];
+	}
+}
+
+
+void BlockEncode::EncodeColourBlock(uint8* dst, const tPixel block[16])
+{
+	int minC[3] = { 255, 255, 255 };
+	int maxC[3] = { 0, 0, 0 };
+	int mean[3] = { 0, 0, 0 };
+	for (int i = 0; i < 16; i++)
+	{
+		const uint8 rgb[3] = { block[i].R, block[i].G, block[i].B };
+		for (int c = 0; c < 3; c++)
+		{
+			minC[c] = tMath::tMin(minC[c], int(rgb[c]));
+			maxC[c] = tMath::tMax(maxC[c], int(rgb[c]));
+			mean[c] += rgb[c];
+		}
+	}
+
+	// The bounding box diagonal only fits the colours if they all rise together. For each channel that falls as the
+	// widest one rises, the ends are swapped so the line runs along the other diagonal.
+	int widest = 0;
+	for (int c = 1; c < 3; c++)
+		if ((maxC[c] - minC[c]) > (maxC[widest] - minC[widest]))
+			widest = c;
+
+	int end0[3] = { maxC[0], maxC[1], maxC[2] };
+	int end1[3] = { minC[0], minC[1], minC[2] };
+	for (int c = 0; c < 3; c++)
+	{
+		if (c == widest)
+			continue;
+
+		int covariance = 0;
+		for (int i = 0; i < 16; i++)
+		{
+			const uint8 rgb[3] = { block[i].R, block[i].G, block[i].B };
+			covariance += (16*rgb[widest] - mean[widest]) * (16*rgb[c] - mean[c]);
+		}
+		if (covariance < 0)
+			tMath::tSwap(end0[c], end1[c]);
+	}
+
+	// Four-colour mode needs colour0 > colour1. Swapping the ends swaps palette entries 0 and 1, and 2 and 3.
+	uint16 colour0 = To565(end0[0], end0[1], end0[2]);
+	uint16 colour1 = To565(end1[0], end1[1], end1[2]);
+	if (colour0 < colour1)
+		tMath::tSwap(colour0, colour1);
+
+	uint32 indices = 0;
+	if (colour0 != colour1)
+	{
+		int palette[4][3];
+		From565(colour0, palette[0]);
+		From565(colour1, palette[1]);
+		for (int c = 0; c < 3; c++)
+		{
+			palette[2][c] = (2*palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2*palette[1][c]) / 3;
+		}
+
+		for (int i = 0; i < 16; i++)
+		{
+			int best = 0;
+			int bestDist = 0x7FFFFFFF;
+			for (int p = 0; p < 4; p++)
+			{
+				int dr = int(block[i].R) - palette[p][0];
+				int dg = int(block[i].G) - palette[p][1];
+				int db = int(block[i].B) - palette[p][2];
+				int dist = dr*dr + dg*dg + db*db;
+				if (dist < bestDist)
+				{
+					bestDist = dist;
+					best = p;
+				}
+			}
+			indices |= uint32(best) << (2*i);
+		}
+	}
+
+	dst[0] = uint8(colour0);	dst[1] = uint8(colour0 >> 8);
+	dst[2] = uint8(colour1);	dst[3] = uint8(colour1 >> 8);
+	dst[4] = uint8(indices);	dst[5] = uint8(indices >> 8);
+	dst[6] = uint8(indices >> 16);	dst[7] = uint8(indices >> 24);
+}
+
+
+void BlockEncode::EncodeAlphaBlock(uint8* dst, const tPixel block[16])
+{
+	// The range isn't inset. Fully opaque and fully transparent texels must stay exact or cut-outs get fringes.
+	int minA = 255;
+	int maxA = 0;
+	for (int i = 0; i < 16; i++)
+	{
+		minA = tMath::tMin(minA, int(block[i].A));
+		maxA = tMath::tMax(maxA, int(block[i].A));
+	}
+
+	// With alpha0 > alpha1 there are six interpolated values between them. Index 0 is alpha0 and 1 is alpha1.
+	uint64 indices = 0;
+	if (maxA != minA)
+	{
+		int palette[8] = { maxA, minA };
+		for (int p = 2; p < 8; p++)
+			palette[p] = ((8-p)*maxA + (p-1)*minA) / 7;
+
+		for (int i = 0; i < 16; i++)
+		{
+			int best = 0;
+			int bestDist = 256;
+			for (int p = 0; p < 8; p++)
+			{
+				int dist = tMath::tAbs(int(block[i].A) - palette[p]);
+				if (dist < bestDist)
+				{
+					bestDist = dist;
+					best = p;
+				}
+			}
+			indices |= uint64(best) << (3*i);
+		}
+	}
+
+	dst[0] = uint8(maxA);
+	dst[1] = uint8(minA);
+	for (int b = 0; b < 6; b++)
+		dst[2+b] = uint8(indices >> (8*b));
+}
+
+
+void BlockEncode::EncodeBlocks(uint8* dst, const tPixel* src, int width, int height, int blockBytes, bool alpha)
+{
+	if (!dst || !src || (width <= 0) || (height <= 0))
+		return;
+
+	int blocksW = (width + 3) / 4;
+	int blocksH = (height + 3) / 4;
+	int rowsPerChunk = tMath::tMax(MinBlocksPerChunk / blocksW, 1);
+	Viewer::WorkerPool.ParallelFor
+	(
+		blocksH, rowsPerChunk,
+		[=](int begin, int end)
+		{
+			tPixel block[16];
+			for (int by = begin; by < end; by++)
+			{
+				uint8* out = dst + by*blocksW*blockBytes;
+				for (int bx = 0; bx < blocksW; bx++, out += blockBytes)
+				{
+					LoadBlock(block, src, width, height, bx, by);
+					if (alpha)
+						EncodeAlphaBlock(out, block);
+					EncodeColourBlock(alpha ? out+8 : out, block);
+				}
+			}
+		}
+	);
+}
+
+
+void BlockEncode::EncodeBC1(uint8* dst, const tPixel* src, int width, int height)
+{
+	EncodeBlocks(dst, src, width, height, 8, false);
+}
+
+
+void BlockEncode::EncodeBC3(uint8* dst, const tPixel* src, int width, int height)
+{
+	EncodeBlocks(dst, src, width, height, 16, true);
+}
+
+
+tLayer* BlockEncode::EncodeLayer(tPixelFormat format, const tPixel* src, int width, int height)
+{
+	int numBytes = GetEncodedSize(format, width, height);
+	if (numBytes <= 0)
+		return nullptr;
+
+	uint8* data = new uint8[numBytes];
+	if (format == tPixelFormat::BC1_DXT1)
+		EncodeBC1(data, src, width, height);
+	else
+		EncodeBC3(data, src, width, height);
+
+	return new tLayer(format, width, height, data, true);
+}
@@ -0,0 +1,39 @@
+// BlockEncode.h
+//
+// Fast BC1 (DXT1) and BC3 (DXT5) encoders for display textures. They fit each 4x4 block's colours along the diagonal
+// of its bounding box, flipped to follow the block's dominant colour direction, and pick the nearest palette entry for
+// every texel. Quality is below an offline encoder but good enough for viewing, and each core encodes tens of
+// megapixels a second.
+//
+// Copyright (c) 2021 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <Foundation/tPlatform.h>
+#include <Math/tColour.h>
+#include <Image/tPixelFormat.h>
+#include <Image/tLayer.h>
+namespace BlockEncode
+{
+
+
+// Number of bytes needed for a width x height image in the given format. Only BC1_DXT1 and BC3_DXT5 are supported.
+int GetEncodedSize(tImage::tPixelFormat, int width, int height);
+
+// Encode R8G8B8A8 pixels. Rows are kept in the same order as the source. Partial blocks at the right and last rows
+// repeat the edge pixels. Rows of blocks are spread over the worker pool when called from the main thread.
+void EncodeBC1(uint8* dst, const tPixel* src, int width, int height);
+void EncodeBC3(uint8* dst, const tPixel* src, int width, int height);
+
+// Encodes into a new layer that owns its data. Returns nullptr for unsupported formats.
+tImage::tLayer* EncodeLayer(tImage::tPixelFormat, const tPixel* src, int width, int height);
+
+
+}
@@ -0,0 +1,201 @@
+// CacheWarmer.cpp
+//
+// Fills the thumbnail cache for a whole directory tree from the command line with --warm-thumbnails <dir>. It runs
+// without a window, so it can be scheduled to run overnight and folders open with their thumbnails already cached.
+//
+// Copyright (c) 2021 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <System/tFile.h>
+#include <System/tPrint.h>
+#include "CacheWarmer.h"
+#include "Image.h"
+#include "Settings.h"
+#include "ThumbnailCache.h"
+#include "WorkerPool.h"
+using namespace tSystem;
+using namespace tImage;
+namespace Viewer { extern Settings Config; extern Worker::Pool WorkerPool; extern ThumbnailCache ThumbCache; }
+
+
+namespace CacheWarmer
+{
+	typedef std::chrono::steady_clock Clock;
+	double GetSeconds(Clock::time_point start)																			{ return std::chrono::duration<double>(Clock::now() - start).count(); }
+
+	// Submitting stops while this many jobs are queued so a huge tree doesn't queue a job for every file up front.
+	const int MaxQueued = 1024;
+	const double ProgressInterval = 5.0;
+
+	struct Stats
+	{
+		std::atomic<int> Done			= 0;
+		std::atomic<int> Generated		= 0;
+		std::atomic<int> UpToDate		= 0;
+		std::atomic<int> Failed			= 0;
+		std::atomic<uint64> BytesRead	= 0;			// Source bytes of the generated thumbnails.
+	};
+
+	class WarmJob : public Worker::Job
+	{
+	public:
+		WarmJob(const tString& filename, tFileType filetype, Stats& stats)												: Filename(filename), Filetype(filetype), Counts(stats) { }
+		void Execute() override;
+
+		tString Filename;
+		tFileType Filetype;
+		Stats& Counts;
+	};
+
+	void PrintProgress(const Stats&, int numFound, bool enumerating, Clock::time_point start);
+}
+
+
+void CacheWarmer::WarmJob::Execute()
+{
+	// The key includes the file size and timestamps, so a hit means the entry is up to date.
+	if (Viewer::ThumbCache.Contains(Viewer::Image::GetThumbnailKey(Filename)))
+	{
+		Counts.UpToDate++;
+		Counts.Done++;
+		return;
+	}
+
+	// Generating any level caches the whole pyramid.
+	tPicture thumbnail;
+	if (Viewer::Image::GenerateThumbnail(thumbnail, Filename, Filetype, 0))
+	{
+		tFileInfo fileInfo;
+		if (tGetFileInfo(fileInfo, Filename))
+			Counts.BytesRead += fileInfo.FileSize;
+		Counts.Generated++;
+	}
+	else
+	{
+		tPrintf("Warning: Could not generate thumbnail for %s\n", Filename.Chars());
+		Counts.Failed++;
+	}
+	Counts.Done++;
+}
+
+
+void CacheWarmer::PrintProgress(const Stats& stats, int numFound, bool enumerating, Clock::time_point start)
+{
+	double seconds = GetSeconds(start);
+	int done = stats.Done;
+	tPrintf
+	(
+		"%d/%d%s files. %d generated, %d up to date, %d failed. %.1f files/s.\n",
+		done, numFound, enumerating ? "+" : "", int(stats.Generated), int(stats.UpToDate), int(stats.Failed),
+		(seconds > 0.0) ? double(done)/seconds : 0.0
+	);
+}
+
+
+int CacheWarmer::Run(const tString& rootDir)
+{
+	// The key includes the full path, so it has to be spelled the way the viewer spells it.
+	tString root = tGetSimplifiedPath(tGetAbsolutePath(rootDir, tGetCurrentDir()), true);
+	if (!tDirExists(root))
+	{
+		tPrintf("Thumbnail warming directory %s does not exist.\n", root.Chars());
+		return 1;
+	}
+
+	if (!Viewer::ThumbCache.IsOpen())
+	{
+		tPrintf("Could not open the thumbnail cache in %s\n", Viewer::Image::ThumbCacheDir.Chars());
+		return 1;
+	}
+
+	tPrintf("Warming thumbnails under %s with %d worker threads.\n", root.Chars(), Viewer::WorkerPool.GetNumThreads());
+	tExtensions extensions;
+	Viewer::Image::GetCanLoad(extensions);
+
+	// Directories are listed on the main thread while the workers generate. Listing is cheap next to decoding, and
+	// submitting is main-thread only.
+	Stats stats;
+	int numFound = 0;
+	int numSkipped = 0;
+	Clock::time_point start = Clock::now();
+	Clock::time_point lastProgress = start;
+	std::vector<tString> dirs = { root };
+	while (!dirs.empty())
+	{
+		tString dir = dirs.back();
+		dirs.pop_back();
+
+		tList<tStringItem> foundDirs;
+		tFindDirs(foundDirs, dir, false);
+		for (tStringItem* sub = foundDirs.First(); sub; sub = sub->Next())
+			dirs.push_back(*sub);
+
+		tList<tStringItem> foundFiles;
+		tFindFiles(foundFiles, dir, extensions);
+		for (tStringItem* file = foundFiles.First(); file; file = file->Next())
+		{
+			// Dds thumbnails need an OpenGL context to decode and there is no window here. They are left for the
+			// viewer to generate.
+			tFileType filetype = tGetFileType(*file);
+			if (filetype == tFileType::DDS)
+			{
+				numSkipped++;
+				continue;
+			}
+
+			while (Viewer::WorkerPool.GetNumQueued() >= MaxQueued)
+			{
+				Viewer::WorkerPool.DrainCompleted();
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+
+			Viewer::WorkerPool.Submit(new WarmJob(*file, filetype, stats));
+			numFound++;
+
+			if (GetSeconds(lastProgress) >= ProgressInterval)
+			{
+				PrintProgress(stats, numFound, true, start);
+				lastProgress = Clock::now();
+			}
+		}
+		Viewer::WorkerPool.DrainCompleted();
+	}
+
+	while (stats.Done < numFound)
+	{
+		Viewer::WorkerPool.DrainCompleted();
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		if (GetSeconds(lastProgress) >= ProgressInterval)
+		{
+			PrintProgress(stats, numFound, false, start);
+			lastProgress = Clock::now();
+		}
+	}
+	Viewer::WorkerPool.DrainCompleted();
+
+	double seconds = GetSeconds(start);
+	int generated = stats.Generated;
+	double megabytes = double(stats.BytesRead) / (1024.0*1024.0);
+	tPrintf("Done in %.1fs.\n", seconds);
+	tPrintf("Files      : %d found, %d generated, %d up to date, %d failed, %d dds skipped.\n", numFound, generated, int(stats.UpToDate), int(stats.Failed), numSkipped);
+	tPrintf("Throughput : %.1f files/s, %.1f thumbnails/s, %.1f MB/s of source images.\n", double(numFound)/seconds, double(generated)/seconds, megabytes/seconds);
+	int numEntries = Viewer::ThumbCache.GetNumEntries();
+	tPrintf("Cache      : %d entries, %.1f MB in %s\n", numEntries, double(Viewer::ThumbCache.GetDiskSize())/(1024.0*1024.0), Viewer::Image::ThumbCacheDir.Chars());
+
+	// The viewer trims the cache to MaxCacheFiles when it exits, least recently used first.
+	if (numEntries > Viewer::Config.MaxCacheFiles)
+		tPrintf("Warning: The cache holds more than the %d thumbnails allowed by the Max Cache Files setting. The oldest will be evicted the next time the viewer exits.\n", Viewer::Config.MaxCacheFiles);
+
+	return 0;
+}
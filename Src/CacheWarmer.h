@@ -0,0 +1,28 @@
+// CacheWarmer.h
+//
+// Fills the thumbnail cache for a whole directory tree from the command line with --warm-thumbnails <dir>. It runs
+// without a window, so it can be scheduled to run overnight and folders open with their thumbnails already cached.
+//
+// Copyright (c) 2021 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <Foundation/tString.h>
+namespace CacheWarmer
+{
+
+
+// Generates and caches thumbnails for every loadable image under rootDir, recursively. Files that already have an
+// up-to-date cache entry are skipped. Expects the worker pool to be started and the thumbnail cache to be open.
+// Returns the process exit code.
+int Run(const tString& rootDir);
+
+
+}
@@ -0,0 +1,582 @@
+// Compress.cpp
+//
+// Small in-memory codecs used for cached data. Includes an LZ4 block-format compressor/decompressor and a picture
+// codec built on top of it with lossless and lossy (chroma subsampled) modes.
+//
+// Copyright (c) 2021 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <cstring>
+#include <Foundation/tStandard.h>
+#include <Foundation/tFundamentals.h>
+#include "Compress.h"
+using namespace tImage;
+
+
+namespace Compress
+{
+	const char* MethodNames[int(Method::NumMethods)] = { "None", "Lossless", "Lossy" };
+
+	// LZ4 block format constants. The last match must start at least MFLimit bytes before the end and the last
+	// LastLiterals bytes are always literals.
+	const int MinMatch							= 4;
+	const int LastLiterals						= 5;
+	const int MFLimit							= 12;
+	const int MaxOffset							= 65535;
+	const int HashLog							= 14;
+
+	inline uint32 Read32(const uint8* p)																				{ uint32 v; memcpy(&v, p, 4); return v; }
+	inline uint32 Hash(uint32 sequence)																					{ return (sequence * 2654435761u) >> (32 - HashLog); }
+	bool WriteLength(uint8*& op, const uint8* oend, int length);
+	bool ReadLength(const uint8*& ip, const uint8* iend, int& length, int limit);
+
+	struct PictureHeader
+	{
+		uint32 Magic;
+		uint8 EncodeMethod;
+		uint8 Pad[3];
+		int32 Width;
+		int32 Height;
+		int32 PlaneBytes;			// Size of the planar data before LZ4. Unused for Raw.
+	};
+	const uint32 PictureMagic					= 0x50435654;		// TVCP.
+
+	void EncodePlanesLossless(uint8* planes, const tPixel* pixels, int w, int h);
+	void DecodePlanesLossless(tPixel* pixels, const uint8* planes, int w, int h);
+	void EncodePlanesLossy(uint8* planes, const tPixel* pixels, int w, int h);
+	void DecodePlanesLossy(tPixel* pixels, const uint8* planes, int w, int h);
+	void DeltaEncode(uint8* plane, int w, int h);
+	void DeltaDecode(uint8* plane, int w, int h);
+	void QuantizedDeltaEncode(uint8* plane, int w, int h, int step);
+	void QuantizedDeltaDecode(uint8* plane, int w, int h, int step);
+	const int LossyLumaStep						= 3;				// Reconstructed luma is within 1 of the original.
+	const int LossyChromaStep					= 3;
+	int GetPlaneBytes(Method, int w, int h);
+}
+
+
+bool Compress::WriteLength(uint8*& op, const uint8* oend, int length)
+{
+	// Writes the extra bytes of a length whose nibble in the token was saturated at 15.
+	length -= 15;
+	while (length >= 255)
+	{
+		if (op >= oend)
+			return false;
+		*op++ = 255;
+		length -= 255;
+	}
+	if (op >= oend)
+		return false;
+	*op++ = uint8(length);
+	return true;
+}
+
+
+bool Compress::ReadLength(const uint8*& ip, const uint8* iend, int& length, int limit)
+{
+	uint8 b;
+	do
+	{
+		if ((ip >= iend) || (length > limit))
+			return false;
+		b = *ip++;
+		length += b;
+	}
+	while (b == 255);
+	return true;
+}
+
+
+int Compress::LZ4Bound(int srcSize)
+{
+	if (srcSize < 0)
+		return 0;
+	return srcSize + srcSize/255 + 16;
+}
+
+
+int Compress::LZ4Compress(const uint8* src, int srcSize, uint8* dst, int dstCapacity)
+{
+	if (!src || !dst || (srcSize < 0))
+		return 0;
+
+	const uint8* ip = src;
+	const uint8* anchor = src;
+	const uint8* iend = src + srcSize;
+	uint8* op = dst;
+	const uint8* oend = dst + dstCapacity;
+
+	if (srcSize > MFLimit)
+	{
+		const uint8* mflimit = iend - MFLimit;
+		const uint8* matchlimit = iend - LastLiterals;
+
+		// Positions are stored plus one so zero means empty.
+		std::vector<int> table(1 << HashLog, 0);
+		int misses = 0;
+		while (ip < mflimit)
+		{
+			uint32 sequence = Read32(ip);
+			uint32 h = Hash(sequence);
+			int candidate = table[h] - 1;
+			int pos = int(ip - src);
+			table[h] = pos + 1;
+			if ((candidate < 0) || ((pos - candidate) > MaxOffset) || (Read32(src + candidate) != sequence))
+			{
+				// Step faster through data that isn't matching. This is the LZ4 acceleration heuristic.
+				ip += 1 + (misses++ >> 6);
+				continue;
+			}
+			misses = 0;
+
+			const uint8* match = src + candidate;
+			while ((ip > anchor) && (match > src) && (ip[-1] == match[-1]))
+			{
+				ip--;
+				match--;
+			}
+
+			const uint8* mp = ip + MinMatch;
+			const uint8* mm = match + MinMatch;
+			while ((mp + 8 <= matchlimit) && !memcmp(mp, mm, 8))
+			{
+				mp += 8;
+				mm += 8;
+			}
+			while ((mp < matchlimit) && (*mp == *mm))
+			{
+				mp++;
+				mm++;
+			}
+
+			int literalLength = int(ip - anchor);
+			int matchLength = int(mp - ip) - MinMatch;
+			int offset = int(ip - match);
+
+			// Token, literals, offset. The length extensions are checked as they are written.
+			if ((oend - op) < (1 + literalLength + 2))
+				return 0;
+			uint8* token = op++;
+			*token = uint8(((literalLength >= 15) ? 15 : literalLength) << 4);
+			if ((literalLength >= 15) && !WriteLength(op, oend, literalLength))
+				return 0;
+			if ((oend - op) < (literalLength + 2))
+				return 0;
+			memcpy(op, anchor, literalLength);
+			op += literalLength;
+			*op++ = uint8(offset & 0xFF);
+			*op++ = uint8(offset >> 8);
+			*token |= uint8((matchLength >= 15) ? 15 : matchLength);
+			if ((matchLength >= 15) && !WriteLength(op, oend, matchLength))
+				return 0;
+
+			ip = mp;
+			anchor = ip;
+			if (ip < mflimit)
+				table[Hash(Read32(ip - 2))] = int(ip - 2 - src) + 1;
+		}
+	}
+
+	// The final sequence is literals only.
+	int literalLength = int(iend - anchor);
+	if ((oend - op) < 1)
+		return 0;
+	uint8* token = op++;
+	*token = uint8(((literalLength >= 15) ? 15 : literalLength) << 4);
+	if ((literalLength >= 15) && !WriteLength(op, oend, literalLength))
+		return 0;
+	if ((oend - op) < literalLength)
+		return 0;
+	memcpy(op, anchor, literalLength);
+	op += literalLength;
+
+	return int(op - dst);
+}
+
+
+int Compress::LZ4Decompress(const uint8* src, int srcSize, uint8* dst, int dstCapacity)
+{
+	if (!src || !dst || (srcSize <= 0) || (dstCapacity < 0))
+		return -1;
+
+	const uint8* ip = src;
+	const uint8* iend = src + srcSize;
+	uint8* op = dst;
+	uint8* oend = dst + dstCapacity;
+
+	while (ip < iend)
+	{
+		int token = *ip++;
+		int literalLength = token >> 4;
+		if ((literalLength == 15) && !ReadLength(ip, iend, literalLength, dstCapacity))
+			return -1;
+		if ((literalLength > (iend - ip)) || (literalLength > (oend - op)))
+			return -1;
+		memcpy(op, ip, literalLength);
+		op += literalLength;
+		ip += literalLength;
+
+		// The last sequence has no match part.
+		if (ip >= iend)
+			break;
+
+		if ((iend - ip) < 2)
+			return -1;
+		int offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if ((offset == 0) || (offset > (op - dst)))
+			return -1;
+
+		int matchLength = token & 15;
+		if ((matchLength == 15) && !ReadLength(ip, iend, matchLength, dstCapacity))
+			return -1;
+		matchLength += MinMatch;
+		if (matchLength > (oend - op))
+			return -1;
+
+		const uint8* match = op - offset;
+		if (offset >= matchLength)
+		{
+			memcpy(op, match, matchLength);
+			op += matchLength;
+		}
+		else
+		{
+			// Overlapping copies repeat the pattern so they must go a byte at a time.
+			for (int b = 0; b < matchLength; b++)
+				*op++ = *match++;
+		}
+	}
+
+	return int(op - dst);
+}
+
+
+void Compress::DeltaEncode(uint8* plane, int w, int h)
+{
+	// Each byte becomes the difference from its left neighbour. Smooth images turn into runs of small values that LZ4
+	// finds far more matches in. Working right to left means no temporary row is needed.
+	for (int y = 0; y < h; y++)
+	{
+		uint8* row = plane + y*w;
+		for (int x = w-1; x > 0; x--)
+			row[x] = uint8(row[x] - row[x-1]);
+	}
+}
+
+
+void Compress::DeltaDecode(uint8* plane, int w, int h)
+{
+	for (int y = 0; y < h; y++)
+	{
+		uint8* row = plane + y*w;
+		for (int x = 1; x < w; x++)
+			row[x] = uint8(row[x] + row[x-1]);
+	}
+}
+
+
+void Compress::QuantizedDeltaEncode(uint8* plane, int w, int h, int step)
+{
+	// Near-lossless DPCM. The difference from the reconstructed left neighbour is rounded to a multiple of step, so the
+	// error never exceeds step/2 and small gradients collapse into repeated values. The prediction must use the value
+	// the decoder will see, not the original, or the error would accumulate along the row.
+	for (int y = 0; y < h; y++)
+	{
+		uint8* row = plane + y*w;
+		int recon = 128;
+		for (int x = 0; x < w; x++)
+		{
+			int diff = int(row[x]) - recon;
+			int q = (diff >= 0) ? (diff + step/2) / step : -((-diff + step/2) / step);
+			recon = tMath::tClamp(recon + q*step, 0, 255);
+			row[x] = uint8(int8(q));
+		}
+	}
+}
+
+
+void Compress::QuantizedDeltaDecode(uint8* plane, int w, int h, int step)
+{
+	for (int y = 0; y < h; y++)
+	{
+		uint8* row = plane + y*w;
+		int recon = 128;
+		for (int x = 0; x < w; x++)
+		{
+			recon = tMath::tClamp(recon + int(int8(row[x]))*step, 0, 255);
+			row[x] = uint8(recon);
+		}
+	}
+}
+
+
+int Compress::GetPlaneBytes(Method method, int w, int h)
+{
+	switch (method)
+	{
+		case Method::Lossless:
+			return w*h*4;
+
+		case Method::Lossy:
+		{
+			int cw = (w+1)/2;
+			int ch = (h+1)/2;
+			return w*h*2 + cw*ch*2;
+		}
+
+		default:
+			return 0;
+	}
+}
+
+
+void Compress::EncodePlanesLossless(uint8* planes, const tPixel* pixels, int w, int h)
+{
+	int n = w*h;
+	uint8* r = planes;
+	uint8* g = r + n;
+	uint8* b = g + n;
+	uint8* a = b + n;
+	for (int p = 0; p < n; p++)
+	{
+		r[p] = pixels[p].R;
+		g[p] = pixels[p].G;
+		b[p] = pixels[p].B;
+		a[p] = pixels[p].A;
+	}
+
+	for (int c = 0; c < 4; c++)
+		DeltaEncode(planes + c*n, w, h);
+}
+
+
+void Compress::DecodePlanesLossless(tPixel* pixels, const uint8* planes, int w, int h)
+{
+	int n = w*h;
+	const uint8* r = planes;
+	const uint8* g = r + n;
+	const uint8* b = g + n;
+	const uint8* a = b + n;
+	for (int p = 0; p < n; p++)
+	{
+		pixels[p].R = r[p];
+		pixels[p].G = g[p];
+		pixels[p].B = b[p];
+		pixels[p].A = a[p];
+	}
+}
+
+
+void Compress::EncodePlanesLossy(uint8* planes, const tPixel* pixels, int w, int h)
+{
+	// Y and A are kept at full resolution. Co and Cg are averaged over 2x2 blocks. Eyes are much less sensitive to
+	// chroma detail, and at thumbnail sizes the difference is hard to spot. Luma and chroma residuals are also quantized.
+	int cw = (w+1)/2;
+	int ch = (h+1)/2;
+	uint8* yPlane = planes;
+	uint8* aPlane = yPlane + w*h;
+	uint8* coPlane = aPlane + w*h;
+	uint8* cgPlane = coPlane + cw*ch;
+
+	for (int p = 0; p < w*h; p++)
+	{
+		int r = pixels[p].R; int g = pixels[p].G; int b = pixels[p].B;
+		yPlane[p] = uint8((r + 2*g + b + 2) >> 2);
+		aPlane[p] = pixels[p].A;
+	}
+
+	for (int cy = 0; cy < ch; cy++)
+	{
+		for (int cx = 0; cx < cw; cx++)
+		{
+			int sumCo = 0, sumCg = 0, count = 0;
+			for (int y = 2*cy; y < tMath::tMin(2*cy+2, h); y++)
+			{
+				for (int x = 2*cx; x < tMath::tMin(2*cx+2, w); x++)
+				{
+					const tPixel& pix = pixels[y*w + x];
+					sumCo += int(pix.R) - int(pix.B);
+					sumCg += 2*int(pix.G) - int(pix.R) - int(pix.B);
+					count++;
+				}
+			}
+
+			// Co is in [-255, 255] and Cg in [-510, 510]. Halve and quarter them to fit a byte around 128.
+			int co = 128 + (sumCo / (2*count));
+			int cg = 128 + (sumCg / (4*count));
+			coPlane[cy*cw + cx] = uint8(tMath::tClamp(co, 0, 255));
+			cgPlane[cy*cw + cx] = uint8(tMath::tClamp(cg, 0, 255));
+		}
+	}
+
+	QuantizedDeltaEncode(yPlane, w, h, LossyLumaStep);
+	DeltaEncode(aPlane, w, h);
+	QuantizedDeltaEncode(coPlane, cw, ch, LossyChromaStep);
+	QuantizedDeltaEncode(cgPlane, cw, ch, LossyChromaStep);
+}
+
+
+void Compress::DecodePlanesLossy(tPixel* pixels, const uint8* planes, int w, int h)
+{
+	int cw = (w+1)/2;
+	const uint8* yPlane = planes;
+	const uint8* aPlane = yPlane + w*h;
+	const uint8* coPlane = aPlane + w*h;
+	const uint8* cgPlane = coPlane + cw*((h+1)/2);
+
+	for (int y = 0; y < h; y++)
+	{
+		const uint8* coRow = coPlane + (y/2)*cw;
+		const uint8* cgRow = cgPlane + (y/2)*cw;
+		for (int x = 0; x < w; x++)
+		{
+			int p = y*w + x;
+			int lum = yPlane[p];
+			int co = 2*(int(coRow[x/2]) - 128);
+			int cg = 4*(int(cgRow[x/2]) - 128);
+
+			// Y = (R + 2G + B)/4, Co = R - B, Cg = 2G - R - B.
+			int g = lum + cg/4;
+			int t = lum - cg/4;
+			int r = t + co/2;
+			int b = t - co/2;
+			pixels[p].R = uint8(tMath::tClamp(r, 0, 255));
+			pixels[p].G = uint8(tMath::tClamp(g, 0, 255));
+			pixels[p].B = uint8(tMath::tClamp(b, 0, 255));
+			pixels[p].A = aPlane[p];
+		}
+	}
+}
+
+
+bool Compress::EncodePicture(std::vector<uint8>& dst, const tPicture& picture, Method method)
+{
+	if (!picture.IsValid() || (method >= Method::NumMethods))
+		return false;
+
+	int w = picture.GetWidth();
+	int h = picture.GetHeight();
+	const tPixel* pixels = picture.GetPixels();
+	int rawBytes = w*h*int(sizeof(tPixel));
+
+	PictureHeader header;
+	memset(&header, 0, sizeof(header));
+	header.Magic = PictureMagic;
+	header.EncodeMethod = uint8(method);
+	header.Width = w;
+	header.Height = h;
+
+	size_t start = dst.size();
+	if (method == Method::Raw)
+	{
+		dst.resize(start + sizeof(header) + rawBytes);
+		memcpy(dst.data() + start, &header, sizeof(header));
+		memcpy(dst.data() + start + sizeof(header), pixels, rawBytes);
+		return true;
+	}
+
+	int planeBytes = GetPlaneBytes(method, w, h);
+	std::vector<uint8> planes(planeBytes);
+	if (method == Method::Lossless)
+		EncodePlanesLossless(planes.data(), pixels, w, h);
+	else
+		EncodePlanesLossy(planes.data(), pixels, w, h);
+
+	header.PlaneBytes = planeBytes;
+	int bound = LZ4Bound(planeBytes);
+	dst.resize(start + sizeof(header) + bound);
+	int packed = LZ4Compress(planes.data(), planeBytes, dst.data() + start + sizeof(header), bound);
+	if (packed <= 0)
+	{
+		dst.resize(start);
+		return false;
+	}
+
+	memcpy(dst.data() + start, &header, sizeof(header));
+	dst.resize(start + sizeof(header) + packed);
+	return true;
+}
+
+
+Compress::Method Compress::GetMethod(const uint8* src, int srcSize)
+{
+	if (!src || (srcSize < int(sizeof(PictureHeader))))
+		return Method::NumMethods;
+
+	PictureHeader header;
+	memcpy(&header, src, sizeof(header));
+	if ((header.Magic != PictureMagic) || (header.EncodeMethod >= uint8(Method::NumMethods)))
+		return Method::NumMethods;
+
+	return Method(header.EncodeMethod);
+}
+
+
+bool Compress::DecodePicture(tPicture& picture, const uint8* src, int srcSize)
+{
+	Method method = GetMethod(src, srcSize);
+	if (method == Method::NumMethods)
+		return false;
+
+	PictureHeader header;
+	memcpy(&header, src, sizeof(header));
+	int w = header.Width;
+	int h = header.Height;
+	if ((w <= 0) || (h <= 0) || (w > 0x4000) || (h > 0x4000))
+		return false;
+
+	const uint8* payload = src + sizeof(header);
+	int payloadBytes = srcSize - int(sizeof(header));
+	tPixel* pixels = new tPixel[w*h];
+
+	bool ok = false;
+	if (method == Method::Raw)
+	{
+		ok = (payloadBytes == w*h*int(sizeof(tPixel)));
+		if (ok)
+			memcpy(pixels, payload, payloadBytes);
+	}
+	else if (header.PlaneBytes == GetPlaneBytes(method, w, h))
+	{
+		std::vector<uint8> planes(header.PlaneBytes);
+		int unpacked = LZ4Decompress(payload, payloadBytes, planes.data(), header.PlaneBytes);
+		if (unpacked == header.PlaneBytes)
+		{
+			if (method == Method::Lossless)
+			{
+				for (int c = 0; c < 4; c++)
+					DeltaDecode(planes.data() + c*w*h, w, h);
+				DecodePlanesLossless(pixels, planes.data(), w, h);
+			}
+			else
+			{
+				int cw = (w+1)/2;
+				int ch = (h+1)/2;
+				QuantizedDeltaDecode(planes.data(), w, h, LossyLumaStep);
+				DeltaDecode(planes.data() + w*h, w, h);
+				QuantizedDeltaDecode(planes.data() + 2*w*h, cw, ch, LossyChromaStep);
+				QuantizedDeltaDecode(planes.data() + 2*w*h + cw*ch, cw, ch, LossyChromaStep);
+				DecodePlanesLossy(pixels, planes.data(), w, h);
+			}
+			ok = true;
+		}
+	}
+
+	if (!ok)
+	{
+		delete[] pixels;
+		return false;
+	}
+
+	picture.Set(w, h, pixels, false);
+	return true;
+}
@@ -0,0 +1,53 @@
+// Compress.h
+//
+// Small in-memory codecs used for cached data. Includes an LZ4 block-format compressor/decompressor and a picture
+// codec built on top of it with lossless and lossy (chroma subsampled) modes.
+//
+// Copyright (c) 2021 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <vector>
+#include <Foundation/tPlatform.h>
+#include <Image/tPicture.h>
+namespace Compress
+{
+
+
+// LZ4 block format. The output is compatible with LZ4_decompress_safe. Compress returns the number of bytes written,
+// or 0 if dst is too small. Use LZ4Bound to size dst. Decompress returns the number of bytes written to dst, or -1 if
+// the input is malformed or dst is too small.
+int LZ4Bound(int srcSize);
+int LZ4Compress(const uint8* src, int srcSize, uint8* dst, int dstCapacity);
+int LZ4Decompress(const uint8* src, int srcSize, uint8* dst, int dstCapacity);
+
+
+// Picture codec. Raw stores RGBA as is. Lossless splits the channels into planes, delta-codes each row and LZ4s the
+// result. Lossy converts to YCoCg with 2x2 subsampled chroma (alpha stays full resolution) before doing the same.
+enum class Method
+{
+	Raw,
+	Lossless,
+	Lossy,
+	NumMethods
+};
+extern const char* MethodNames[int(Method::NumMethods)];
+
+// Appends the encoded picture to dst. Returns false if the picture is invalid.
+bool EncodePicture(std::vector<uint8>& dst, const tImage::tPicture&, Method);
+
+// Decodes a picture encoded with any method. Returns false on malformed data.
+bool DecodePicture(tImage::tPicture&, const uint8* src, int srcSize);
+
+// The method a previously encoded buffer used, or NumMethods if it isn't one of ours.
+Method GetMethod(const uint8* src, int srcSize);
+
+
+}
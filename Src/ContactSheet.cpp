@@ -18,6 +18,8 @@
 #include "OpenSaveDialogs.h"
 #include "TacentView.h"
 #include "Image.h"
+#include "Downscale.h"
+#include "Resampler.h"
 using namespace tStd;
 using namespace tMath;
 using namespace tSystem;
@@ -53,10 +55,8 @@ void Viewer::DoContactSheetModal(bool saveContactSheetPressed)
 	static int finalWidth = 2048;
 	static int finalHeight = 2048;
 	tAssert(CurrImage);
-	tPicture* picture = CurrImage->GetCurrentPic();
-	tAssert(picture);
-	int picW = picture->GetWidth();
-	int picH = picture->GetHeight();
+	int picW = CurrImage->GetCurrentFrameWidth();
+	int picH = CurrImage->GetCurrentFrameHeight();
 	if (saveContactSheetPressed)
 	{
 		frameWidth = picW;
@@ -221,9 +221,6 @@ void Viewer::SaveContactSheetTo
 	// Do the work.
 	int frameWidth = contactWidth / numCols;
 	int frameHeight = contactHeight / numRows;
-	int ix = 0;
-	int iy = 0;
-	int frame = 0;
 
 	tPrintf("Loading all frames...\n");
 	bool allOpaque = true;
@@ -236,25 +233,28 @@ void Viewer::SaveContactSheetTo
 			allOpaque = false;
 	}
 
-	Image* currImg = Images.First();
-	while (currImg)
+	// Frames are box halved one at a time as they're copied, then all the final resamples run as one batch.
+	tImage::tResampleFilter filter = tImage::tResampleFilter(Config.ResampleFilter);
+	tList<tImage::tPicture> frames;
+	std::vector<Image*> frameImages;
+	for (Image* img = Images.First(); img && (int(frameImages.size()) < numCols*numRows); img = img->Next())
 	{
-		if (!currImg->IsLoaded())
-		{
-			currImg = currImg->Next();
+		if (!img->IsLoaded())
 			continue;
-		}
 
-		tPrintf("Processing frame %d : %s at (%d, %d).\n", frame, currImg->Filename.Chars(), ix, iy);
-		frame++;
-		tImage::tPicture* currPic = currImg->GetCurrentPic();
+		tImage::tPicture* resampled = new tImage::tPicture(*img->GetCurrentPic());
+		Downscale::HalveToward(*resampled, frameWidth, frameHeight, filter);
+		frames.Append(resampled);
+		frameImages.push_back(img);
+	}
+	Resampler::Resample(frames, frameWidth, frameHeight, filter, tImage::tResampleEdgeMode(Config.ResampleEdgeMode));
 
-		tImage::tPicture resampled;
-		if ((currImg->GetWidth() != frameWidth) || (currImg->GetHeight() != frameHeight))
-		{
-			resampled.Set(*currPic);
-			resampled.Resample(frameWidth, frameHeight, tImage::tResampleFilter(Config.ResampleFilter), tImage::tResampleEdgeMode(Config.ResampleEdgeMode));
-		}
+	int frame = 0;
+	for (tImage::tPicture* resampled = frames.First(); resampled; resampled = resampled->Next(), frame++)
+	{
+		int ix = frame % numCols;
+		int iy = frame / numCols;
+		tPrintf("Processing frame %d : %s at (%d, %d).\n", frame, frameImages[frame]->Filename.Chars(), ix, iy);
 
 		// Copy resampled frame into place.
 		for (int y = 0; y < frameHeight; y++)
@@ -263,19 +263,8 @@ void Viewer::SaveContactSheetTo
 				(
 					x + (ix*frameWidth),
 					y + ((numRows-1-iy)*frameHeight),
-					resampled.IsValid() ? resampled.GetPixel(x, y) : currPic->GetPixel(x, y)
+					resampled->GetPixel(x, y)
 				);
-
-		currImg = currImg->Next();
-
-		ix++;
-		if (ix >= numCols)
-		{
-			ix = 0;
-			iy++;
-			if (iy >= numRows)
-				break;
-		}
 	}
 
 	tImage::tPicture::tColourFormat colourFmt = allOpaque ? tImage::tPicture::tColourFormat::Colour : tImage::tPicture::tColourFormat::ColourAndAlpha;
@@ -290,7 +279,7 @@ void Viewer::SaveContactSheetTo
 	else
 	{
 		tImage::tPicture finalResampled(outPic);
-		finalResampled.Resample(finalWidth, finalHeight, tImage::tResampleFilter(Config.ResampleFilter), tImage::tResampleEdgeMode(Config.ResampleEdgeMode));
+		Downscale::Reduce(finalResampled, finalWidth, finalHeight, tImage::tResampleFilter(Config.ResampleFilter), tImage::tResampleEdgeMode(Config.ResampleEdgeMode));
 
 		if (Config.SaveFileType == 0)
 			finalResampled.SaveTGA(outFile, tgaFmt, Config.SaveFileTargaRLE ? tImage::tImageTGA::tCompression::RLE : tImage::tImageTGA::tCompression::None);
@@ -18,9 +18,86 @@
 #include "ContentView.h"
 #include "TacentView.h"
 #include "Image.h"
+#include "ThumbnailAtlas.h"
 using namespace tMath;
 
 
+namespace Viewer
+{
+	// Thumbnail scheduling. Distances are in multiples of the visible height of the thumbnail area. Thumbnails are
+	// prefetched further ahead in the scroll direction than behind it. Queued jobs beyond the cancel distance are
+	// dropped so fast scrolling doesn't leave stale work in front of what is on screen.
+	const float ThumbLookaheadAhead			= 1.0f;
+	const float ThumbLookaheadBehind		= 0.25f;
+	const float ThumbCancelDistance			= 2.0f;
+
+	// Priority tiers. Fully visible rows are filled before partially visible ones, which come before lookahead. Within
+	// the visible tiers thumbnails fill in reading order. Within lookahead, nearer ones go first.
+	const int ThumbPriorityFullyVisible		= 0x20000000;
+	const int ThumbPriorityPartlyVisible	= 0x10000000;
+	const int ThumbPriorityLookahead		= 0x00000000;
+
+	int GetThumbnailPriority(float itemTop, float itemBottom, float viewTop, float viewBottom, int scrollDir, int thumbNum, bool& inRange);
+
+	// Shortens text with a trailing ellipsis so it fits in width. Thumbnail items aren't child windows so nothing
+	// clips long filenames for us.
+	tString GetFittedText(const tString& text, float width);
+}
+
+
+int Viewer::GetThumbnailPriority(float itemTop, float itemBottom, float viewTop, float viewBottom, int scrollDir, int thumbNum, bool& inRange)
+{
+	inRange = true;
+	if ((itemTop >= viewTop) && (itemBottom <= viewBottom))
+		return ThumbPriorityFullyVisible - thumbNum;
+
+	if ((itemBottom > viewTop) && (itemTop < viewBottom))
+		return ThumbPriorityPartlyVisible - thumbNum;
+
+	// Off screen. Work out how far away the item is and whether it is ahead of or behind the scroll direction.
+	float viewH = viewBottom - viewTop;
+	bool below = (itemTop >= viewBottom);
+	float dist = below ? (itemTop - viewBottom) : (viewTop - itemBottom);
+	bool ahead = below ? (scrollDir >= 0) : (scrollDir < 0);
+	float lookahead = viewH * (ahead ? ThumbLookaheadAhead : ThumbLookaheadBehind);
+	if (dist > lookahead)
+	{
+		inRange = false;
+		return ThumbPriorityLookahead;
+	}
+
+	// Behind counts as further away so ahead rows at the same distance win.
+	return ThumbPriorityLookahead - int(ahead ? dist : dist*2.0f);
+}
+
+
+tString Viewer::GetFittedText(const tString& text, float width)
+{
+	if (ImGui::CalcTextSize(text.Chars()).x <= width)
+		return text;
+
+	// Binary search for the longest prefix that fits with the ellipsis.
+	const char* ellipsis = "...";
+	float ellipsisWidth = ImGui::CalcTextSize(ellipsis).x;
+	int lo = 0;
+	int hi = text.Length();
+	while (lo < hi)
+	{
+		int mid = (lo + hi + 1) / 2;
+		if (ImGui::CalcTextSize(text.Chars(), text.Chars() + mid).x + ellipsisWidth <= width)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+
+	// Don't cut a UTF-8 sequence in half.
+	while ((lo > 0) && ((uint8(text.Chars()[lo]) & 0xC0) == 0x80))
+		lo--;
+
+	return text.Left(lo) + ellipsis;
+}
+
+
 void Viewer::ShowContentViewDialog(bool* popen)
 {
 	ImGuiWindowFlags windowFlags = ImGuiWindowFlags_NoScrollbar;
@@ -47,6 +124,31 @@ void Viewer::ShowContentViewDialog(bool* popen)
 	float extra = ImGui::GetWindowContentRegionMax().x - (float(numPerRow) * (Config.ThumbnailWidth + minSpacing));
 	ImGui::PushStyleVar(ImGuiStyleVar_ItemSpacing, tVector2(minSpacing + extra/float(numPerRow), minSpacing));
 	tVector2 thumbButtonSize(Config.ThumbnailWidth, Config.ThumbnailWidth*9.0f/16.0f); // 64 36, 32 18,
+	tVector2 thumbItemSize = thumbButtonSize + tVector2(0.0f, 32.0f);
+	int thumbLevel = Image::GetThumbLevel(thumbButtonSize.x);
+
+	// The visible range is in the same content-space coordinates as GetCursorPos. The scroll direction sticks to the
+	// last direction moved so lookahead doesn't flip when scrolling stops.
+	static float lastScrollY = 0.0f;
+	static int scrollDir = 1;
+	float viewTop = ImGui::GetScrollY();
+	float viewBottom = viewTop + ImGui::GetWindowHeight();
+	if (viewTop != lastScrollY)
+		scrollDir = (viewTop > lastScrollY) ? 1 : -1;
+	lastScrollY = viewTop;
+	float cancelDist = ThumbCancelDistance * (viewBottom - viewTop);
+
+	// Thumbnails are drawn from a few atlas pages. Draws are split into channels so ImGui can merge everything using
+	// the same texture: button frames first, then one channel per atlas page, one for the default thumbnail, and text
+	// and decorations last. That keeps the draw call count down to roughly the number of pages.
+	ThumbAtlas.BeginFrame();
+	ImDrawList* drawList = ImGui::GetWindowDrawList();
+	const int frameChannel = 0;
+	const int defaultChannel = 1 + ThumbnailAtlas::MaxPages;
+	const int textChannel = defaultChannel + 1;
+	drawList->ChannelsSplit(textChannel + 1);
+	ImU32 tint = ImGui::GetColorU32(ColourEnabledTint);
+
 	int thumbNum = 0;
 	for (Image* i = Images.First(); i; i = i->Next(), thumbNum++)
 	{
@@ -55,30 +157,61 @@ void Viewer::ShowContentViewDialog(bool* popen)
 			ImGui::SetCursorPos(tVector2(0.5f*extra/float(numPerRow), cursor.y));
 
 		ImGui::PushID(thumbNum);
-		ImGui::PushStyleVar(ImGuiStyleVar_WindowPadding, tVector2::zero);
 		bool isCurr = (i == CurrImage);
 
-		// Unlike other widgets, BeginChild ALWAYS needs a corresponding EndChild, even if it's invisible.
-		bool visible = ImGui::BeginChild("ThumbItem", thumbButtonSize+tVector2(0.0, 32.0f), false, ImGuiWindowFlags_NoDecoration);
+		// Schedule by distance to the visible range rather than by what ImGui happens to report visible. Queued jobs
+		// that are now far away are cancelled. Between the lookahead and cancel distances we leave things alone.
+		float itemTop = ImGui::GetCursorPosY();
+		float itemBottom = itemTop + thumbItemSize.y;
+		bool inRange = false;
+		int priority = GetThumbnailPriority(itemTop, itemBottom, viewTop, viewBottom, scrollDir, thumbNum, inRange);
+		if (inRange)
+			i->RequestThumbnail(priority, thumbLevel);
+		else if ((itemTop - viewBottom > cancelDist) || (viewTop - itemBottom > cancelDist))
+			i->UnrequestThumbnail();
+
+		// Items are groups rather than child windows. Each child window gets its own draw list, which would stop the
+		// thumbnails from batching.
+		ImGui::BeginGroup();
+		tVector2 itemMin = ImGui::GetCursorScreenPos();
+		bool visible = ImGui::IsRectVisible(thumbItemSize);
 		if (visible)
 		{
-			i->RequestThumbnail();
-			uint64 thumbnailTexID = i->BindThumbnail();
+			tVector2 uv0(0.0f, 1.0f);
+			tVector2 uv1(1.0f, 0.0f);
+			int atlasPage = -1;
+			uint64 thumbnailTexID = i->BindThumbnail(uv0, uv1, atlasPage);
+			int imageChannel = 1 + atlasPage;
 			if (!thumbnailTexID)
+			{
 				thumbnailTexID = DefaultThumbnailImage.Bind();
-			if
-			(
-				thumbnailTexID &&
-				ImGui::ImageButton(ImTextureID(thumbnailTexID), thumbButtonSize, tVector2(0,1), tVector2(1,0), 0,
-				ColourBG, ColourEnabledTint)
-			)
+				uv0.Set(0.0f, 1.0f);
+				uv1.Set(1.0f, 0.0f);
+				imageChannel = defaultChannel;
+			}
+
+			// This is what ImageButton draws, split across channels.
+			tVector2 buttonMin = ImGui::GetCursorScreenPos();
+			tVector2 buttonMax = buttonMin + thumbButtonSize;
+			drawList->ChannelsSetCurrent(frameChannel);
+			if (ImGui::InvisibleButton("Thumb", thumbButtonSize))
 			{
 				CurrImage = i;
 				LoadCurrImage();
 			}
+			bool held = ImGui::IsItemActive();
+			bool hovered = ImGui::IsItemHovered();
+			ImGuiCol frameCol = (held && hovered) ? ImGuiCol_ButtonActive : (hovered ? ImGuiCol_ButtonHovered : ImGuiCol_Button);
+			drawList->AddRectFilled(buttonMin, buttonMax, ImGui::GetColorU32(frameCol), ImGui::GetStyle().FrameRounding);
+			if (thumbnailTexID)
+			{
+				drawList->ChannelsSetCurrent(imageChannel);
+				drawList->AddImage(ImTextureID(thumbnailTexID), buttonMin, buttonMax, uv0, uv1, tint);
+			}
 
+			drawList->ChannelsSetCurrent(textChannel);
 			tString filename = tSystem::tGetFileName(i->Filename);
-			ImGui::Text(filename.Chars());
+			ImGui::Text(GetFittedText(filename, thumbButtonSize.x).Chars());
 
 			tString ttStr;
 			tsPrintf(ttStr, "%s\n%s\n%'d Bytes", 
@@ -86,26 +219,25 @@ void Viewer::ShowContentViewDialog(bool* popen)
 				tSystem::tConvertTimeToString(tSystem::tConvertTimeToLocal(i->FileModTime)).Chars(), i->FileSizeB);
 			ShowToolTip(ttStr.Chars());
 
-			// We use a separator to indicate the current item.
+			// We use a bar under the name to indicate the current item.
 			if (isCurr)
-				ImGui::Separator(2.0f);
-		}
-		else
-		{
-			// We need to keep calling bind even if the image is not visible. It frees up the worker threads.
-			if (i->IsThumbnailWorkerActive())
-				i->BindThumbnail();
-			else
-				i->UnrequestThumbnail();
+			{
+				tVector2 barMin = ImGui::GetCursorScreenPos();
+				drawList->AddRectFilled(barMin, barMin + tVector2(thumbButtonSize.x, 2.0f), ImGui::GetColorU32(ImGuiCol_Separator));
+			}
 		}
-		ImGui::EndChild();
-		ImGui::PopStyleVar();
+
+		// The group must always cover the full item so the layout is the same whether or not it is visible.
+		ImGui::SetCursorScreenPos(itemMin);
+		ImGui::Dummy(thumbItemSize);
+		ImGui::EndGroup();
 
 		if ((thumbNum+1) % numPerRow)
 			ImGui::SameLine();
 
 		ImGui::PopID();
 	}
+	drawList->ChannelsMerge();
 	ImGui::PopStyleVar();
 	ImGui::EndChild();
 
@@ -346,7 +346,6 @@ void Viewer::ShowCropPopup(const tVector4& lrtb, const tVector2& uvmarg, const t
 			newW = tClampMin(newW, 4);
 			newH = tClampMin(newH, 4);
 
-			CurrImage->Unbind();
 			CurrImage->Crop(newW, newH, minX, minY, tColouri::transparent);
 			CurrImage->Bind();
 			Viewer::SetWindowTitle();
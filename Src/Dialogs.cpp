@@ -193,6 +193,32 @@ void Viewer::ShowPixelEditorOverlay(bool* popen)
 }
 
 
+void Viewer::ShowEditProgressOverlay(float x, float y, float w, float h)
+{
+	// Bottom centre of the work area so it doesn't fight the details overlay for a corner.
+	const float margin = 6.0f;
+	ImGui::SetNextWindowPos(tVector2(x + w*0.5f, y + h - margin), ImGuiCond_Always, tVector2(0.5f, 1.0f));
+	ImGui::SetNextWindowBgAlpha(0.6f);
+	ImGuiWindowFlags flags =
+		ImGuiWindowFlags_NoMove | ImGuiWindowFlags_NoTitleBar | ImGuiWindowFlags_NoResize |
+		ImGuiWindowFlags_AlwaysAutoResize | ImGuiWindowFlags_NoSavedSettings |
+		ImGuiWindowFlags_NoFocusOnAppearing | ImGuiWindowFlags_NoNav | ImGuiWindowFlags_NoScrollbar;
+
+	if (ImGui::Begin("EditProgress", nullptr, flags))
+	{
+		int done = CurrImage->GetEditFramesDone();
+		int total = CurrImage->GetEditFramesTotal();
+		tString progress; tsPrintf(progress, "%d / %d Frames", done, total);
+		ImGui::Text("%s", CurrImage->GetEditDesc().Chars());
+		ImGui::ProgressBar((total > 0) ? float(done)/float(total) : 0.0f, tVector2(200.0f, 0.0f), progress.Chars());
+		ImGui::SameLine();
+		if (ImGui::Button("Cancel", tVector2(60.0f, 0.0f)))
+			CurrImage->CancelEdits();
+	}
+	ImGui::End();
+}
+
+
 void Viewer::ShowCheatSheetPopup(bool* popen)
 {
 	tVector2 windowPos = GetDialogOrigin(5);
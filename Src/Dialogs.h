@@ -19,6 +19,7 @@ namespace Viewer
 {
 	void ShowImageDetailsOverlay(bool* popen, float x, float y, float w, float h, int cursorX, int cursorY, float zoom);
 	void ShowPixelEditorOverlay(bool* popen);
+	void ShowEditProgressOverlay(float x, float y, float w, float h);
 	void ShowCheatSheetPopup(bool* popen);
 	void ShowAboutPopup(bool* popen);
 	void ColourCopyAs();
@@ -0,0 +1,198 @@
+// DisplayShader.cpp
+//
+// A small GLSL program used to draw the image. Channel isolation and swizzles, inverting, exposure, gamma, and
+// premultiplied alpha are applied while drawing from uniforms, so changing them never touches the pictures or
+// re-uploads a texture. Without GLSL support the image is drawn with the fixed-function pipeline as before.
+//
+// Copyright (c) 2021 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <cmath>
+#include <glad/glad.h>
+#include <Foundation/tFundamentals.h>
+#include <System/tPrint.h>
+#include "DisplayShader.h"
+using namespace Viewer;
+
+
+// GLSL 1.20 goes with the GL 2.1 the viewer already needs, and can still use the fixed-function matrices and
+// vertex colour.
+static const char* VertexSource =
+	"#version 120\n"
+	"void main()\n"
+	"{\n"
+	"	gl_Position = ftransform();\n"
+	"	gl_TexCoord[0] = gl_MultiTexCoord0;\n"
+	"	gl_FrontColor = gl_Color;\n"
+	"}\n";
+
+static const char* FragmentSource =
+	"#version 120\n"
+	"uniform sampler2D Image;\n"
+	"uniform mat4 ChannelMatrix;\n"
+	"uniform vec4 ChannelOffset;\n"
+	"uniform float Unpremultiply;\n"
+	"uniform float Exposure;\n"
+	"uniform float InvGamma;\n"
+	"uniform float Invert;\n"
+	"void main()\n"
+	"{\n"
+	"	vec4 c = texture2D(Image, gl_TexCoord[0].st);\n"
+	"	if ((Unpremultiply > 0.5) && (c.a > 0.0))\n"
+	"		c.rgb /= c.a;\n"
+	"	c = ChannelMatrix*c + ChannelOffset;\n"
+	"	c.rgb = pow(clamp(c.rgb*Exposure, 0.0, 1.0), vec3(InvGamma));\n"
+	"	c.rgb = mix(c.rgb, vec3(1.0) - c.rgb, Invert);\n"
+	"	gl_FragColor = c * gl_Color;\n"
+	"}\n";
+
+// Source channel for each of the displayed R, G, B, and A. 4 is zero and 5 is one.
+static const int Zero = 4;
+static const int One = 5;
+static const int Swizzles[int(DisplayShader::Channels::NumChannels)][4] =
+{
+	{ 0, 1, 2, 3 },			// RGBA
+	{ 0, 1, 2, One },		// RGB
+	{ 0, 0, 0, One },		// Red
+	{ 1, 1, 1, One },		// Green
+	{ 2, 2, 2, One },		// Blue
+	{ 3, 3, 3, One },		// Alpha
+	{ 2, 1, 0, 3 }			// BGRA
+};
+
+
+const char* DisplayShader::ChannelsNames[int(Channels::NumChannels)] =
+{
+	"RGBA",
+	"RGB",
+	"Red",
+	"Green",
+	"Blue",
+	"Alpha",
+	"BGRA"
+};
+
+
+bool DisplayShader::Params::IsDefault() const
+{
+	return (Show == Channels::RGBA) && !Premultiplied && (Exposure == 0.0f) && (Gamma == 1.0f) && !Invert;
+}
+
+
+static uint CompileShader(GLenum type, const char* source)
+{
+	uint shader = glCreateShader(type);
+	if (shader == 0)
+		return 0;
+
+	glShaderSource(shader, 1, &source, nullptr);
+	glCompileShader(shader);
+	GLint compiled = 0;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+	if (!compiled)
+	{
+		char log[512];
+		glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+		tPrintf("Display shader failed to compile: %s\n", log);
+		glDeleteShader(shader);
+		return 0;
+	}
+
+	return shader;
+}
+
+
+bool DisplayShader::Init()
+{
+	Shutdown();
+	if (!GLAD_GL_VERSION_2_0)
+		return false;
+
+	uint vertex = CompileShader(GL_VERTEX_SHADER, VertexSource);
+	uint fragment = CompileShader(GL_FRAGMENT_SHADER, FragmentSource);
+	if (vertex && fragment)
+	{
+		Program = glCreateProgram();
+		glAttachShader(Program, vertex);
+		glAttachShader(Program, fragment);
+		glLinkProgram(Program);
+	}
+
+	// The program keeps what it needs once linked.
+	if (vertex)
+		glDeleteShader(vertex);
+	if (fragment)
+		glDeleteShader(fragment);
+	if (Program == 0)
+		return false;
+
+	GLint linked = 0;
+	glGetProgramiv(Program, GL_LINK_STATUS, &linked);
+	if (!linked)
+	{
+		char log[512];
+		glGetProgramInfoLog(Program, sizeof(log), nullptr, log);
+		tPrintf("Display shader failed to link: %s\n", log);
+		Shutdown();
+		return false;
+	}
+
+	ImageLoc			= glGetUniformLocation(Program, "Image");
+	ChannelMatrixLoc	= glGetUniformLocation(Program, "ChannelMatrix");
+	ChannelOffsetLoc	= glGetUniformLocation(Program, "ChannelOffset");
+	UnpremultiplyLoc	= glGetUniformLocation(Program, "Unpremultiply");
+	ExposureLoc			= glGetUniformLocation(Program, "Exposure");
+	InvGammaLoc			= glGetUniformLocation(Program, "InvGamma");
+	InvertLoc			= glGetUniformLocation(Program, "Invert");
+	return true;
+}
+
+
+void DisplayShader::Shutdown()
+{
+	if (Program != 0)
+		glDeleteProgram(Program);
+	Program = 0;
+}
+
+
+void DisplayShader::Begin(const Params& params)
+{
+	if (Program == 0)
+		return;
+
+	// The matrix is column-major. Column n holds where source channel n goes.
+	float matrix[16] = { 0.0f };
+	float offset[4] = { 0.0f };
+	const int* swizzle = Swizzles[tMath::tClamp(int(params.Show), 0, int(Channels::NumChannels)-1)];
+	for (int dst = 0; dst < 4; dst++)
+	{
+		if (swizzle[dst] == One)
+			offset[dst] = 1.0f;
+		else if (swizzle[dst] != Zero)
+			matrix[swizzle[dst]*4 + dst] = 1.0f;
+	}
+
+	glUseProgram(Program);
+	glUniform1i(ImageLoc, 0);
+	glUniformMatrix4fv(ChannelMatrixLoc, 1, GL_FALSE, matrix);
+	glUniform4fv(ChannelOffsetLoc, 1, offset);
+	glUniform1f(UnpremultiplyLoc, params.Premultiplied ? 1.0f : 0.0f);
+	glUniform1f(ExposureLoc, std::pow(2.0f, params.Exposure));
+	glUniform1f(InvGammaLoc, 1.0f / tMath::tMax(params.Gamma, 0.01f));
+	glUniform1f(InvertLoc, params.Invert ? 1.0f : 0.0f);
+}
+
+
+void DisplayShader::End()
+{
+	if (Program != 0)
+		glUseProgram(0);
+}
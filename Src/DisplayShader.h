@@ -0,0 +1,80 @@
+// DisplayShader.h
+//
+// A small GLSL program used to draw the image. Channel isolation and swizzles, inverting, exposure, gamma, and
+// premultiplied alpha are applied while drawing from uniforms, so changing them never touches the pictures or
+// re-uploads a texture. Without GLSL support the image is drawn with the fixed-function pipeline as before.
+//
+// Copyright (c) 2021 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <Foundation/tPlatform.h>
+namespace Viewer
+{
+
+
+class DisplayShader
+{
+public:
+	DisplayShader()																										{ }
+
+	// Does not free the program. Call Shutdown while the GL context is still current.
+	~DisplayShader()																									{ }
+
+	// Where each displayed channel comes from. Isolating a single channel shows it as grey with full alpha.
+	enum class Channels
+	{
+		RGBA,
+		RGB,
+		Red,
+		Green,
+		Blue,
+		Alpha,
+		BGRA,
+		NumChannels
+	};
+	static const char* ChannelsNames[int(Channels::NumChannels)];
+
+	struct Params
+	{
+		Channels Show			= Channels::RGBA;
+		bool Premultiplied		= false;		// Colours are already multiplied by alpha, so they're divided by it to display.
+		float Exposure			= 0.0f;			// In stops.
+		float Gamma				= 1.0f;			// Applied after exposure. Values above 1 brighten the midtones.
+		bool Invert				= false;		// Applied last, to the colour channels only.
+
+		bool IsDefault() const;
+		void Reset()																									{ *this = Params(); }
+	};
+
+	// Compiles the program. Returns false if GLSL isn't supported or the program fails to build, in which case Begin
+	// does nothing.
+	bool Init();
+	void Shutdown();
+	bool IsValid() const																								{ return Program != 0; }
+
+	// Draws between Begin and End use the program. The texture is read from unit 0 and the result is multiplied by the
+	// vertex colour like GL_MODULATE.
+	void Begin(const Params&);
+	void End();
+
+private:
+	uint Program			= 0;
+	int ImageLoc			= -1;
+	int ChannelMatrixLoc	= -1;
+	int ChannelOffsetLoc	= -1;
+	int UnpremultiplyLoc	= -1;
+	int ExposureLoc			= -1;
+	int InvGammaLoc			= -1;
+	int InvertLoc			= -1;
+};
+
+
+}
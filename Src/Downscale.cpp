@@ -0,0 +1,270 @@
+// Downscale.cpp
+//
+// Fast large-ratio image reduction. The picture is first halved repeatedly with a 2x2 box filter, vectorized and split
+// across the worker pool by rows, until it is within a factor of two of the target. A regular resample then finishes
+// the job. Compared to resampling straight from full size it is much faster and every source pixel contributes, so
+// big reductions don't alias.
+//
+// Copyright (c) 2021 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define DOWNSCALE_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define DOWNSCALE_NEON
+#include <arm_neon.h>
+#endif
+#include <Foundation/tFundamentals.h>
+#include "Downscale.h"
+#include "Resampler.h"
+#include "WorkerPool.h"
+using namespace tImage;
+namespace Viewer { extern Worker::Pool WorkerPool; }
+
+
+namespace Downscale
+{
+	// Enough rows per chunk that the job overhead is small next to the work, even for narrow images.
+	const int MinPixelsPerChunk = 64*1024;
+
+	// The row kernels write dstW pixels. Source rows must have at least 2*dstW pixels when halving horizontally.
+	void HalveRow2x2(const uint8* row0, const uint8* row1, uint8* dst, int dstW);
+	void HalveRow2x1(const uint8* row0, uint8* dst, int dstW);
+	void HalveRow1x2(const uint8* row0, const uint8* row1, uint8* dst, int dstW);
+}
+
+
+void Downscale::HalveRow2x2(const uint8* row0, const uint8* row1, uint8* dst, int dstW)
+{
+	int x = 0;
+
+	#if defined(DOWNSCALE_SSE2)
+	// Four destination pixels per iteration from eight source pixels in each row. Channels are widened to 16 bits so
+	// the sum of four is exact, then rounded and narrowed back.
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i two = _mm_set1_epi16(2);
+	for (; x + 4 <= dstW; x += 4)
+	{
+		__m128i a0 = _mm_loadu_si128((const __m128i*)(row0 + x*8));
+		__m128i a1 = _mm_loadu_si128((const __m128i*)(row0 + x*8 + 16));
+		__m128i b0 = _mm_loadu_si128((const __m128i*)(row1 + x*8));
+		__m128i b1 = _mm_loadu_si128((const __m128i*)(row1 + x*8 + 16));
+
+		// Vertical sums. Each register holds two source pixels of four 16-bit channels.
+		__m128i s0 = _mm_add_epi16(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(b0, zero));
+		__m128i s1 = _mm_add_epi16(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(b0, zero));
+		__m128i s2 = _mm_add_epi16(_mm_unpacklo_epi8(a1, zero), _mm_unpacklo_epi8(b1, zero));
+		__m128i s3 = _mm_add_epi16(_mm_unpackhi_epi8(a1, zero), _mm_unpackhi_epi8(b1, zero));
+
+		// Horizontal sums of neighbouring pixels. The low 64 bits of each result hold one destination pixel.
+		s0 = _mm_add_epi16(s0, _mm_srli_si128(s0, 8));
+		s1 = _mm_add_epi16(s1, _mm_srli_si128(s1, 8));
+		s2 = _mm_add_epi16(s2, _mm_srli_si128(s2, 8));
+		s3 = _mm_add_epi16(s3, _mm_srli_si128(s3, 8));
+		__m128i p01 = _mm_unpacklo_epi64(s0, s1);
+		__m128i p23 = _mm_unpacklo_epi64(s2, s3);
+
+		p01 = _mm_srli_epi16(_mm_add_epi16(p01, two), 2);
+		p23 = _mm_srli_epi16(_mm_add_epi16(p23, two), 2);
+		_mm_storeu_si128((__m128i*)(dst + x*4), _mm_packus_epi16(p01, p23));
+	}
+
+	#elif defined(DOWNSCALE_NEON)
+	// Same scheme as SSE2. The rounding shift folds in the +2.
+	for (; x + 4 <= dstW; x += 4)
+	{
+		uint8x16_t a0 = vld1q_u8(row0 + x*8);
+		uint8x16_t a1 = vld1q_u8(row0 + x*8 + 16);
+		uint8x16_t b0 = vld1q_u8(row1 + x*8);
+		uint8x16_t b1 = vld1q_u8(row1 + x*8 + 16);
+
+		uint16x8_t s0 = vaddl_u8(vget_low_u8(a0), vget_low_u8(b0));
+		uint16x8_t s1 = vaddl_u8(vget_high_u8(a0), vget_high_u8(b0));
+		uint16x8_t s2 = vaddl_u8(vget_low_u8(a1), vget_low_u8(b1));
+		uint16x8_t s3 = vaddl_u8(vget_high_u8(a1), vget_high_u8(b1));
+
+		uint16x8_t p01 = vcombine_u16(vadd_u16(vget_low_u16(s0), vget_high_u16(s0)), vadd_u16(vget_low_u16(s1), vget_high_u16(s1)));
+		uint16x8_t p23 = vcombine_u16(vadd_u16(vget_low_u16(s2), vget_high_u16(s2)), vadd_u16(vget_low_u16(s3), vget_high_u16(s3)));
+		vst1q_u8(dst + x*4, vcombine_u8(vrshrn_n_u16(p01, 2), vrshrn_n_u16(p23, 2)));
+	}
+	#endif
+
+	for (; x < dstW; x++)
+	{
+		const uint8* a = row0 + x*8;
+		const uint8* b = row1 + x*8;
+		for (int c = 0; c < 4; c++)
+			dst[x*4 + c] = uint8((int(a[c]) + int(a[c+4]) + int(b[c]) + int(b[c+4]) + 2) >> 2);
+	}
+}
+
+
+void Downscale::HalveRow2x1(const uint8* row0, uint8* dst, int dstW)
+{
+	// Only used when the height is not being reduced much, so there is no vector path.
+	for (int x = 0; x < dstW; x++)
+	{
+		const uint8* a = row0 + x*8;
+		for (int c = 0; c < 4; c++)
+			dst[x*4 + c] = uint8((int(a[c]) + int(a[c+4]) + 1) >> 1);
+	}
+}
+
+
+void Downscale::HalveRow1x2(const uint8* row0, const uint8* row1, uint8* dst, int dstW)
+{
+	int numBytes = dstW*4;
+	int i = 0;
+
+	#if defined(DOWNSCALE_SSE2)
+	for (; i + 16 <= numBytes; i += 16)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i*)(row0 + i));
+		__m128i b = _mm_loadu_si128((const __m128i*)(row1 + i));
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_avg_epu8(a, b));
+	}
+	#elif defined(DOWNSCALE_NEON)
+	for (; i + 16 <= numBytes; i += 16)
+		vst1q_u8(dst + i, vrhaddq_u8(vld1q_u8(row0 + i), vld1q_u8(row1 + i)));
+	#endif
+
+	for (; i < numBytes; i++)
+		dst[i] = uint8((int(row0[i]) + int(row1[i]) + 1) >> 1);
+}
+
+
+void Downscale::Halve(tPicture& picture, bool halveX, bool halveY)
+{
+	int srcW = picture.GetWidth();
+	int srcH = picture.GetHeight();
+	int dstW = halveX ? srcW/2 : srcW;
+	int dstH = halveY ? srcH/2 : srcH;
+	if (!picture.IsValid() || (dstW < 1) || (dstH < 1) || (!halveX && !halveY))
+		return;
+
+	tPixel* dstPixels = new tPixel[dstW*dstH];
+	Halve(dstPixels, picture.GetPixels(), srcW, srcH, halveX, halveY);
+	picture.Set(dstW, dstH, dstPixels, false);
+}
+
+
+void Downscale::Halve(tPixel* dstPixels, const tPixel* srcPixels, int srcW, int srcH, bool halveX, bool halveY)
+{
+	int dstW = halveX ? srcW/2 : srcW;
+	int dstH = halveY ? srcH/2 : srcH;
+	const uint8* src = (const uint8*)srcPixels;
+	uint8* dst = (uint8*)dstPixels;
+	int srcStride = srcW*4;
+	int dstStride = dstW*4;
+
+	int rowsPerChunk = tMath::tMax(MinPixelsPerChunk / dstW, 1);
+	Viewer::WorkerPool.ParallelFor
+	(
+		dstH, rowsPerChunk,
+		[=](int begin, int end)
+		{
+			for (int y = begin; y < end; y++)
+			{
+				const uint8* row0 = src + (halveY ? 2*y : y)*srcStride;
+				const uint8* row1 = row0 + srcStride;
+				uint8* out = dst + y*dstStride;
+				if (halveX && halveY)
+					HalveRow2x2(row0, row1, out, dstW);
+				else if (halveX)
+					HalveRow2x1(row0, out, dstW);
+				else
+					HalveRow1x2(row0, row1, out, dstW);
+			}
+		}
+	);
+}
+
+
+void Downscale::GenerateMipmaps(tList<tLayer>& levels, const tPicture& picture, tResampleFilter filter, bool chaining)
+{
+	if (picture.IsValid())
+		GenerateMipmaps(levels, picture.GetPixels(), picture.GetWidth(), picture.GetHeight(), filter, chaining);
+}
+
+
+void Downscale::GenerateMipmaps(tList<tLayer>& levels, const tPixel* pixels, int width, int height, tResampleFilter filter, bool chaining)
+{
+	if (!pixels || (width < 1) || (height < 1) || (filter == tResampleFilter::None))
+		return;
+
+	const tPixel* prev = pixels;
+	int prevW = width;
+	int prevH = height;
+	int w = prevW;
+	int h = prevH;
+	while ((w > 1) || (h > 1))
+	{
+		bool halveX = (w > 1);
+		bool halveY = (h > 1);
+		w = halveX ? w/2 : w;
+		h = halveY ? h/2 : h;
+		// An exact halving with a box or bilinear filter is the 2x2 average either way, so it takes the halving kernel.
+		// Odd sizes and the other filters go through the resampler.
+		bool exact = (!halveX || (prevW == 2*w)) && (!halveY || (prevH == 2*h));
+		bool average = (filter == tResampleFilter::Box) || (filter == tResampleFilter::Bilinear);
+		tPixel* levelPixels = new tPixel[w*h];
+		if (chaining && exact && average)
+			Halve(levelPixels, prev, prevW, prevH, halveX, halveY);
+		else if (chaining)
+			Resampler::Resample(prev, prevW, prevH, levelPixels, w, h, filter, tResampleEdgeMode::Clamp);
+		else
+			Resampler::Resample(pixels, width, height, levelPixels, w, h, filter, tResampleEdgeMode::Clamp);
+
+		tLayer* level = new tLayer(tPixelFormat::R8G8B8A8, w, h, (uint8*)levelPixels, true);
+		levels.Append(level);
+		prev = levelPixels;
+		prevW = w;
+		prevH = h;
+	}
+}
+
+
+void Downscale::HalveToward(tPicture& picture, int width, int height, tResampleFilter filter)
+{
+	if (!picture.IsValid() || (filter == tResampleFilter::Nearest))
+		return;
+
+	while (true)
+	{
+		bool halveX = (picture.GetWidth()/2 >= width);
+		bool halveY = (picture.GetHeight()/2 >= height);
+		if (!halveX && !halveY)
+			break;
+		Halve(picture, halveX, halveY);
+	}
+}
+
+
+bool Downscale::Reduce(tPicture& picture, int width, int height, tResampleFilter filter, tResampleEdgeMode edgeMode)
+{
+	return Reduce(std::vector<tPicture*>(1, &picture), width, height, filter, edgeMode);
+}
+
+
+bool Downscale::Reduce(const std::vector<tPicture*>& pictures, int width, int height, tResampleFilter filter, tResampleEdgeMode edgeMode)
+{
+	if ((width < 1) || (height < 1))
+		return false;
+
+	for (tPicture* picture : pictures)
+	{
+		if (!picture->IsValid())
+			return false;
+		HalveToward(*picture, width, height, filter);
+	}
+
+	return Resampler::Resample(pictures, width, height, filter, edgeMode);
+}
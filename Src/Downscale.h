@@ -0,0 +1,52 @@
+// Downscale.h
+//
+// Fast large-ratio image reduction. The picture is first halved repeatedly with a 2x2 box filter, vectorized and split
+// across the worker pool by rows, until it is within a factor of two of the target. A regular resample then finishes
+// the job. Compared to resampling straight from full size it is much faster and every source pixel contributes, so
+// big reductions don't alias.
+//
+// Copyright (c) 2021 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <vector>
+#include <Foundation/tList.h>
+#include <Image/tPicture.h>
+#include <Image/tLayer.h>
+#include <Image/tResample.h>
+namespace Downscale
+{
+
+
+// Reduces the picture to width x height. The final resample uses the given filter and edge mode. Box halving is
+// skipped for an axis being enlarged or reduced by less than half, and entirely for the nearest filter since it is
+// usually chosen to keep hard pixel edges. Rows are split across the worker pool when called from the main thread.
+bool Reduce(tImage::tPicture&, int width, int height, tImage::tResampleFilter, tImage::tResampleEdgeMode = tImage::tResampleEdgeMode::Clamp);
+
+// Reduces every picture to width x height. The final resamples run as one batch so the frames share the pool.
+bool Reduce(const std::vector<tImage::tPicture*>&, int width, int height, tImage::tResampleFilter, tImage::tResampleEdgeMode = tImage::tResampleEdgeMode::Clamp);
+
+// Just the box halving part of Reduce. Leaves the picture within a factor of two of width x height, ready for the
+// final resample. Lets callers shrink big frames one at a time before resampling them all together.
+void HalveToward(tImage::tPicture&, int width, int height, tImage::tResampleFilter);
+
+// Halves the width and/or height with a box filter. Odd trailing columns or rows are dropped.
+void Halve(tImage::tPicture&, bool halveX, bool halveY);
+void Halve(tPixel* dst, const tPixel* src, int srcW, int srcH, bool halveX, bool halveY);
+
+// Appends the mipmap levels below the picture to levels, down to 1x1, as R8G8B8A8 layers. The picture itself is not
+// copied. Chained box and bilinear levels that are exact halvings use the vector halving kernel. Everything else uses
+// the vector resampler, from the level above when chaining or from the picture when not. The None filter generates
+// nothing.
+void GenerateMipmaps(tList<tImage::tLayer>& levels, const tImage::tPicture&, tImage::tResampleFilter, bool chaining);
+void GenerateMipmaps(tList<tImage::tLayer>& levels, const tPixel* pixels, int width, int height, tImage::tResampleFilter, bool chaining);
+
+
+}
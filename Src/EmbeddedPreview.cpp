@@ -0,0 +1,559 @@
+// EmbeddedPreview.cpp
+//
+// Finds and decodes the reduced-size JPEG previews that cameras and many editors embed in image files. Supported are
+// EXIF IFD1 thumbnails and MPF preview images in JPEGs, reduced-resolution SubIFDs and IFD1 in TIFFs, and EXIF blocks
+// inside PNG (eXIf chunk) and WebP (EXIF chunk) files. Only the headers and the chosen preview are read, not the main
+// image data.
+//
+// Copyright (c) 2021 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <Foundation/tFundamentals.h>
+#include <Image/tImageJPG.h>
+#include "EmbeddedPreview.h"
+using namespace tSystem;
+using namespace tImage;
+
+
+namespace Viewer
+{
+	// Reads from a file through a small window so parsing many tiny header fields doesn't turn into many syscalls.
+	class PreviewReader
+	{
+	public:
+		PreviewReader(const tString& filename);
+		~PreviewReader()																								{ if (File) tCloseFile(File); }
+		bool IsValid() const																							{ return File != nullptr; }
+		uint32 GetSize() const																							{ return Size; }
+
+		bool Read(uint32 offset, void* dst, int numBytes);
+		bool Read8(uint32 offset, uint32& value);
+		bool Read16(uint32 offset, uint32& value, bool bigEndian);
+		bool Read32(uint32 offset, uint32& value, bool bigEndian);
+
+	private:
+		const static int WindowSize = 64*1024;
+		tFileHandle File = nullptr;
+		uint32 Size = 0;
+		uint32 WindowStart = 0;
+		uint32 WindowLength = 0;
+		std::vector<uint8> Window;
+	};
+
+	// A JPEG stream somewhere in the file.
+	struct PreviewCandidate
+	{
+		uint32 Offset;
+		uint32 Length;
+	};
+
+	struct PreviewScan
+	{
+		std::vector<PreviewCandidate> Candidates;
+		int MainWidth = 0;
+		int MainHeight = 0;
+	};
+
+	const uint32 MaxPreviewBytes				= 32*1024*1024;
+	const int MaxIFDs							= 32;
+	const int MaxIFDEntries						= 1024;
+
+	void ScanJPG(PreviewReader&, PreviewScan&);
+	void ScanTIFF(PreviewReader&, uint32 base, uint32 limit, PreviewScan&, bool isMainImage);
+	void ScanMPF(PreviewReader&, uint32 base, uint32 limit, PreviewScan&);
+	void ScanPNG(PreviewReader&, PreviewScan&);
+	void ScanWEBP(PreviewReader&, PreviewScan&);
+	bool GetJPGSize(PreviewReader&, uint32 offset, uint32 length, int& width, int& height);
+}
+
+
+Viewer::PreviewReader::PreviewReader(const tString& filename)
+{
+	File = tOpenFile(filename.Chars(), "rb");
+	if (!File)
+		return;
+
+	int size = tGetFileSize(File);
+	if (size <= 0)
+	{
+		tCloseFile(File);
+		File = nullptr;
+		return;
+	}
+	Size = uint32(size);
+	Window.resize(WindowSize);
+}
+
+
+bool Viewer::PreviewReader::Read(uint32 offset, void* dst, int numBytes)
+{
+	if (!File || (numBytes < 0) || (offset > Size) || (uint32(numBytes) > (Size - offset)))
+		return false;
+
+	// Big reads go straight to the file.
+	if (numBytes > WindowSize/2)
+	{
+		tFileSeek(File, int(offset), tSeekOrigin::Beginning);
+		return tReadFile(File, dst, numBytes) == numBytes;
+	}
+
+	if ((offset < WindowStart) || ((offset + numBytes) > (WindowStart + WindowLength)))
+	{
+		WindowStart = offset;
+		WindowLength = tMath::tMin(uint32(WindowSize), Size - offset);
+		tFileSeek(File, int(WindowStart), tSeekOrigin::Beginning);
+		if (tReadFile(File, Window.data(), int(WindowLength)) != int(WindowLength))
+		{
+			WindowLength = 0;
+			return false;
+		}
+	}
+
+	memcpy(dst, Window.data() + (offset - WindowStart), numBytes);
+	return true;
+}
+
+
+bool Viewer::PreviewReader::Read8(uint32 offset, uint32& value)
+{
+	uint8 b;
+	if (!Read(offset, &b, 1))
+		return false;
+	value = b;
+	return true;
+}
+
+
+bool Viewer::PreviewReader::Read16(uint32 offset, uint32& value, bool bigEndian)
+{
+	uint8 b[2];
+	if (!Read(offset, b, 2))
+		return false;
+	value = bigEndian ? ((b[0] << 8) | b[1]) : ((b[1] << 8) | b[0]);
+	return true;
+}
+
+
+bool Viewer::PreviewReader::Read32(uint32 offset, uint32& value, bool bigEndian)
+{
+	uint8 b[4];
+	if (!Read(offset, b, 4))
+		return false;
+	value = bigEndian ?
+		((uint32(b[0]) << 24) | (uint32(b[1]) << 16) | (uint32(b[2]) << 8) | uint32(b[3])) :
+		((uint32(b[3]) << 24) | (uint32(b[2]) << 16) | (uint32(b[1]) << 8) | uint32(b[0]));
+	return true;
+}
+
+
+bool Viewer::GetJPGSize(PreviewReader& reader, uint32 offset, uint32 length, int& width, int& height)
+{
+	// Walks the marker segments to the first start-of-frame. Stops at start-of-scan since the frame header must come
+	// before it.
+	uint32 soi = 0;
+	if (!reader.Read16(offset, soi, true) || (soi != 0xFFD8))
+		return false;
+
+	uint32 end = offset + length;
+	uint32 pos = offset + 2;
+	for (int segment = 0; (segment < 256) && (pos + 4 <= end); segment++)
+	{
+		uint32 marker = 0, segLength = 0;
+		if (!reader.Read16(pos, marker, true) || ((marker & 0xFF00) != 0xFF00))
+			return false;
+
+		// Fill bytes.
+		if (marker == 0xFFFF)
+		{
+			pos++;
+			continue;
+		}
+
+		if ((marker == 0xFFDA) || (marker == 0xFFD9))
+			return false;
+
+		if (!reader.Read16(pos + 2, segLength, true) || (segLength < 2))
+			return false;
+
+		bool isFrame = (marker >= 0xFFC0) && (marker <= 0xFFCF) && (marker != 0xFFC4) && (marker != 0xFFC8) && (marker != 0xFFCC);
+		if (isFrame)
+		{
+			uint32 h = 0, w = 0;
+			if (!reader.Read16(pos + 5, h, true) || !reader.Read16(pos + 7, w, true))
+				return false;
+			width = int(w);
+			height = int(h);
+			return (width > 0) && (height > 0);
+		}
+
+		pos += 2 + segLength;
+	}
+
+	return false;
+}
+
+
+void Viewer::ScanTIFF(PreviewReader& reader, uint32 base, uint32 limit, PreviewScan& scan, bool isMainImage)
+{
+	// Offsets inside a TIFF structure are relative to its header at base. For EXIF blocks that is inside some other
+	// container. For TIFF files base is zero.
+	uint32 byteOrder = 0, magic = 0;
+	if (!reader.Read16(base, byteOrder, true))
+		return;
+	bool bigEndian = (byteOrder == 0x4D4D);
+	if (!bigEndian && (byteOrder != 0x4949))
+		return;
+	if (!reader.Read16(base + 2, magic, bigEndian) || (magic != 42))
+		return;
+
+	uint32 firstIFD = 0;
+	if (!reader.Read32(base + 4, firstIFD, bigEndian))
+		return;
+
+	// IFDs to visit. The IFD0 chain is followed through next pointers and SubIFDs are pushed as found.
+	std::vector<uint32> pending = { firstIFD };
+	std::vector<uint32> visited;
+	bool first = true;
+	while (!pending.empty() && (int(visited.size()) < MaxIFDs))
+	{
+		uint32 ifd = pending.back();
+		pending.pop_back();
+		if ((ifd == 0) || (ifd >= limit) || (std::find(visited.begin(), visited.end(), ifd) != visited.end()))
+			continue;
+		visited.push_back(ifd);
+		bool isIFD0 = first;
+		first = false;
+
+		uint32 numEntries = 0;
+		if (!reader.Read16(base + ifd, numEntries, bigEndian) || (numEntries > MaxIFDEntries))
+			continue;
+
+		uint32 width = 0, height = 0, compression = 0, subfileType = 0;
+		uint32 jpegOffset = 0, jpegLength = 0;
+		uint32 stripOffset = 0, stripLength = 0, numStrips = 0;
+		bool hasJPEGTables = false;
+		for (uint32 e = 0; e < numEntries; e++)
+		{
+			uint32 entry = base + ifd + 2 + e*12;
+			uint32 tag = 0, type = 0, count = 0, value = 0;
+			if (!reader.Read16(entry, tag, bigEndian) || !reader.Read16(entry + 2, type, bigEndian) || !reader.Read32(entry + 4, count, bigEndian))
+				break;
+
+			// Single SHORTs are left-justified in the value field.
+			if ((type == 3) && (count == 1))
+				reader.Read16(entry + 8, value, bigEndian);
+			else
+				reader.Read32(entry + 8, value, bigEndian);
+
+			switch (tag)
+			{
+				case 0x00FE:	subfileType = value;				break;
+				case 0x0100:	width = value;						break;
+				case 0x0101:	height = value;						break;
+				case 0x0103:	compression = value;				break;
+				case 0x0201:	jpegOffset = value;					break;
+				case 0x0202:	jpegLength = value;					break;
+				case 0x015B:	hasJPEGTables = true;				break;
+				case 0x0111:	stripOffset = value;	numStrips = count;		break;
+				case 0x0117:	stripLength = value;				break;
+				case 0x014A:
+				{
+					// SubIFDs. One offset is stored inline, more are in an array.
+					if (count == 1)
+						pending.push_back(value);
+					else
+						for (uint32 s = 0; (s < count) && (s < 8); s++)
+						{
+							uint32 sub = 0;
+							if (reader.Read32(base + value + s*4, sub, bigEndian))
+								pending.push_back(sub);
+						}
+					break;
+				}
+			}
+		}
+
+		uint32 next = 0;
+		if (reader.Read32(base + ifd + 2 + numEntries*12, next, bigEndian))
+			pending.insert(pending.begin(), next);
+
+		if (isIFD0 && isMainImage)
+		{
+			scan.MainWidth = int(width);
+			scan.MainHeight = int(height);
+			continue;
+		}
+
+		// IFD0 of an EXIF block describes the main image, not a preview.
+		if (isIFD0)
+			continue;
+
+		// Old-style JPEG thumbnails (EXIF IFD1) use the interchange format tags. New-style JPEG compressed reduced
+		// images are only usable if they are a single self-contained strip.
+		if (jpegOffset && jpegLength)
+		{
+			scan.Candidates.push_back({ base + jpegOffset, jpegLength });
+		}
+		else if ((compression == 7) && (numStrips == 1) && stripLength && !hasJPEGTables && ((subfileType & 1) || !isMainImage))
+		{
+			scan.Candidates.push_back({ base + stripOffset, stripLength });
+		}
+	}
+}
+
+
+void Viewer::ScanMPF(PreviewReader& reader, uint32 base, uint32 limit, PreviewScan& scan)
+{
+	// Multi-Picture Format (CIPA DC-007). IFD0 holds an MPEntry table. Offsets are relative to the MPF TIFF header and
+	// the first entry, with offset zero, is the main image itself.
+	uint32 byteOrder = 0, ifd = 0, numEntries = 0;
+	if (!reader.Read16(base, byteOrder, true))
+		return;
+	bool bigEndian = (byteOrder == 0x4D4D);
+	if ((!bigEndian && (byteOrder != 0x4949)) || !reader.Read32(base + 4, ifd, bigEndian) || (ifd >= limit))
+		return;
+	if (!reader.Read16(base + ifd, numEntries, bigEndian) || (numEntries > MaxIFDEntries))
+		return;
+
+	for (uint32 e = 0; e < numEntries; e++)
+	{
+		uint32 entry = base + ifd + 2 + e*12;
+		uint32 tag = 0, count = 0, value = 0;
+		if (!reader.Read16(entry, tag, bigEndian) || !reader.Read32(entry + 4, count, bigEndian) || !reader.Read32(entry + 8, value, bigEndian))
+			return;
+		if (tag != 0xB002)
+			continue;
+
+		int numImages = int(count / 16);
+		for (int i = 0; (i < numImages) && (i < 16); i++)
+		{
+			uint32 size = 0, offset = 0;
+			if (!reader.Read32(base + value + i*16 + 4, size, bigEndian) || !reader.Read32(base + value + i*16 + 8, offset, bigEndian))
+				break;
+			if (offset && size)
+				scan.Candidates.push_back({ base + offset, size });
+		}
+		return;
+	}
+}
+
+
+void Viewer::ScanJPG(PreviewReader& reader, PreviewScan& scan)
+{
+	uint32 soi = 0;
+	if (!reader.Read16(0, soi, true) || (soi != 0xFFD8))
+		return;
+
+	uint32 pos = 2;
+	for (int segment = 0; (segment < 256) && (pos + 4 <= reader.GetSize()); segment++)
+	{
+		uint32 marker = 0, segLength = 0;
+		if (!reader.Read16(pos, marker, true) || ((marker & 0xFF00) != 0xFF00))
+			return;
+		if (marker == 0xFFFF)
+		{
+			pos++;
+			continue;
+		}
+		if ((marker == 0xFFDA) || (marker == 0xFFD9) || !reader.Read16(pos + 2, segLength, true) || (segLength < 2))
+			return;
+
+		uint32 data = pos + 4;
+		uint32 dataLength = segLength - 2;
+		char id[6];
+		if ((marker == 0xFFE1) && (dataLength > 14) && reader.Read(data, id, 6) && !memcmp(id, "Exif\0\0", 6))
+			ScanTIFF(reader, data + 6, dataLength - 6, scan, false);
+		else if ((marker == 0xFFE2) && (dataLength > 12) && reader.Read(data, id, 4) && !memcmp(id, "MPF\0", 4))
+			ScanMPF(reader, data + 4, dataLength - 4, scan);
+
+		bool isFrame = (marker >= 0xFFC0) && (marker <= 0xFFCF) && (marker != 0xFFC4) && (marker != 0xFFC8) && (marker != 0xFFCC);
+		if (isFrame)
+		{
+			uint32 h = 0, w = 0;
+			if (reader.Read16(pos + 5, h, true) && reader.Read16(pos + 7, w, true))
+			{
+				scan.MainWidth = int(w);
+				scan.MainHeight = int(h);
+			}
+			return;
+		}
+
+		pos += 2 + segLength;
+	}
+}
+
+
+void Viewer::ScanPNG(PreviewReader& reader, PreviewScan& scan)
+{
+	uint8 signature[8];
+	const uint8 pngSignature[8] = { 0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A };
+	if (!reader.Read(0, signature, 8) || memcmp(signature, pngSignature, 8))
+		return;
+
+	// The eXIf chunk should precede IDAT. We stop there rather than reading through the image data.
+	uint32 pos = 8;
+	for (int chunk = 0; (chunk < 64) && (pos + 8 <= reader.GetSize()); chunk++)
+	{
+		uint32 length = 0;
+		char type[4];
+		if (!reader.Read32(pos, length, true) || !reader.Read(pos + 4, type, 4))
+			return;
+
+		if (!memcmp(type, "IHDR", 4))
+		{
+			uint32 w = 0, h = 0;
+			if (reader.Read32(pos + 8, w, true) && reader.Read32(pos + 12, h, true))
+			{
+				scan.MainWidth = int(w);
+				scan.MainHeight = int(h);
+			}
+		}
+		else if (!memcmp(type, "eXIf", 4))
+		{
+			ScanTIFF(reader, pos + 8, length, scan, false);
+		}
+		else if (!memcmp(type, "IDAT", 4) || !memcmp(type, "IEND", 4))
+		{
+			return;
+		}
+
+		pos += 12 + length;
+	}
+}
+
+
+void Viewer::ScanWEBP(PreviewReader& reader, PreviewScan& scan)
+{
+	char riff[4], webp[4];
+	if (!reader.Read(0, riff, 4) || !reader.Read(8, webp, 4) || memcmp(riff, "RIFF", 4) || memcmp(webp, "WEBP", 4))
+		return;
+
+	// The EXIF chunk usually follows the image data. Chunk headers tell us where everything is so we hop over the
+	// data without reading it.
+	uint32 pos = 12;
+	for (int chunk = 0; (chunk < 1024) && (pos + 8 <= reader.GetSize()); chunk++)
+	{
+		char type[4];
+		uint32 length = 0;
+		if (!reader.Read(pos, type, 4) || !reader.Read32(pos + 4, length, false))
+			return;
+		uint32 data = pos + 8;
+
+		if (!memcmp(type, "VP8X", 4))
+		{
+			uint8 canvas[6];
+			if (reader.Read(data + 4, canvas, 6))
+			{
+				scan.MainWidth = 1 + int(canvas[0] | (canvas[1] << 8) | (canvas[2] << 16));
+				scan.MainHeight = 1 + int(canvas[3] | (canvas[4] << 8) | (canvas[5] << 16));
+			}
+		}
+		else if (!memcmp(type, "VP8 ", 4) && !scan.MainWidth)
+		{
+			uint32 w = 0, h = 0;
+			if (reader.Read16(data + 6, w, false) && reader.Read16(data + 8, h, false))
+			{
+				scan.MainWidth = int(w & 0x3FFF);
+				scan.MainHeight = int(h & 0x3FFF);
+			}
+		}
+		else if (!memcmp(type, "VP8L", 4) && !scan.MainWidth)
+		{
+			uint32 bits = 0;
+			if (reader.Read32(data + 1, bits, false))
+			{
+				scan.MainWidth = 1 + int(bits & 0x3FFF);
+				scan.MainHeight = 1 + int((bits >> 14) & 0x3FFF);
+			}
+		}
+		else if (!memcmp(type, "EXIF", 4))
+		{
+			// Some writers include the JPEG APP1 identifier, some don't.
+			char id[6];
+			uint32 tiff = data;
+			if ((length > 6) && reader.Read(data, id, 6) && !memcmp(id, "Exif\0\0", 6))
+				tiff += 6;
+			ScanTIFF(reader, tiff, length - (tiff - data), scan, false);
+		}
+
+		// Chunks are padded to even sizes.
+		pos = data + length + (length & 1);
+	}
+}
+
+
+bool Viewer::LoadEmbeddedPreview(tPicture& preview, const tString& filename, tFileType filetype, int minWidth, int minHeight)
+{
+	if ((filetype != tFileType::JPG) && (filetype != tFileType::TIFF) && (filetype != tFileType::PNG) && (filetype != tFileType::WEBP))
+		return false;
+
+	PreviewReader reader(filename);
+	if (!reader.IsValid())
+		return false;
+
+	PreviewScan scan;
+	switch (filetype)
+	{
+		case tFileType::JPG:	ScanJPG(reader, scan);							break;
+		case tFileType::TIFF:	ScanTIFF(reader, 0, reader.GetSize(), scan, true);	break;
+		case tFileType::PNG:	ScanPNG(reader, scan);							break;
+		case tFileType::WEBP:	ScanWEBP(reader, scan);							break;
+		default:																break;
+	}
+
+	if (scan.Candidates.empty() || (scan.MainWidth <= 0) || (scan.MainHeight <= 0))
+		return false;
+
+	// Smaller streams decode faster, so try them first. The first one big enough wins.
+	std::sort
+	(
+		scan.Candidates.begin(), scan.Candidates.end(),
+		[](const PreviewCandidate& a, const PreviewCandidate& b) { return a.Length < b.Length; }
+	);
+
+	float mainAspect = float(scan.MainWidth) / float(scan.MainHeight);
+	for (const PreviewCandidate& candidate : scan.Candidates)
+	{
+		if ((candidate.Length > MaxPreviewBytes) || (candidate.Offset >= reader.GetSize()) || (candidate.Length > (reader.GetSize() - candidate.Offset)))
+			continue;
+
+		int w = 0, h = 0;
+		if (!GetJPGSize(reader, candidate.Offset, candidate.Length, w, h))
+			continue;
+
+		// Same test the thumbnail generator uses to pick its scale. We want to shrink or keep, never grow.
+		float scale = tMath::tMin(float(minWidth) / float(w), float(minHeight) / float(h));
+		if (scale > 1.0f)
+			continue;
+
+		// Many cameras store 4:3 thumbnails with black bars for 3:2 sensors. Those would show the bars.
+		float aspect = float(w) / float(h);
+		if (tMath::tAbs(aspect - mainAspect) > 0.02f*mainAspect)
+			continue;
+
+		std::vector<uint8> data(candidate.Length);
+		if (!reader.Read(candidate.Offset, data.data(), int(candidate.Length)))
+			continue;
+
+		tImageJPG jpg;
+		if (!jpg.Set(data.data(), int(candidate.Length), false) || !jpg.IsValid())
+			continue;
+
+		int width = jpg.GetWidth();
+		int height = jpg.GetHeight();
+		preview.Set(width, height, jpg.StealPixels(), false);
+		return true;
+	}
+
+	return false;
+}
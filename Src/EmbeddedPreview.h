@@ -0,0 +1,32 @@
+// EmbeddedPreview.h
+//
+// Finds and decodes the reduced-size JPEG previews that cameras and many editors embed in image files. Supported are
+// EXIF IFD1 thumbnails and MPF preview images in JPEGs, reduced-resolution SubIFDs and IFD1 in TIFFs, and EXIF blocks
+// inside PNG (eXIf chunk) and WebP (EXIF chunk) files. Only the headers and the chosen preview are read, not the main
+// image data.
+//
+// Copyright (c) 2021 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <Foundation/tString.h>
+#include <System/tFile.h>
+#include <Image/tPicture.h>
+namespace Viewer
+{
+
+
+// Loads the smallest embedded preview that, when fit inside minWidth x minHeight keeping its aspect, does not need to
+// be upscaled. The preview must also have the same aspect as the main image so letterboxed camera thumbnails are
+// rejected. Returns false if there is no suitable preview, in which case the caller should decode the full image.
+bool LoadEmbeddedPreview(tImage::tPicture& preview, const tString& filename, tSystem::tFileType, int minWidth, int minHeight);
+
+
+}
@@ -13,7 +13,11 @@
 // PERFORMANCE OF THIS SOFTWARE.
 
 #include <mutex>
+#include <algorithm>
+#include <memory>
 #include <chrono>
+#include <cmath>
+#include <cstring>
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>				// Include glfw3.h after our OpenGL definitions.
 #include <Foundation/tHash.h>
@@ -22,17 +26,170 @@
 #include <System/tFile.h>
 #include <System/tTime.h>
 #include <System/tMachine.h>
-#include <System/tChunk.h>
 #include "Image.h"
 #include "Settings.h"
+#include "ThumbnailCache.h"
+#include "Compress.h"
+#include "EmbeddedPreview.h"
+#include "Downscale.h"
+#include "Resampler.h"
+#include "TextureStream.h"
+#include "TiledTexture.h"
+#include "Transpose.h"
+#include "BlockEncode.h"
 using namespace tStd;
 using namespace tSystem;
 using namespace tImage;
 using namespace tMath;
 using namespace Viewer;
-int Image::ThumbnailNumThreadsRunning = 0;
 tString Image::ThumbCacheDir;
-namespace Viewer { extern Settings Config; }
+namespace Viewer { extern Settings Config; extern Worker::Pool WorkerPool; extern ThumbnailCache ThumbCache; extern ThumbnailAtlas ThumbAtlas; }
+
+
+// The job copies what it needs from the Image so Execute never dereferences it. Owner is only read and cleared on the
+// main thread. If the Image is deleted while the job is running the owner is cleared and the result is discarded.
+class Image::ThumbnailJob : public Worker::Job
+{
+public:
+	ThumbnailJob(Image* owner, int level)																				: Owner(owner), Filename(owner->Filename), Filetype(owner->Filetype), Level(level) { }
+	void Execute() override																								{ Image::GenerateThumbnail(Thumbnail, Filename, Filetype, Level); }
+	void OnComplete() override;
+
+	Image* Owner;
+	tString Filename;
+	tFileType Filetype;
+	int Level;
+	tPicture Thumbnail;
+};
+
+
+void Image::ThumbnailJob::OnComplete()
+{
+	if (!Owner)
+		return;
+
+	tAssert(Owner->ThumbnailPending == this);
+	Owner->ThumbnailPending = nullptr;
+	if (!Thumbnail.IsValid())
+		return;
+
+	// The atlas may still hold a different level. The new one is uploaded on the next bind.
+	Owner->ThumbnailPicture.Set(Thumbnail.GetWidth(), Thumbnail.GetHeight(), Thumbnail.StealPixels(), false);
+	Owner->ThumbnailLevel = Level;
+	ThumbAtlas.Remove(Owner->ThumbnailSlot);
+}
+
+
+// Like the thumbnail job, Owner is only touched on the main thread. The job reads the picture's pixels but never the
+// picture itself. If the Image has to change or free the picture first, the job is handed the pixels to keep alive
+// (see HandOffPixels). The picture pointer is only used to find the chain on completion.
+class Image::MipmapJob : public Worker::Job
+{
+public:
+	MipmapJob(Image* owner, const tPicture& picture, tResampleFilter filter, bool chaining, bool compressed)				: Owner(owner), Picture(&picture), Pixels(picture.GetPixels()), Width(picture.GetWidth()), Height(picture.GetHeight()), Filter(filter), Chaining(chaining), Compressed(compressed) { }
+	void Execute() override;
+	void OnComplete() override;
+
+	Image* Owner;
+	const tPicture* Picture;
+	const tPixel* Pixels;
+	int Width;
+	int Height;
+	std::shared_ptr<tPixel> Keep;			// Only set and released on the main thread.
+	tResampleFilter Filter;
+	bool Chaining;
+	bool Compressed;
+	tList<tLayer> Levels;
+};
+
+
+void Image::MipmapJob::Execute()
+{
+	if (Filter != tResampleFilter::None)
+		Downscale::GenerateMipmaps(Levels, Pixels, Width, Height, Filter, Chaining);
+
+	if (!Compressed)
+		return;
+
+	// Each mipmap is made from the uncompressed level above it, so encoding waits until they're all done. BC1 has no
+	// useful alpha so only pictures with transparency pay for BC3.
+	bool opaque = true;
+	for (int p = 0; (p < Width*Height) && opaque; p++)
+		opaque = (Pixels[p].A == 255);
+
+	tPixelFormat format = opaque ? tPixelFormat::BC1_DXT1 : tPixelFormat::BC3_DXT5;
+	tList<tLayer> encoded;
+	encoded.Append(BlockEncode::EncodeLayer(format, Pixels, Width, Height));
+	while (tLayer* level = Levels.Remove())
+	{
+		encoded.Append(BlockEncode::EncodeLayer(format, (const tPixel*)level->Data, level->Width, level->Height));
+		delete level;
+	}
+
+	while (tLayer* level = encoded.Remove())
+		Levels.Append(level);
+}
+
+
+void Image::MipmapJob::OnComplete()
+{
+	if (!Owner)
+		return;
+
+	MipChain* chain = Owner->FindMipChain(*Picture);
+	tAssert(chain && (chain->Pending == this));
+	chain->Pending = nullptr;
+	chain->Ready = true;
+	chain->Compressed = Compressed;
+	while (tLayer* level = Levels.Remove())
+		chain->Levels.Append(level);
+	Owner->Info.MemSizeBytes = Owner->GetMemSizeBytes();
+}
+
+
+// Like the mipmap job, only the source frame's pixels are read, and they are kept alive for the job if the frame
+// changes first. The edit is made to a copy, which is handed to the owner on completion. An orphaned job frees its
+// result.
+class Image::FrameJob : public Worker::Job
+{
+public:
+	FrameJob(Image* owner, const tPicture& source, const FrameOp& op, int index)										: Owner(owner), Pixels(source.GetPixels()), Width(source.GetWidth()), Height(source.GetHeight()), Op(op), Index(index) { }
+	~FrameJob()																											{ delete Result; }
+	void Execute() override;
+	void OnComplete() override;
+
+	Image* Owner;
+	const tPixel* Pixels;
+	int Width;
+	int Height;
+	std::shared_ptr<tPixel> Keep;			// Only set and released on the main thread.
+	FrameOp Op;
+	int Index;
+	tPicture* Result = nullptr;
+};
+
+
+void Image::FrameJob::Execute()
+{
+	Result = new tPicture;
+	Result->Set(Width, Height, (tPixel*)Pixels, true);
+	Op(*Result);
+}
+
+
+void Image::FrameJob::OnComplete()
+{
+	if (!Owner)
+		return;
+
+	tAssert(Owner->EditJobs[Index] == this);
+	Owner->EditJobs[Index] = nullptr;
+	Owner->EditResults[Index] = Result;
+	Result = nullptr;
+	Owner->EditNumDone++;
+	if (Owner->EditNumDone == Owner->GetEditFramesTotal())
+		Owner->ApplyEdit();
+}
 
 
 const int Image::ThumbWidth			= 256;
@@ -40,6 +197,18 @@ const int Image::ThumbHeight		= 144;
 const int Image::ThumbMinDispWidth	= 64;
 
 
+int Image::GetThumbLevel(float displayWidth)
+{
+	// Picks the level closest in scale, so a level is never stretched or shrunk by more than about 1.4x. That keeps
+	// plain linear filtering looking fine without needing mipmaps.
+	if (displayWidth <= 0.0f)
+		return NumThumbLevels-1;
+
+	int level = int(tRound(std::log2(float(ThumbWidth) / displayWidth)));
+	return tClamp(level, 0, NumThumbLevels-1);
+}
+
+
 Image::Image() :
 	Filename(),
 	Filetype(tFileType::Unknown),
@@ -73,18 +242,13 @@ Image::Image(const tString& filename) :
 
 Image::~Image()
 {
-	// If we're being destroyed before the thumbnail thread is done, we have to wait because that thread
-	// accesses the thumbnail picture of this object... so 'this' must be valid.
-	if (ThumbnailThread.joinable())
-		ThumbnailThread.join();
-
-	// It is important that the thread count decrements if necessary since Images can be deleted
-	// when changing folders. The threads need to be available to do more work in a new folder.
-	if (ThumbnailRequested && ThumbnailThreadRunning)
-	{
-		ThumbnailNumThreadsRunning--;
-		tiClampMin(ThumbnailNumThreadsRunning, 0);
-	}
+	// Images are deleted when changing folders. A queued thumbnail job is removed so the workers are free for the new
+	// folder. One that can't be cancelled, because it's running or already done, is orphaned and discards its result
+	// on completion.
+	if (ThumbnailPending && !WorkerPool.Cancel(ThumbnailPending))
+		ThumbnailPending->Owner = nullptr;
+	ThumbnailPending = nullptr;
+	ThumbAtlas.Remove(ThumbnailSlot);
 
 	// Free GPU image mem and texture IDs.
 	Unload(true);
@@ -482,6 +646,9 @@ int Image::GetMemSizeBytes() const
 		numBytes += pic->GetNumPixels() * sizeof(tPixel);
 
 	numBytes += AltPicture.IsValid() ? AltPicture.GetNumPixels()*sizeof(tPixel) : 0;
+	for (MipChain* chain : MipChains)
+		for (tLayer* level = chain->Levels.First(); level; level = level->Next())
+			numBytes += level->GetDataSize();
 	return numBytes;
 }
 
@@ -568,18 +735,23 @@ bool Image::Unload(bool force)
 	if (!IsLoaded())
 		return true;
 
-	// Not allowed to unload if dirty (modified).
-	if (Dirty && !force)
+	// Not allowed to unload if dirty (modified) or about to be.
+	if ((Dirty || IsEditing()) && !force)
 		return false;
 
+	// Jobs still reading the pictures keep their pixels, so cancelling and unbinding don't have to copy or wait.
+	for (tPicture* picture = Pictures.First(); picture; picture = picture->Next())
+		HandOffPixels(*picture, false);
+	CancelEdits();
 	Unbind();
+	ReleaseStandIn();
 	DDSTexture2D.Clear();
 	DDSCubemap.Clear();
 	AltPicture.Clear();
 	AltPictureEnabled = false;
 	Pictures.Clear();
+	Orient = Transpose::Orientation();
 	Info.MemSizeBytes = 0;
-
 	LoadedTime = -1.0f;
 	return true;
 }
@@ -587,20 +759,228 @@ bool Image::Unload(bool force)
 
 void Image::Unbind()
 {
+	// Unbind is usually followed by a Bind after an edit. If the new texture has to stream, the one that was showing
+	// is drawn until it's ready. A half-streamed texture is no good as a stand-in. The stream reads the mipmaps, so it
+	// goes first, as do the tiles.
+	AbandonStream();
+	ReleaseTiled();
+	ClearMipmaps();
+	uint showing = 0;
+	if (AltPictureEnabled && AltPicture.IsValid())
+		showing = TexIDAlt;
+	else if (tPicture* currPic = CurrentPic())
+		showing = currPic->TextureID;
+
+	if (showing != 0)
+	{
+		ReleaseStandIn();
+		TexIDStandIn = showing;
+	}
+
 	for (tPicture* pic = Pictures.First(); pic; pic = pic->Next())
 	{
-		if (pic->TextureID != 0)
-		{
+		if ((pic->TextureID != 0) && (pic->TextureID != showing))
 			glDeleteTextures(1, &pic->TextureID);
-			pic->TextureID = 0;
-		}
+		pic->TextureID = 0;
 	}
 
-	if (TexIDAlt != 0)
-	{
+	if ((TexIDAlt != 0) && (TexIDAlt != showing))
 		glDeleteTextures(1, &TexIDAlt);
-		TexIDAlt = 0;
+	TexIDAlt = 0;
+}
+
+
+Image::MipChain* Image::FindMipChain(const tPicture& picture)
+{
+	for (MipChain* chain : MipChains)
+		if (chain->Picture == &picture)
+			return chain;
+
+	return nullptr;
+}
+
+
+Image::MipChain* Image::RequestMipmaps(const tPicture& picture)
+{
+	MipChain* chain = FindMipChain(picture);
+	if (chain)
+		return chain;
+
+	chain = new MipChain;
+	chain->Picture = &picture;
+	MipChains.push_back(chain);
+
+	// Without mipmaps a tiled picture would need every one of its full-size tiles to draw it zoomed out, so it always
+	// gets them.
+	tResampleFilter filter = tResampleFilter(Config.MipmapFilter);
+	bool chaining = Config.MipmapChaining;
+	if ((filter == tResampleFilter::None) && TiledTexture::NeedsTiling(picture.GetWidth(), picture.GetHeight()))
+	{
+		filter = tResampleFilter::Box;
+		chaining = true;
+	}
+
+	// Tiles are uploaded uncompressed, so tiled pictures are never compressed.
+	bool compressed = Config.CompressTextures && !TiledTexture::NeedsTiling(picture.GetWidth(), picture.GetHeight());
+	if ((filter == tResampleFilter::None) && !compressed)
+	{
+		chain->Ready = true;
+		return chain;
+	}
+
+	// Mipmaps are for the image being looked at, so they go ahead of any thumbnails.
+	chain->Pending = new MipmapJob(this, picture, filter, chaining, compressed);
+	WorkerPool.Submit(chain->Pending, MipmapPriority);
+	return chain;
+}
+
+
+void Image::PrefetchMipmaps()
+{
+	tAssert(!Worker::Pool::IsWorkerThread());
+	for (tPicture* picture = Pictures.First(); picture; picture = picture->Next())
+	{
+		if
+		(
+			TextureStream::ShouldStream(picture->GetNumPixels() * int(sizeof(tPixel))) ||
+			TiledTexture::NeedsTiling(picture->GetWidth(), picture->GetHeight())
+		)
+			RequestMipmaps(*picture);
+	}
+}
+
+
+void Image::ClearMipmaps()
+{
+	// A job that's still going is reading its picture, which is about to change. It's handed the pixels rather than
+	// waited for. A job that can't be cancelled is orphaned. It may also have run inline with the pool stopped and be
+	// waiting to be drained.
+	for (tPicture* picture = Pictures.First(); picture; picture = picture->Next())
+	{
+		MipChain* chain = FindMipChain(*picture);
+		if (chain && chain->Pending && (chain->Pending->GetState() != Worker::Job::State::Done))
+			HandOffPixels(*picture);
+	}
+
+	for (MipChain* chain : MipChains)
+	{
+		if (chain->Pending && !WorkerPool.Cancel(chain->Pending))
+			chain->Pending->Owner = nullptr;
+		delete chain;
+	}
+	MipChains.clear();
+}
+
+
+void Image::HandOffPixels(tPicture& picture, bool keepPicture)
+{
+	const tPixel* pixels = picture.GetPixels();
+	if (!pixels)
+		return;
+
+	// Queued jobs will read the pixels later, so they count too. Finished ones are done with them.
+	std::vector<std::shared_ptr<tPixel>*> readers;
+	for (MipChain* chain : MipChains)
+	{
+		MipmapJob* job = chain->Pending;
+		if (job && (job->Pixels == pixels) && (job->GetState() != Worker::Job::State::Done))
+			readers.push_back(&job->Keep);
+	}
+	for (FrameJob* job : EditJobs)
+	{
+		if (job && (job->Pixels == pixels) && (job->GetState() != Worker::Job::State::Done))
+			readers.push_back(&job->Keep);
+	}
+	if (readers.empty())
+		return;
+
+	int width = picture.GetWidth();
+	int height = picture.GetHeight();
+	float duration = picture.Duration;
+	uint textureID = picture.TextureID;
+	std::shared_ptr<tPixel> keep(picture.StealPixels(), [](tPixel* p) { delete[] p; });
+	for (std::shared_ptr<tPixel>* reader : readers)
+		*reader = keep;
+
+	if (!keepPicture)
+		return;
+
+	// Copying at the same time as the jobs read is fine.
+	tPixel* copy = new tPixel[width*height];
+	std::memcpy(copy, keep.get(), size_t(width)*size_t(height)*sizeof(tPixel));
+	picture.Set(width, height, copy, false);
+	picture.Duration = duration;
+	picture.TextureID = textureID;
+}
+
+
+void Image::AbandonStream()
+{
+	if (!Stream)
+		return;
+
+	delete Stream;
+	Stream = nullptr;
+	glDeleteTextures(1, StreamTexID);
+	*StreamTexID = 0;
+	StreamTexID = nullptr;
+}
+
+
+void Image::SetExactDisplay(bool exact)
+{
+	if (exact == ExactDisplay)
+		return;
+
+	ExactDisplay = exact;
+	bool altShowing = AltPictureEnabled && AltPicture.IsValid();
+	tPicture* currPic = CurrentPic();
+	for (tPicture* pic = Pictures.First(); pic; pic = pic->Next())
+		ReleaseCompressed(*pic, pic->TextureID, !altShowing && (pic == currPic));
+
+	ReleaseCompressed(AltPicture, TexIDAlt, altShowing);
+}
+
+
+void Image::ReleaseCompressed(const tPicture& picture, uint& texID, bool showing)
+{
+	MipChain* chain = FindMipChain(picture);
+	if (!chain || !chain->Compressed || (texID == 0))
+		return;
+
+	if (Stream && (StreamTexID == &texID))
+	{
+		AbandonStream();
+		return;
+	}
+
+	// The texture being drawn stays up until its replacement is drawable.
+	if (showing)
+	{
+		ReleaseStandIn();
+		TexIDStandIn = texID;
 	}
+	else
+	{
+		glDeleteTextures(1, &texID);
+	}
+	texID = 0;
+}
+
+
+void Image::ReleaseStandIn()
+{
+	if (TexIDStandIn != 0)
+		glDeleteTextures(1, &TexIDStandIn);
+	TexIDStandIn = 0;
+}
+
+
+void Image::ReleaseTiled()
+{
+	delete Tiled;
+	Tiled = nullptr;
+	TiledPicture = nullptr;
 }
 
 
@@ -625,11 +1005,14 @@ int Image::GetWidth() const
 	if (AltPicture.IsValid() && AltPictureEnabled)
 		return AltPicture.GetWidth();
 
-	tPicture* picture = GetCurrentPic();
-	if (picture && picture->IsValid())
-		return picture->GetWidth();
+	tPicture* picture = CurrentPic();
+	if (!picture || !picture->IsValid())
+		return 0;
 
-	return 0;
+	int w = picture->GetWidth();
+	int h = picture->GetHeight();
+	Orient.MapSize(w, h);
+	return w;
 }
 
 
@@ -638,11 +1021,47 @@ int Image::GetHeight() const
 	if (AltPicture.IsValid() && AltPictureEnabled)
 		return AltPicture.GetHeight();
 
-	tPicture* picture = GetCurrentPic();
-	if (picture && picture->IsValid())
-		return picture->GetHeight();
+	tPicture* picture = CurrentPic();
+	if (!picture || !picture->IsValid())
+		return 0;
 
-	return 0;
+	int w = picture->GetWidth();
+	int h = picture->GetHeight();
+	Orient.MapSize(w, h);
+	return h;
+}
+
+
+float Image::GetCurrentFrameDuration() const
+{
+	tPicture* picture = CurrentPic();
+	return picture ? picture->Duration : 0.0f;
+}
+
+
+int Image::GetCurrentFrameWidth() const
+{
+	tPicture* picture = CurrentPic();
+	if (!picture)
+		return 0;
+
+	int w = picture->GetWidth();
+	int h = picture->GetHeight();
+	Orient.MapSize(w, h);
+	return w;
+}
+
+
+int Image::GetCurrentFrameHeight() const
+{
+	tPicture* picture = CurrentPic();
+	if (!picture)
+		return 0;
+
+	int w = picture->GetWidth();
+	int h = picture->GetHeight();
+	Orient.MapSize(w, h);
+	return h;
 }
 
 
@@ -651,9 +1070,15 @@ tColouri Image::GetPixel(int x, int y) const
 	if (AltPicture.IsValid() && AltPictureEnabled)
 		return AltPicture.GetPixel(x, y);
 
-	tPicture* picture = GetCurrentPic();
+	tPicture* picture = CurrentPic();
 	if (picture && picture->IsValid())
+	{
+		int w = picture->GetWidth();
+		int h = picture->GetHeight();
+		Orient.MapSize(w, h);
+		Orient.MapPixel(x, y, w, h);
 		return picture->GetPixel(x, y);
+	}
 
 	// Generally the PictureImage should always be valid. When dds files (tTextures) are loaded, they get
 	// uncompressed into valid PictureImage files so the pixel info can be read.
@@ -661,88 +1086,462 @@ tColouri Image::GetPixel(int x, int y) const
 }
 
 
+Transpose::Orientation Image::GetOrientation() const
+{
+	if (AltPicture.IsValid() && AltPictureEnabled)
+		return Transpose::Orientation();
+
+	return Orient;
+}
+
+
+void Image::GetStoredSize(int& width, int& height) const
+{
+	width = 0;
+	height = 0;
+	if (AltPicture.IsValid() && AltPictureEnabled)
+	{
+		width = AltPicture.GetWidth();
+		height = AltPicture.GetHeight();
+	}
+	else if (tPicture* picture = CurrentPic())
+	{
+		width = picture->GetWidth();
+		height = picture->GetHeight();
+	}
+}
+
+
+void Image::BakeOrientation()
+{
+	if (Orient.IsIdentity())
+		return;
+
+	// While the orientation is pending during edits, the first edit is the bake. It's taken over and done here so the
+	// pictures are as shown now. Its jobs may still be reading them.
+	FrameEdit* queued = nullptr;
+	if (IsEditing() && EditQueue.front()->Bake)
+	{
+		queued = EditQueue.front();
+		DropEditJobs();
+		EditQueue.erase(EditQueue.begin());
+	}
+
+	// The stand-in is the texture the wrong way round, so it can't be shown while the baked one streams. Crop steps
+	// still on the stored pictures need a copy before they go.
+	Unbind();
+	ReleaseStandIn();
+	UndoStack.KeepBase(Pictures);
+	Transpose::Orientation orientation = Orient;
+	std::vector<tPicture*> frames;
+	for (tPicture* picture = Pictures.First(); picture; picture = picture->Next())
+		frames.push_back(picture);
+
+	WorkerPool.ParallelFor
+	(
+		int(frames.size()), 1,
+		[&frames, orientation](int begin, int end) { for (int f = begin; f < end; f++) Transpose::Apply(*frames[f], orientation); }
+	);
+
+	// The turn and flip steps still undo, now on the orientation starting from identity. The crop steps build the
+	// pictures from their copies. The other steps hold the pixels as shown, so they don't change.
+	Orient = Transpose::Orientation();
+	if (!queued)
+		return;
+
+	if (queued->Then)
+		queued->Then();
+	delete queued;
+	EditApplied = true;
+	if (IsEditing())
+		StartEdit();
+}
+
+
+void Image::QueueBake(const std::function<void()>& then)
+{
+	// While editing, a pending orientation is already being baked by the first edit.
+	if (Orient.IsIdentity() || IsEditing())
+	{
+		if (then)
+			then();
+		return;
+	}
+
+	if ((Pictures.Count() > 1) && WorkerPool.IsRunning())
+	{
+		Transpose::Orientation orientation = Orient;
+		FrameEdit* edit = new FrameEdit;
+		edit->Desc = "Bake Orientation";
+		edit->Prepare = EachFrame([orientation](tPicture& picture) { Transpose::Apply(picture, orientation); });
+		edit->Bake = true;
+		edit->Then = then;
+		EditQueue.push_back(edit);
+		StartEdit();
+		return;
+	}
+
+	BakeOrientation();
+	if (then)
+		then();
+}
+
+
 void Image::Rotate90(bool antiClockWise)
 {
+	// Lossless, so undo just rotates back. The step does the rotate both ways.
 	tString desc; tsPrintf(desc, "Rotate 90 %s", antiClockWise ? "ACW" : "CW");
-	PushUndo(desc);
-	for (tPicture* picture = Pictures.First(); picture; picture = picture->Next())
-		picture->Rotate90(antiClockWise);
+	if (!IsEditing())
+	{
+		UndoStack.Push(new Undo::Step_Rotate90(desc, Dirty, antiClockWise), &Orient);
+		Dirty = true;
+		return;
+	}
 
-	Dirty = true;
+	// Behind a running edit the turn happens to the pictures it leaves.
+	FrameEdit* edit = new FrameEdit;
+	edit->Desc = desc;
+	edit->Prepare = EachFrame([antiClockWise](tPicture& picture) { Transpose::Rotate90(picture, antiClockWise); });
+	edit->MakeStep = [desc, antiClockWise](bool dirty) -> Undo::Step_Operation* { return new Undo::Step_Rotate90(desc, dirty, antiClockWise); };
+	QueueEdit(edit);
 }
 
 
 void Image::Rotate(float angle, const tColouri& fill, tResampleFilter upFilter, tResampleFilter downFilter)
 {
 	tString desc; tsPrintf(desc, "Rotate %.1f", tRadToDeg(angle));
-	PushUndo(desc);
-	for (tPicture* picture = Pictures.First(); picture; picture = picture->Next())
-		picture->RotateCenter(angle, fill, upFilter, downFilter);
+	EditFrames
+	(
+		desc,
+		EachFrame([angle, fill, upFilter, downFilter](tPicture& picture) { picture.RotateCenter(angle, fill, upFilter, downFilter); })
+	);
+}
 
-	Dirty = true;
+
+void Image::RotateCrop(float angle, bool resize, const tColouri& fill, tResampleFilter upFilter)
+{
+	// Replaces a rotate onto a bigger canvas, a crop, and a resample back up, each with its own buffer and undo step.
+	tString desc; tsPrintf(desc, "Rotate %.1f %s", tRadToDeg(angle), resize ? "Crop Resize" : "Crop");
+	tPixel fillPixel = fill;
+	EditFrames
+	(
+		desc,
+		EachFrame
+		(
+			[angle, resize, fillPixel, upFilter](tPicture& picture)
+			{
+				int srcW = picture.GetWidth();
+				int srcH = picture.GetHeight();
+				Resampler::Affine map;
+				int dstW = 0;
+				int dstH = 0;
+				Resampler::GetRotateCropMap(map, dstW, dstH, srcW, srcH, angle, resize);
+
+				// The crop is never bigger than the source, so the warp never reduces and only the up filter applies.
+				// Without one the rotate has always been nearest.
+				tResampleFilter filter = (upFilter != tResampleFilter::None) ? upFilter : tResampleFilter::Nearest;
+
+				tPixel* pixels = new tPixel[dstW*dstH];
+				Resampler::Warp(picture.GetPixels(), srcW, srcH, pixels, dstW, dstH, map, filter, fillPixel);
+				float duration = picture.Duration;
+				picture.Set(dstW, dstH, pixels, false);
+				picture.Duration = duration;
+			}
+		)
+	);
 }
 
 
 void Image::Flip(bool horizontal)
 {
 	tString desc; tsPrintf(desc, "Flip %s", horizontal ? "Horiz" : "Vert");
-	PushUndo(desc);
-	for (tPicture* picture = Pictures.First(); picture; picture = picture->Next())
-		picture->Flip(horizontal);
+	if (!IsEditing())
+	{
+		UndoStack.Push(new Undo::Step_Flip(desc, Dirty, horizontal), &Orient);
+		Dirty = true;
+		return;
+	}
 
-	Dirty = true;
+	FrameEdit* edit = new FrameEdit;
+	edit->Desc = desc;
+	edit->Prepare = EachFrame([horizontal](tPicture& picture) { Transpose::Flip(picture, horizontal); });
+	edit->MakeStep = [desc, horizontal](bool dirty) -> Undo::Step_Operation* { return new Undo::Step_Flip(desc, dirty, horizontal); };
+	QueueEdit(edit);
 }
 
 
 void Image::Crop(int newWidth, int newHeight, int originX, int originY, const tColouri& fillColour)
 {
 	tString desc; tsPrintf(desc, "Crop %d %d", newWidth, newHeight);
-	PushUndo(desc);
-	for (tPicture* picture = Pictures.First(); picture; picture = picture->Next())
-		picture->Crop(newWidth, newHeight, originX, originY, fillColour);
+	if (CropWindow(desc, newWidth, newHeight, originX, originY))
+		return;
 
-	Dirty = true;
+	Unbind();
+	EditFrames
+	(
+		desc,
+		EachFrame([=](tPicture& picture) { picture.Crop(newWidth, newHeight, originX, originY, fillColour); })
+	);
 }
 
 
 void Image::Crop(int newWidth, int newHeight, tPicture::Anchor anchor, const tColouri& fillColour)
 {
+	// The origin is worked out as tPicture does it. The anchors go left to right and then top to bottom.
 	tString desc; tsPrintf(desc, "Crop %d %d", newWidth, newHeight);
-	PushUndo(desc);
-	for (tPicture* picture = Pictures.First(); picture; picture = picture->Next())
-		picture->Crop(newWidth, newHeight, anchor, fillColour);
+	int w = GetCurrentFrameWidth();
+	int h = GetCurrentFrameHeight();
+	int column = int(anchor) % 3;
+	int row = int(anchor) / 3;
+	int originX = (column == 0) ? 0 : ((column == 1) ? (w/2 - newWidth/2) : (w - newWidth));
+	int originY = (row == 0) ? (h - newHeight) : ((row == 1) ? (h/2 - newHeight/2) : 0);
+	if (CropWindow(desc, newWidth, newHeight, originX, originY))
+		return;
 
-	Dirty = true;
+	Unbind();
+	EditFrames
+	(
+		desc,
+		EachFrame([=](tPicture& picture) { picture.Crop(newWidth, newHeight, anchor, fillColour); })
+	);
 }
 
 
-void Image::Crop(const tColouri& borderColour, uint32 channels)
+bool Image::CropWindow(const tString& desc, int newWidth, int newHeight, int originX, int originY)
 {
-	PushUndo("Crop Borders");
-	for (tPicture* picture = Pictures.First(); picture; picture = picture->Next())
-		picture->Crop(borderColour, channels);
+	// Only a crop inside the picture, the same for every frame, can be a window. Behind a running edit the sizes
+	// aren't known yet.
+	tPicture* first = Pictures.First();
+	if (IsEditing() || !first || !first->IsValid() || (newWidth <= 0) || (newHeight <= 0))
+		return false;
+
+	for (tPicture* picture = first->Next(); picture; picture = picture->Next())
+		if ((picture->GetWidth() != first->GetWidth()) || (picture->GetHeight() != first->GetHeight()))
+			return false;
+
+	int w = first->GetWidth();
+	int h = first->GetHeight();
+	Orient.MapSize(w, h);
+	if ((originX < 0) || (originY < 0) || (originX + newWidth > w) || (originY + newHeight > h))
+		return false;
 
+	Transpose::Orientation cropped = Orient;
+	cropped.Crop(originX, originY, newWidth, newHeight, w, h);
+	UndoStack.Push(new Undo::Step_Crop(desc, Dirty, Orient, cropped), &Orient);
 	Dirty = true;
+	return true;
+}
+
+
+void Image::Crop(const tColouri& borderColour, uint32 channels)
+{
+	EditFrames
+	(
+		"Crop Borders",
+		EachFrame([borderColour, channels](tPicture& picture) { picture.Crop(borderColour, channels); })
+	);
 }
 
 
 void Image::Resample(int newWidth, int newHeight, tImage::tResampleFilter filter, tImage::tResampleEdgeMode edgeMode)
 {
+	// Edited inline, the resampler splits the picture across the pool. On a worker each frame stays on its own thread.
 	tString desc; tsPrintf(desc, "Resample %d %d", newWidth, newHeight);
-	PushUndo(desc);
-	for (tPicture* picture = Pictures.First(); picture; picture = picture->Next())
-		picture->Resample(newWidth, newHeight, filter, edgeMode);
+	EditFrames
+	(
+		desc,
+		EachFrame([=](tPicture& picture) { Resampler::Resample(picture, newWidth, newHeight, filter, edgeMode); })
+	);
+}
 
-	Dirty = true;
+
+void Image::EditFrames(const tString& desc, const FramePrep& prepare)
+{
+	FrameEdit* edit = new FrameEdit;
+	edit->Desc = desc;
+	edit->Prepare = prepare;
+	QueueEdit(edit);
+}
+
+
+void Image::QueueEdit(FrameEdit* edit)
+{
+	// Edits work on the pixels as shown. A multi-frame bake goes ahead of this edit in the queue.
+	QueueBake();
+
+	// Queued behind a running edit, or on the pool if there are frames to share out.
+	if (IsEditing() || ((Pictures.Count() > 1) && WorkerPool.IsRunning()))
+	{
+		EditQueue.push_back(edit);
+		if (EditQueue.size() == 1)
+			StartEdit();
+		return;
+	}
+
+	tPicture* first = Pictures.First();
+	FrameOp op = first ? edit->Prepare(first->GetWidth(), first->GetHeight()) : FrameOp();
+	if (op)
+	{
+		if (edit->MakeStep)
+			UndoStack.Push(edit->MakeStep(Dirty));
+		else
+			PushUndo(edit->Desc, edit->Changed);
+
+		for (tPicture* picture = Pictures.First(); picture; picture = picture->Next())
+			op(*picture);
+		Dirty = true;
+	}
+	delete edit;
+}
+
+
+void Image::StartEdit()
+{
+	tAssert(IsEditing() && EditJobs.empty());
+	FrameEdit* edit = EditQueue.front();
+	tPicture* first = Pictures.First();
+	FrameOp op = first ? edit->Prepare(first->GetWidth(), first->GetHeight()) : FrameOp();
+
+	// An edit that has nothing to do is skipped. The prepare function may decide the earlier edits left nothing to do.
+	if (!op)
+	{
+		EditQueue.erase(EditQueue.begin());
+		delete edit;
+		if (IsEditing())
+			StartEdit();
+		return;
+	}
+
+	EditNumDone = 0;
+	int index = 0;
+	for (tPicture* picture = Pictures.First(); picture; picture = picture->Next(), index++)
+	{
+		FrameJob* job = new FrameJob(this, *picture, op, index);
+		EditJobs.push_back(job);
+		EditResults.push_back(nullptr);
+		WorkerPool.Submit(job, EditPriority);
+	}
+}
+
+
+void Image::ApplyEdit()
+{
+	FrameEdit* edit = EditQueue.front();
+	EditQueue.erase(EditQueue.begin());
+
+	// Unbind goes first as the mipmaps and tiles read the pictures. Every frame changes at once so one undo step covers
+	// them all. A bake isn't a step. The turn and flip steps undo from the identity orientation afterwards, crop steps
+	// get a copy of the pictures they were on, and the stand-in can't be shown as it's the texture the wrong way round.
+	Unbind();
+	if (edit->Bake)
+	{
+		ReleaseStandIn();
+		UndoStack.KeepBase(Pictures);
+	}
+	else if (edit->MakeStep)
+	{
+		UndoStack.Push(edit->MakeStep(Dirty));
+	}
+	else
+	{
+		PushUndo(edit->Desc, edit->Changed);
+	}
+
+	int index = 0;
+	for (tPicture* picture = Pictures.First(); picture; picture = picture->Next(), index++)
+	{
+		tPicture* result = EditResults[index];
+		float duration = picture->Duration;
+		picture->Set(result->GetWidth(), result->GetHeight(), result->StealPixels(), false);
+		picture->Duration = duration;
+		delete result;
+	}
+	EditJobs.clear();
+	EditResults.clear();
+	EditNumDone = 0;
+
+	if (edit->Bake)
+		Orient = Transpose::Orientation();
+	else
+		Dirty = true;
+	if (edit->Then)
+		edit->Then();
+	delete edit;
+
+	EditApplied = true;
+	if (IsEditing())
+		StartEdit();
+}
+
+
+void Image::CancelEdits()
+{
+	DropEditJobs();
+	for (FrameEdit* edit : EditQueue)
+		delete edit;
+	EditQueue.clear();
+}
+
+
+void Image::DropEditJobs()
+{
+	// Queued jobs are removed. Running ones are orphaned and throw their results away on completion. They are still
+	// reading the frames, so the frames hand them their pixels and carry on with copies rather than waiting for them.
+	if (!EditJobs.empty())
+	{
+		for (tPicture* picture = Pictures.First(); picture; picture = picture->Next())
+			HandOffPixels(*picture);
+	}
+
+	for (FrameJob* job : EditJobs)
+	{
+		if (job && !WorkerPool.Cancel(job))
+			job->Owner = nullptr;
+	}
+	for (tPicture* result : EditResults)
+		delete result;
+
+	EditJobs.clear();
+	EditResults.clear();
+	EditNumDone = 0;
 }
 
 
 void Image::SetPixelColour(int x, int y, const tColouri& colour, bool pushUndo, bool surpressDirty)
 {
+	// The pixel would be lost when the running edit replaces the pictures.
+	if (IsEditing())
+		return;
+
+	// The position is in the picture as shown. Behind a queued bake the colour is set as an edit of its own.
+	QueueBake();
+	if (IsEditing())
+	{
+		FrameEdit* edit = new FrameEdit;
+		tsPrintf(edit->Desc, "Pixel Colour (%d,%d)", x, y);
+		edit->Changed = Undo::Region(-1, x, y, 1, 1);
+		edit->Prepare = EachFrame
+		(
+			[x, y, colour](tPicture& picture)
+			{
+				if ((x > 0) && (x < picture.GetWidth()) && (y > 0) && (y < picture.GetHeight()))
+					picture.SetPixel(x, y, colour);
+			}
+		);
+		QueueEdit(edit);
+		return;
+	}
+
+	// Without a push the pixel belongs to the last step, as when dragging the colour around.
+	Undo::Region region(-1, x, y, 1, 1);
 	if (pushUndo)
 	{
 		tString desc; tsPrintf(desc, "Pixel Colour (%d,%d)", x, y);
-		PushUndo(desc);
+		PushUndo(desc, region);
+	}
+	else
+	{
+		UndoStack.Touch(Pictures, region);
 	}
 
 	for (tPicture* picture = Pictures.First(); picture; picture = picture->Next())
@@ -758,22 +1557,51 @@ void Image::SetPixelColour(int x, int y, const tColouri& colour, bool pushUndo,
 
 void Image::SetFrameDuration(float duration, bool allFrames)
 {
+	std::vector<float> before;
+	std::vector<float> after;
+	tPicture* currPic = CurrentPic();
+	for (tPicture* picture = Pictures.First(); picture; picture = picture->Next())
+	{
+		before.push_back(picture->Duration);
+		after.push_back((allFrames || (picture == currPic)) ? duration : picture->Duration);
+	}
+
 	tString desc; tsPrintf(desc, "Frame Dur %.3f", duration);
-	PushUndo(desc);
+	Undo::Step_FrameDuration* step = new Undo::Step_FrameDuration(desc, Dirty, before, after);
+	UndoStack.Push(step);
+	step->Reapply(Pictures);
+
+	Dirty = true;
+}
 
-	if (allFrames)
+
+void Image::Undo()
+{
+	if (IsEditing())
+		return;
+
+	// Turns, flips, and frame durations leave the pixels alone. Anything else needs them as they're shown, and waits
+	// for a queued bake.
+	if (!UndoStack.UndoNeedsPixels())
 	{
-		for (tPicture* picture = Pictures.First(); picture; picture = picture->Next())
-			picture->Duration = duration;
+		UndoStack.Undo(Pictures, Dirty, &Orient);
+		return;
 	}
-	else
+	QueueBake([this]() { Unbind(); UndoStack.Undo(Pictures, Dirty, &Orient); });
+}
+
+
+void Image::Redo()
+{
+	if (IsEditing())
+		return;
+
+	if (!UndoStack.RedoNeedsPixels())
 	{
-		tPicture* pic = GetCurrentPic();
-		if (pic)
-			pic->Duration = duration;
+		UndoStack.Redo(Pictures, Dirty, &Orient);
+		return;
 	}
-
-	Dirty = true;
+	QueueBake([this]() { Unbind(); UndoStack.Redo(Pictures, Dirty, &Orient); });
 }
 
 
@@ -796,48 +1624,211 @@ void Image::PrintInfo()
 }
 
 
+// The top level comes straight from the picture. The rest are the worker-made mipmaps.
+static void GetStreamLevels(std::vector<TextureStream::Level>& levels, const tPicture& picture, const tList<tLayer>& mipmaps)
+{
+	levels.push_back({ (const uint8*)picture.GetPixels(), picture.GetWidth(), picture.GetHeight(), picture.GetNumPixels() * int(sizeof(tPixel)) });
+	for (tLayer* layer = mipmaps.First(); layer; layer = layer->Next())
+		levels.push_back({ layer->Data, layer->Width, layer->Height, layer->GetDataSize() });
+}
+
+
 uint64 Image::Bind()
 {
 	if (AltPictureEnabled && AltPicture.IsValid())
+		return BindPicture(AltPicture, TexIDAlt);
+
+	tPicture* currPic = CurrentPic();
+	if (!IsLoaded() || !currPic)
+		return 0;
+
+	if (TiledTexture::NeedsTiling(currPic->GetWidth(), currPic->GetHeight()))
 	{
-		if (TexIDAlt != 0)
-		{
-			glBindTexture(GL_TEXTURE_2D, TexIDAlt);
-			return TexIDAlt;
-		}
+		BindTiled(*currPic);
+		return 0;
+	}
+	ReleaseTiled();
+
+	// Uploading a frame releases the stand-in, so the look-ahead waits until the current frame shows its own texture.
+	uint64 texID = BindPicture(*currPic, currPic->TextureID);
+	bool showingOwn = (texID != 0) && (texID == currPic->TextureID);
+	UpdateResidentFrames(showingOwn);
+	glBindTexture(GL_TEXTURE_2D, GLuint(texID));
+	return texID;
+}
 
-		glGenTextures(1, &TexIDAlt);
-		if (TexIDAlt == 0)
-			return 0;
 
-		tList<tLayer> layers;
-		AltPicture.GenerateLayers(layers, tResampleFilter(Config.MipmapFilter), tResampleEdgeMode::Clamp, Config.MipmapChaining);
-		BindLayers(layers, TexIDAlt);
-		return TexIDAlt;
+void Image::UpdateResidentFrames(bool lookAhead)
+{
+	int numFrames = GetNumFrames();
+	if (numFrames <= 1)
+		return;
+
+	// Frames are ranked by how many steps away they are in the play direction.
+	int step = FramePlayRev ? -1 : 1;
+	std::vector<tPicture*> frames;
+	frames.reserve(numFrames);
+	for (tPicture* picture = Pictures.First(); picture; picture = picture->Next())
+		frames.push_back(picture);
+
+	// The look-ahead frames share the upload budget with streaming. At least one goes up per call so they keep up
+	// with playback. Ones big enough to stream wait until they are shown.
+	int numUploads = 0;
+	for (int ahead = 1; lookAhead && (ahead <= FrameLookAhead); ahead++)
+	{
+		int frame = FrameNum + ahead*step;
+		if (!FramePlayLooping && ((frame < 0) || (frame >= numFrames)))
+			break;
+
+		tPicture* picture = frames[((frame % numFrames) + numFrames) % numFrames];
+		if ((picture->TextureID != 0) || !picture->IsValid())
+			continue;
+
+		if (TextureStream::ShouldStream(picture->GetNumPixels() * int(sizeof(tPixel))))
+			continue;
+
+		if ((numUploads > 0) && !TextureStream::HasBudget())
+			break;
+
+		BindPicture(*picture, picture->TextureID);
+		numUploads++;
 	}
 
-	tPicture* currPic = GetCurrentPic();
-	if (currPic && (currPic->TextureID != 0))
+	// Evict the frames furthest from being shown. The frame just behind the current one is the last to come around
+	// again, so it goes first.
+	std::vector<std::pair<int, tPicture*>> resident;
+	for (int frame = 0; frame < numFrames; frame++)
 	{
-		glBindTexture(GL_TEXTURE_2D, currPic->TextureID);
-		return currPic->TextureID;
+		if ((frame == FrameNum) || (frames[frame]->TextureID == 0))
+			continue;
+
+		int distance = ((frame - FrameNum)*step + numFrames) % numFrames;
+		resident.push_back(std::make_pair(distance, frames[frame]));
 	}
 
-	if (!IsLoaded())
-		return 0;
+	int numEvict = int(resident.size()) - (MaxResidentFrames-1);
+	if (numEvict <= 0)
+		return;
 
-	for (tPicture* picture = Pictures.First(); picture; picture = picture->Next())
+	std::sort(resident.begin(), resident.end());
+	for (int e = 0; e < numEvict; e++)
 	{
-		if (!picture->IsValid())
+		tPicture* picture = resident[resident.size()-1-e].second;
+		if (Stream && (StreamTexID == &picture->TextureID))
+		{
+			AbandonStream();
 			continue;
+		}
+		glDeleteTextures(1, &picture->TextureID);
+		picture->TextureID = 0;
+	}
+}
+
+
+void Image::BindTiled(const tPicture& picture)
+{
+	if (Tiled && (TiledPicture == &picture))
+		return;
+
+	ReleaseTiled();
+	MipChain* chain = RequestMipmaps(picture);
+	if (!chain->Ready)
+		return;
+
+	std::vector<TextureStream::Level> levels;
+	GetStreamLevels(levels, picture, chain->Levels);
+	Tiled = new TiledTexture(levels);
+	TiledPicture = &picture;
+}
+
+
+uint64 Image::BindPicture(tPicture& picture, uint& texID)
+{
+	if ((texID != 0) && !(Stream && (StreamTexID == &texID)))
+	{
+		glBindTexture(GL_TEXTURE_2D, texID);
+		return texID;
+	}
+
+	if (texID == 0)
+	{
+		if (!picture.IsValid())
+			return 0;
+
+		// Small pictures are quick enough to mipmap and upload right here.
+		int numBytes = picture.GetNumPixels() * int(sizeof(tPixel));
+		if (!TextureStream::ShouldStream(numBytes))
+		{
+			glGenTextures(1, &texID);
+			if (texID == 0)
+				return 0;
+
+			tList<tLayer> layers;
+			picture.GenerateLayers(layers, tResampleFilter(Config.MipmapFilter), tResampleEdgeMode::Clamp, Config.MipmapChaining);
+			BindLayers(layers, texID);
+			ReleaseStandIn();
+			return texID;
+		}
+
+		// Big pictures have their mipmaps made on a worker, usually requested as soon as the image loaded. Until
+		// they're ready the stand-in is drawn.
+		MipChain* chain = RequestMipmaps(picture);
+		if (!chain->Ready)
+		{
+			glBindTexture(GL_TEXTURE_2D, TexIDStandIn);
+			return TexIDStandIn;
+		}
+
+		glGenTextures(1, &texID);
+		if (texID == 0)
+			return 0;
+
+		// Exact display of a compressed picture only needs level 0. It's shown magnified so mipmaps wouldn't be used.
+		std::vector<TextureStream::Level> levels;
+		tPixelFormat format = tPixelFormat::R8G8B8A8;
+		if (chain->Compressed && !ExactDisplay && chain->Levels.First())
+		{
+			format = chain->Levels.First()->PixelFormat;
+			for (tLayer* layer = chain->Levels.First(); layer; layer = layer->Next())
+				levels.push_back({ layer->Data, layer->Width, layer->Height, layer->GetDataSize() });
+		}
+		else if (chain->Compressed)
+		{
+			levels.push_back({ (const uint8*)picture.GetPixels(), picture.GetWidth(), picture.GetHeight(), numBytes });
+		}
+		else
+		{
+			GetStreamLevels(levels, picture, chain->Levels);
+		}
+
+		GLint srcFormat, dstFormat;
+		GLenum srcType;
+		bool compressed;
+		GetGLFormatInfo(srcFormat, srcType, dstFormat, compressed, format);
+
+		// Only one picture streams at a time. Switching frames part way through starts the new one over.
+		AbandonStream();
+		Stream = new TextureStream(texID, levels, srcFormat, srcType, dstFormat, compressed);
+		StreamTexID = &texID;
+	}
 
-		glGenTextures(1, &picture->TextureID);
+	bool drawable = Stream->Update();
+	if (Stream->IsComplete())
+	{
+		delete Stream;
+		Stream = nullptr;
+		StreamTexID = nullptr;
+		ReleaseStandIn();
+	}
 
-		tList<tLayer> layers;
-		picture->GenerateLayers(layers, tResampleFilter(Config.MipmapFilter), tResampleEdgeMode::Clamp, Config.MipmapChaining);
-		BindLayers(layers, picture->TextureID);
+	if (drawable)
+	{
+		glBindTexture(GL_TEXTURE_2D, texID);
+		return texID;
 	}
-	return GetCurrentPic()->TextureID;
+
+	glBindTexture(GL_TEXTURE_2D, TexIDStandIn);
+	return TexIDStandIn;
 }
 
 
@@ -1040,134 +2031,136 @@ bool Image::ConvertCubemapToPicture()
 }
 
 
-uint64 Image::BindThumbnail()
+uint64 Image::BindThumbnail(tVector2& uv0, tVector2& uv1, int& atlasPage)
 {
 	if (!ThumbnailRequested)
 		return 0;
 
-	if (!ThumbnailThreadFlag.test_and_set())
+	// ThumbnailPicture is filled in when the pool delivers the completed job. If the job failed, ThumbnailPicture
+	// will be invalid and we return 0. While a job for a different level is pending we keep showing the old one.
+	if (ThumbnailPending)
 	{
-		ThumbnailThread.join();
-		ThumbnailThreadRunning = false;
-		ThumbnailNumThreadsRunning--;
+		atlasPage = ThumbnailSlot.Page;
+		return ThumbAtlas.Use(ThumbnailSlot, uv0, uv1);
 	}
 
-	if (ThumbnailThreadRunning)
-		return 0;
-
-	// We only ever access ThumbnailPicture once the worker thread is completed,
-	// If the worker thread failed, ThumbnailPicture will be invalid and we return 0.
 	if (ThumbnailInvalidateRequested)
 	{
 		ThumbnailRequested = false;
 		ThumbnailInvalidateRequested = false;
 		ThumbnailPicture.Clear();
-		if (TexIDThumbnail != 0)
-		{
-			glDeleteTextures(1, &TexIDThumbnail);
-			TexIDThumbnail = 0;
-		}
+		ThumbAtlas.Remove(ThumbnailSlot);
 		return 0;
 	}
 
 	if (ThumbnailPicture.IsValid())
 	{
-		if (TexIDThumbnail != 0)
-		{
-			glBindTexture(GL_TEXTURE_2D, TexIDThumbnail);
-			return TexIDThumbnail;
-		}
-
-		glGenTextures(1, &TexIDThumbnail);
-		if (TexIDThumbnail == 0)
-			return 0;
+		// The slot may have been evicted to make room for others. We still have the picture so upload it again.
+		if (!ThumbAtlas.IsValid(ThumbnailSlot))
+			ThumbnailSlot = ThumbAtlas.Add(ThumbnailPicture, ThumbnailLevel);
 
-		tList<tLayer> layers;
-		ThumbnailPicture.GenerateLayers(layers, tResampleFilter(Config.MipmapFilter), tResampleEdgeMode::Clamp, Config.MipmapChaining);
-		BindLayers(layers, TexIDThumbnail);
-		return TexIDThumbnail;
+		atlasPage = ThumbnailSlot.Page;
+		return ThumbAtlas.Use(ThumbnailSlot, uv0, uv1);
 	}
 
 	return 0;
 }
 
 
-void Image::GenerateThumbnailBridge(Image* img)
+bool Image::IsThumbnailWorkerActive() const
 {
-	img->GenerateThumbnail();
+	return ThumbnailPending && (ThumbnailPending->GetState() != Worker::Job::State::Queued);
 }
 
 
-void Image::GenerateThumbnail()
+tuint256 Image::GetThumbnailKey(const tString& filename)
 {
-	// This thread (only) is allowed to access ThumbnailPicture. The main thread will leave it alone until GenerateThumbnail is complete.
-	if (ThumbnailPicture.IsValid())
-		return;
-
-	// Retrieve from cache if possible.
 	tuint256 hash = 0;
-	int thumbVersion = 1;
+	int thumbVersion = 3;
 	tFileInfo fileInfo;
-	tGetFileInfo(fileInfo, Filename);
+	tGetFileInfo(fileInfo, filename);
 	hash = tHash::tHashData256((uint8*)&thumbVersion, sizeof(thumbVersion));
-	hash = tHash::tHashString256(Filename, hash);
+	hash = tHash::tHashString256(filename, hash);
 	hash = tHash::tHashData256((uint8*)&fileInfo.FileSize, sizeof(fileInfo.FileSize), hash);
 	hash = tHash::tHashData256((uint8*)&fileInfo.CreationTime, sizeof(fileInfo.CreationTime), hash);
 	hash = tHash::tHashData256((uint8*)&fileInfo.ModificationTime, sizeof(fileInfo.ModificationTime), hash);
 	hash = tHash::tHashData256((uint8*)&ThumbWidth, sizeof(ThumbWidth), hash);
 	hash = tHash::tHashData256((uint8*)&ThumbHeight, sizeof(ThumbHeight), hash);
-	tString hashFile;
-	tsPrintf(hashFile, "%s%032|256X.bin", ThumbCacheDir.Chars(), hash);
-	if (tFileExists(hashFile))
+	return hash;
+}
+
+
+bool Image::GenerateThumbnail(tPicture& thumbnail, const tString& filename, tFileType filetype, int level)
+{
+	tAssert((level >= 0) && (level < NumThumbLevels));
+	// Retrieve from cache if possible.
+	tuint256 hash = GetThumbnailKey(filename);
+
+	// Cache entries hold the whole pyramid: the level count, the encoded size of each level, then the encoded levels.
+	// Only the requested level is decoded. Any compression method decodes, so changing the setting doesn't invalidate
+	// what is already cached. We're on a worker thread so the decompression stays off the main thread.
+	std::vector<uint8> entry;
+	if (ThumbCache.Get(hash, entry) && (entry.size() >= sizeof(uint32)*(1+NumThumbLevels)))
 	{
-		tChunkReader chunk(hashFile);
-		ThumbnailPicture.Load(chunk.First());
-		return;
+		uint32 sizes[1+NumThumbLevels];
+		tMemcpy(sizes, entry.data(), sizeof(sizes));
+		size_t offset = sizeof(sizes);
+		for (int l = 0; l < level; l++)
+			offset += sizes[1+l];
+
+		if ((sizes[0] == NumThumbLevels) && ((offset + sizes[1+level]) <= entry.size()))
+			if (Compress::DecodePicture(thumbnail, entry.data() + offset, int(sizes[1+level])))
+				return true;
 	}
 
+	// Camera JPEGs and many TIFFs carry a reduced-size JPEG preview. When it is big enough we decode that instead of
+	// the full image. Only the file headers and the preview itself are read.
+	tPicture embeddedPreview;
+	bool useEmbedded = LoadEmbeddedPreview(embeddedPreview, filename, filetype, ThumbWidth, ThumbHeight);
+
 	// We need an opengl context if we are processing dds files (for now... opengl is used for decompression). GLFW doesn't support creating
 	// contexts without an associated window. However, contexts with hidden windows can be created with the GLFW_VISIBLE window hint.
 	GLFWwindow* offscreenContext = nullptr;
-	if (Filetype == tFileType::DDS)
+	if (filetype == tFileType::DDS)
 	{
 		glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
 		offscreenContext = glfwCreateWindow(32, 32, "placeholdertitle", nullptr, nullptr);
 		if (!offscreenContext)
-			return;
+			return false;
 
 		glfwMakeContextCurrent(offscreenContext);
 	}
 
 	Image thumbLoader;
-	int maxLoadAttempts = 5;
+	int maxLoadAttempts = useEmbedded ? 0 : 5;
 	for (int attempt = 0; attempt < maxLoadAttempts; attempt++)
 	{
-		bool thumbLoaded = thumbLoader.Load(Filename);
+		bool thumbLoaded = thumbLoader.Load(filename);
 		if (thumbLoaded)
 		{
 			if (attempt > 0)
-				tPrintf("Loading of thumbnail %s succeeded on attempt %d.\n", Filename.Chars(), attempt+1);
+				tPrintf("Loading of thumbnail %s succeeded on attempt %d.\n", filename.Chars(), attempt+1);
 			break;
 		}
 		else
 		{
-			tPrintf("Warning: Loading of thumbnail %s failed on attempt %d.\n", Filename.Chars(), attempt+1);
+			tPrintf("Warning: Loading of thumbnail %s failed on attempt %d.\n", filename.Chars(), attempt+1);
 			tSystem::tSleep(250);
 		}	
 	}
 
-	if (Filetype == tFileType::DDS)
+	if (filetype == tFileType::DDS)
 	{
 		glfwMakeContextCurrent(nullptr);
 		glfwDestroyWindow(offscreenContext);
 	}
 
 	// Thumbnails are generated from the primary (first) picture in the picture list.
-	tPicture* srcPic = thumbLoader.GetPrimaryPic();
+	tPicture* srcPic = useEmbedded ? &embeddedPreview : thumbLoader.GetPrimaryPic();
 	if (!srcPic)
 	{
-		tPrintf("Warning: Generation of thumbnail %s failed.\n", Filename.Chars());
-		return;
+		tPrintf("Warning: Generation of thumbnail %s failed.\n", filename.Chars());
+		return false;
 	}
 
 	// We make the thumbnail keep its aspect ratio.
@@ -1189,49 +2182,85 @@ void Image::GenerateThumbnail()
 	tAssert((iw == ThumbWidth) || (ih == ThumbHeight));
 
 	// Create an image that is big (or small) enough to exactly match either the width or height without ruining the aspect.
-	srcPic->Resample(iw, ih, tResampleFilter::Bilinear);
+	// Sources are often 20 to 50 times bigger than the thumbnail, so they are box-halved first and only the last step
+	// is a real resample.
+	Downscale::Reduce(*srcPic, iw, ih, tResampleFilter::Bicubic_Standard);
 
 	// Center-crop the image to what we need. Cropping to a bigger size adds transparent pixels.
 	srcPic->Crop(ThumbWidth, ThumbHeight);
 
-	ThumbnailPicture.Set(*srcPic);
+	// Each smaller level is an exact 2x2 box reduction of the one above.
+	tPicture pyramid[NumThumbLevels];
+	pyramid[0].Set(*srcPic);
+	for (int l = 1; l < NumThumbLevels; l++)
+	{
+		pyramid[l].Set(pyramid[l-1]);
+		Downscale::Halve(pyramid[l], true, true);
+	}
+	thumbnail.Set(pyramid[level]);
 
-	// Write to cache file.
-	tChunkWriter writer(hashFile);
-	ThumbnailPicture.Save(writer);
-	// std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	// Write to the cache.
+	Compress::Method method = Compress::Method(tClamp(Config.ThumbnailCompression, 0, int(Compress::Method::NumMethods)-1));
+	uint32 sizes[1+NumThumbLevels] = { uint32(NumThumbLevels) };
+	entry.assign(sizeof(sizes), 0);
+	for (int l = 0; l < NumThumbLevels; l++)
+	{
+		size_t before = entry.size();
+		if (!Compress::EncodePicture(entry, pyramid[l], method))
+			return true;
+		sizes[1+l] = uint32(entry.size() - before);
+	}
+	tMemcpy(entry.data(), sizes, sizeof(sizes));
+	ThumbCache.Put(hash, entry.data(), int(entry.size()));
+	return true;
 }
 
 
-void Image::RequestThumbnail()
+void Image::RequestThumbnail(int priority, int level)
 {
 	if (ThumbnailRequested)
-		return;
+	{
+		if (ThumbnailPending)
+		{
+			if (ThumbnailPending->Level == level)
+			{
+				if (ThumbnailPending->GetPriority() != priority)
+					WorkerPool.Reprioritize(ThumbnailPending, priority);
+				return;
+			}
 
-	// Leave two cores free unless we are on a three core or lower machine, in which case we always use a min of 2 threads.
-	int numThreadsMax = tClampMin((tSystem::tGetNumCores()) - 2, 2);
-	if (ThumbnailNumThreadsRunning >= numThreadsMax)
-		return;
+			// A queued job for another level is replaced. A running one is left to finish and we ask again after.
+			if (!WorkerPool.Cancel(ThumbnailPending))
+				return;
+			ThumbnailPending = nullptr;
+		}
 
-	ThumbnailRequested = true;
-	ThumbnailThreadRunning = true;
-	ThumbnailNumThreadsRunning++;
-	ThumbnailThreadFlag.test_and_set();
-	ThumbnailThread = std::thread
-	(
-		[this]
+		// A failed generation is not retried, whatever the level.
+		else if (!ThumbnailPicture.IsValid() || (ThumbnailLevel == level))
 		{
-			GenerateThumbnailBridge(this);
-			ThumbnailThreadFlag.clear();
+			return;
 		}
-	);
+	}
+
+	ThumbnailRequested = true;
+	ThumbnailPending = new ThumbnailJob(this, level);
+	WorkerPool.Submit(ThumbnailPending, priority);
 }
 
 
 void Image::UnrequestThumbnail()
 {
-	if (ThumbnailRequested && !ThumbnailThreadRunning && !ThumbnailPicture.IsValid())
-		ThumbnailRequested = false;
+	if (!ThumbnailRequested || ThumbnailPicture.IsValid())
+		return;
+
+	if (ThumbnailPending)
+	{
+		if (!WorkerPool.Cancel(ThumbnailPending))
+			return;
+		ThumbnailPending = nullptr;
+	}
+
+	ThumbnailRequested = false;
 }
 
 
@@ -1246,7 +2275,7 @@ void Image::RequestInvalidateThumbnail()
 
 void Image::Play()
 {
-	FrameCurrCountdown = FrameDurationPreviewEnabled ? FrameDurationPreview : GetCurrentPic()->Duration;
+	FrameCurrCountdown = FrameDurationPreviewEnabled ? FrameDurationPreview : CurrentPic()->Duration;
 	FramePlaying = true;
 }
 
@@ -1300,6 +2329,6 @@ void Image::UpdatePlaying(float dt)
 		if (FrameDurationPreviewEnabled)
 			FrameCurrCountdown = FrameDurationPreview;
 		else
-			FrameCurrCountdown = GetCurrentPic()->Duration;
+			FrameCurrCountdown = CurrentPic()->Duration;
 	}
 }
@@ -13,20 +13,26 @@
 // PERFORMANCE OF THIS SOFTWARE.
 
 #pragma once
-#include <thread>
-#include <atomic>
+#include <vector>
+#include <functional>
 #include <glad/glad.h>
 #include <Foundation/tList.h>
 #include <Foundation/tString.h>
+#include <Foundation/tFixInt.h>
 #include <System/tFile.h>
 #include <Image/tPicture.h>
 #include <Image/tTexture.h>
 #include <Image/tCubemap.h>
 #include <Image/tImageHDR.h>
 #include "Settings.h"
+#include "Transpose.h"
 #include "Undo.h"
+#include "WorkerPool.h"
+#include "ThumbnailAtlas.h"
 namespace Viewer
 {
+class TextureStream;
+class TiledTexture;
 
 
 class Image : public tLink<Image>
@@ -67,23 +73,61 @@ public:
 	// Bind to a texture ID and load into VRAM. If already in VRAM, it makes the texture current. Since some ImGui
 	// functions require a texture ID as parameter, this function return the ID.
 	// If the alt image is enabled, the bound texture and ID  will be the alt image's.
-	// Returns 0 (invalid id) if there was a problem.
+	// Returns 0 (invalid id) if there was a problem. Big images are streamed over several frames, so call it every frame
+	// while drawing. Until the stream has something drawable, it returns the previous texture or 0 if there isn't one.
+	// Pictures too big for a single texture return 0 and are drawn with the tiled texture instead.
 	uint64 Bind();
 	void Unbind();
+
+	// Starts on the mipmaps of big pictures so they are likely done by the time the image is first drawn. Every frame
+	// gets its own job so they are made in parallel. Main thread only. Call it when the image becomes current, not for
+	// images only loaded to read their pixels.
+	void PrefetchMipmaps();
+
+	// Only valid after Bind and only for pictures bigger than the maximum texture size. Null until their mipmaps are
+	// ready.
+	TiledTexture* GetTiledTexture() const																				{ return Tiled; }
+
+	// With compressed textures enabled, big pictures are drawn from BC1 or BC3 textures. Exact display switches them to
+	// uncompressed RGBA8 for pixel-accurate inspection. Call before Bind. Changing it re-uploads compressed pictures.
+	void SetExactDisplay(bool exact);
+
+	// The width, height, and pixels are as the image is shown, with any pending turns, flips, and crop.
 	int GetWidth() const;
 	int GetHeight() const;
 	tColouri GetPixel(int x, int y) const;
 
 	// Some images can store multiple complete images inside a single file (multiple frames).
-	// The primary one is the first one.
-	tImage::tPicture* GetPrimaryPic() const																				{ return Pictures.First(); }
-	tImage::tPicture* GetCurrentPic() const																				{ tImage::tPicture* pic = Pictures.First(); for (int i = 0; i < FrameNum; i++) pic = pic ? pic->Next() : nullptr; return pic; }
-	tList<tImage::tPicture>& GetPictures()																				{ return Pictures; }
+	// The primary one is the first one. Any pending orientation is baked in before the pictures are handed out.
+	tImage::tPicture* GetPrimaryPic()																					{ BakeOrientation(); return Pictures.First(); }
+	tImage::tPicture* GetCurrentPic()																					{ BakeOrientation(); return CurrentPic(); }
+	tList<tImage::tPicture>& GetPictures()																				{ BakeOrientation(); return Pictures; }
+
+	// Read-only queries of the current frame as shown. Unlike GetCurrentPic they never bake, so dialogs can call them
+	// every frame. They ignore the alternative picture.
+	float GetCurrentFrameDuration() const;
+	int GetCurrentFrameWidth() const;
+	int GetCurrentFrameHeight() const;
+
+	// Quarter turns, flips, and crops inside the picture don't touch the pixels. They change an orientation the bound
+	// texture is drawn with, and undoing one just changes it back. The orientation is baked into the pictures, with at
+	// most one crop, turn, and flip, when the pixels are needed as shown: saving, handing the pictures out, or any other
+	// edit. The orientation is the identity while the alternative picture is shown, as it is never turned. Other edits,
+	// and undoing or redoing a step that changes pixels, bake multi-frame images through the edit queue so the bake
+	// shows progress and can be cancelled. BakeOrientation bakes straight away, taking over a bake the queue has under
+	// way. The stored size is that of the current picture before the orientation, which a pending crop's uvs need.
+	Transpose::Orientation GetOrientation() const;
+	void GetStoredSize(int& width, int& height) const;
+	void BakeOrientation();
 
 	// Functions that edit and cause dirty flag to be set.
 	void Rotate90(bool antiClockWise);
 	void Rotate(float angle, const tColouri& fill, tImage::tResampleFilter upFilter, tImage::tResampleFilter downFilter);
 	void Flip(bool horizontal);
+
+	// Rotates and crops away the fill as a single pass over each frame. With resize the crop is scaled back up to the
+	// size before the rotate. The fill only shows if the crop reaches past the rotated corners.
+	void RotateCrop(float angle, bool resize, const tColouri& fill, tImage::tResampleFilter upFilter);
 	void Crop(int newWidth, int newHeight, int originX, int originY, const tColouri& fillColour = tColour::black);
 	void Crop(int newWidth, int newHeight, tImage::tPicture::Anchor, const tColouri& fillColour = tColour::black);
 	void Crop(const tColouri& borderColour, uint32 channels = tMath::ColourChannel_RGBA);
@@ -91,11 +135,30 @@ public:
 	void SetPixelColour(int x, int y, const tColouri&, bool pushUndo, bool supressDirty = false);
 	void SetFrameDuration(float duration, bool allFrames = false);
 
-	// Undo and redo functions.
-	void Undo()																											{ UndoStack.Undo(Pictures, Dirty); }
-	void Redo()																											{ UndoStack.Redo(Pictures, Dirty); }
-	bool IsUndoAvailable() const																						{ return UndoStack.UndoAvailable(); }
-	bool IsRedoAvailable() const																						{ return UndoStack.RedoAvailable(); }
+	// The edits above run a frame per job on the worker pool when there is more than one frame. The pictures are left
+	// alone until every frame is done, and then all of them change at once as a single undo step. Edits made in the
+	// meantime queue up and run in order. Single frame images are edited straight away. The prepare function is called
+	// on the main thread when the edit starts, with the frame size at that time, so it can depend on earlier edits.
+	typedef std::function<void(tImage::tPicture&)> FrameOp;
+	typedef std::function<FrameOp(int width, int height)> FramePrep;
+	void EditFrames(const tString& desc, const FramePrep&);
+	bool IsEditing() const																								{ return !EditQueue.empty(); }
+	int GetEditFramesDone() const																						{ return EditNumDone; }
+	int GetEditFramesTotal() const																						{ return int(EditResults.size()); }
+	tString GetEditDesc() const																							{ return IsEditing() ? EditQueue.front()->Desc : tString(); }
+
+	// Drops the running edit and any queued after it. The pictures are as they were before the edits were made.
+	void CancelEdits();
+
+	// Returns true once after queued edits have been applied, so the window title can pick up the dirty flag.
+	bool ConsumeEditApplied()																							{ bool applied = EditApplied; EditApplied = false; return applied; }
+
+	// Undo and redo functions. They do nothing while edits are running. One that waits on a queued bake happens when
+	// the bake is applied.
+	void Undo();
+	void Redo();
+	bool IsUndoAvailable() const																						{ return !IsEditing() && UndoStack.UndoAvailable(); }
+	bool IsRedoAvailable() const																						{ return !IsEditing() && UndoStack.RedoAvailable(); }
 	tString GetUndoDesc() const																							{ tString desc; tsPrintf(desc, "[%s]", UndoStack.GetUndoDesc().Chars()); return desc; }
 	tString GetRedoDesc() const																							{ tString desc; tsPrintf(desc, "[%s]", UndoStack.GetRedoDesc().Chars()); return desc; }
 
@@ -118,11 +181,13 @@ public:
 	void EnableAltPicture(bool enabled)																					{ AltPictureEnabled = enabled; }
 	bool IsAltPictureEnabled() const																					{ return AltPictureEnabled; }
 
-	// Thumbnail generation is done on a seperate thread. Calling RequestThumbnail starts the thread. You should call it
-	// over and over as it will only ever start one thread, and it may not start it if too mnay threads are already
-	// working. BindThumbnail will at some point return a non-zero texture ID, but not necessarily right away. Just keep
-	// calling it. Unloaded images remain unloaded after thumbnail generation.
-	void RequestThumbnail();
+	// Thumbnail generation is done by a job on the shared worker pool. Calling RequestThumbnail queues the job. You
+	// should call it over and over as it will only ever queue one job. Calling it again with a different priority
+	// reorders the job if no worker has picked it up yet. BindThumbnail will at some point return a non-zero texture
+	// ID, but not necessarily right away. Just keep calling it. Unloaded images remain unloaded after thumbnail
+	// generation. Thumbnails come in a small pyramid of levels. Use GetThumbLevel to pick the one for a display width.
+	// Requesting a different level than the one held replaces it, and the old one stays bound until the new arrives.
+	void RequestThumbnail(int priority = 0, int level = 0);
 
 	// Call this if you need to invaidate the thumbnail. For example, if the file was saved/edited this should be called
 	// to force regeneration.
@@ -130,8 +195,10 @@ public:
 
 	// You are allowed to unrequest. It will succeed if a worker was never assigned.
 	void UnrequestThumbnail();
-	bool IsThumbnailWorkerActive() const																				{ return ThumbnailThreadRunning; }
-	uint64 BindThumbnail();
+	bool IsThumbnailWorkerActive() const;												// True once a worker has picked up the job.
+	// Thumbnails live in the shared thumbnail atlas. Returns the atlas page texture and the UVs of this thumbnail within
+	// it. atlasPage lets callers batch draws by page.
+	uint64 BindThumbnail(tMath::tVector2& uv0, tMath::tVector2& uv1, int& atlasPage);
 
 	ImgInfo Info;						// Info is only valid AFTER loading.
 	tString Filename;					// Valid before load.
@@ -142,12 +209,24 @@ public:
 	const static int ThumbWidth;		// = 256;
 	const static int ThumbHeight;		// = 144;
 	const static int ThumbMinDispWidth;	// = 64;
+	constexpr static int NumThumbLevels = 3;						// Level n is ThumbWidth>>n by ThumbHeight>>n.
+	static int GetThumbLevel(float displayWidth);
 	static tString ThumbCacheDir;
 
+	// The thumbnail cache key depends on the filename, size, and timestamps, so an edited file gets a new key.
+	static tuint256 GetThumbnailKey(const tString& filename);
+
+	// Thread-safe. It only reads the filename and type it is given so it never touches an Image that the main thread
+	// may be using or deleting. The whole pyramid is generated and cached, and the requested level is returned in
+	// thumbnail.
+	static bool GenerateThumbnail(tImage::tPicture& thumbnail, const tString& filename, tSystem::tFileType, int level);
+
 	bool TypeSupportsProperties() const;
 
 private:
-	void PushUndo(const tString& desc)																					{ UndoStack.Push(Pictures, desc, Dirty); }
+	// The region is the part of the pictures the op is about to change. Undo only keeps the tiles it touches.
+	void PushUndo(const tString& desc, const Undo::Region& region = Undo::Region())										{ UndoStack.Push(Pictures, desc, Dirty, region); }
+	tImage::tPicture* CurrentPic() const																				{ tImage::tPicture* pic = Pictures.First(); for (int i = 0; i < FrameNum; i++) pic = pic ? pic->Next() : nullptr; return pic; }
 
 	// Dds files are special and already in HW ready format. The tTexture can store dds files, while tPicture stores
 	// other types (tga, gif, jpg, bmp, tif, png, etc). If the image is a dds file, the tTexture is valid and in order
@@ -157,6 +236,7 @@ private:
 	tImage::tTexture DDSTexture2D;
 	tImage::tCubemap DDSCubemap;
 	tList<tImage::tPicture> Pictures;
+	Transpose::Orientation Orient;
 
 	// The 'alternative' picture is valid when there is another valid way of displaying the image.
 	// Specifically for cubemaps and dds files with mipmaps this offers an alternative view.
@@ -165,19 +245,108 @@ private:
 
 	bool ThumbnailRequested = false;			// True if ever requested.
 	bool ThumbnailInvalidateRequested = false;
-	bool ThumbnailThreadRunning = false;		// Only true while worker thread going.
-	static int ThumbnailNumThreadsRunning;		// How many worker threads active.
-	std::thread ThumbnailThread;
-	std::atomic_flag ThumbnailThreadFlag = ATOMIC_FLAG_INIT;
-	tImage::tPicture ThumbnailPicture;
+	tImage::tPicture ThumbnailPicture;			// Only written on the main thread when the job completes.
+	int ThumbnailLevel = 0;						// The pyramid level ThumbnailPicture holds.
+	ThumbnailAtlas::Handle ThumbnailSlot;		// Where ThumbnailPicture is uploaded in the atlas, if anywhere.
 
-	// These 2 functions run on a helper thread.
-	static void GenerateThumbnailBridge(Image*);
-	void GenerateThumbnail();
+	// The job is owned by the worker pool. We keep a pointer so we can cancel or reprioritize it. It is cleared when
+	// the job completes or is cancelled.
+	class ThumbnailJob;
+	ThumbnailJob* ThumbnailPending = nullptr;
 
 	// Zero is invalid and means texture has never been bound and loaded into VRAM.
 	uint TexIDAlt			= 0;
-	uint TexIDThumbnail		= 0;
+
+	// Big pictures are uploaded over several frames. Only one picture streams at a time. StreamTexID points at the
+	// TextureID (or TexIDAlt) being filled so an abandoned stream can delete it. Unbind keeps the texture that was
+	// showing as a stand-in to draw until the replacement has something drawable.
+	TextureStream* Stream	= nullptr;
+	uint* StreamTexID		= nullptr;
+	uint TexIDStandIn		= 0;
+	uint64 BindPicture(tImage::tPicture&, uint& texID);
+	void AbandonStream();
+	void ReleaseStandIn();
+
+	// When set, pictures with compressed mipmaps are drawn from an uncompressed copy of level 0 instead.
+	bool ExactDisplay		= false;
+	void ReleaseCompressed(const tImage::tPicture&, uint& texID, bool showing);
+
+	// Tiles read straight from the picture and its mipmaps, so the tiled texture goes whenever the mipmaps do.
+	TiledTexture* Tiled						= nullptr;
+	const tImage::tPicture* TiledPicture	= nullptr;
+	void BindTiled(const tImage::tPicture&);
+	void ReleaseTiled();
+
+	// Frames of animated images are uploaded as they come up rather than all on the first Bind. A few frames ahead
+	// in the play direction are uploaded early so playback doesn't hitch, and only a ring of frames around the current
+	// one keeps its texture.
+	const static int FrameLookAhead		= 4;
+	const static int MaxResidentFrames	= 16;
+	void UpdateResidentFrames(bool lookAhead);
+
+	// The mipmap levels of big pictures are made on a worker and kept here so Bind only has to upload them. Levels
+	// start at level 1. Level 0 is the picture itself. They are thrown away by Unbind since that precedes any edit.
+	// A compressed chain holds every level, level 0 included, block compressed on the worker. The uncompressed mipmaps
+	// are not kept.
+	class MipmapJob;
+	struct MipChain
+	{
+		const tImage::tPicture* Picture	= nullptr;
+		MipmapJob* Pending				= nullptr;
+		bool Ready						= false;
+		bool Compressed					= false;
+		tList<tImage::tLayer> Levels;
+	};
+	const static int MipmapPriority		= 0x40000000;			// Ahead of all thumbnails.
+	std::vector<MipChain*> MipChains;
+	MipChain* FindMipChain(const tImage::tPicture&);
+	MipChain* RequestMipmaps(const tImage::tPicture&);
+
+	// Never waits on a running job.
+	void ClearMipmaps();
+
+	// Mipmap and frame jobs read the pictures through their pixel pointers. Instead of waiting for them, a picture about
+	// to change or be freed hands its pixels to the unfinished jobs reading them, and the last of them frees them. A
+	// kept picture carries on with a copy. Does nothing if no job is reading the picture.
+	void HandOffPixels(tImage::tPicture&, bool keepPicture = true);
+
+	// One edit of every frame. MakeStep is for edits with their own undo step. Without it the frames are snapshot where
+	// Changed says they're written. A bake has no step of its own and resets the orientation when applied. Then is
+	// called once the edit is applied.
+	struct FrameEdit
+	{
+		tString Desc;
+		FramePrep Prepare;
+		std::function<Undo::Step_Operation*(bool dirty)> MakeStep;
+		Undo::Region Changed;
+		bool Bake = false;
+		std::function<void()> Then;
+	};
+	void QueueEdit(FrameEdit*);
+	void StartEdit();
+	void ApplyEdit();
+
+	// Cancels or orphans the running edit's jobs and throws their results away. The edit itself stays queued.
+	void DropEditJobs();
+
+	// Bakes any pending orientation and then calls then. Multi-frame images bake as a queued edit when the pool is
+	// running, and then is called when it's applied. While editing the first edit is already the bake, if there is one.
+	void QueueBake(const std::function<void()>& then = nullptr);
+
+	// Pushes a crop that only changes the orientation's window. Returns false if the pixels have to be cropped.
+	bool CropWindow(const tString& desc, int newWidth, int newHeight, int originX, int originY);
+
+	static FramePrep EachFrame(const FrameOp& op)																		{ return [op](int, int) { return op; }; }
+
+	// Each job edits a copy of one frame. The results are kept here, by frame, until all of them are in. Edits go
+	// ahead of mipmaps since the mipmaps are thrown away when an edit is applied.
+	class FrameJob;
+	const static int EditPriority		= 0x50000000;
+	std::vector<FrameEdit*> EditQueue;
+	std::vector<FrameJob*> EditJobs;
+	std::vector<tImage::tPicture*> EditResults;
+	int EditNumDone						= 0;
+	bool EditApplied					= false;
 
 	// Returns the approx main mem size of this image. Considers the Pictures list and the AltPicture.
 	int GetMemSizeBytes() const;
@@ -18,6 +18,8 @@
 #include "OpenSaveDialogs.h"
 #include "TacentView.h"
 #include "Image.h"
+#include "Downscale.h"
+#include "Resampler.h"
 using namespace tStd;
 using namespace tMath;
 using namespace tSystem;
@@ -194,7 +196,10 @@ void Viewer::DoMultiFrameModal(bool saveMultiFramePressed)
 
 void Viewer::SaveMultiFrameTo(const tString& outFile, int outWidth, int outHeight)
 {
-	tList<tFrame> frames;
+	// Each copy is box halved as it's made so there is only ever one full size copy. The final resample of all the
+	// frames is one batch so they run side by side.
+	tImage::tResampleFilter filter = tImage::tResampleFilter(Config.ResampleFilter);
+	tList<tImage::tPicture> pictures;
 	for (Image* img = Images.First(); img; img = img->Next())
 	{
 		if (!img->IsLoaded())
@@ -207,13 +212,16 @@ void Viewer::SaveMultiFrameTo(const tString& outFile, int outWidth, int outHeigh
 		if (!currPic)
 			continue;
 
-		tImage::tPicture resampled(*currPic);
-		if ((resampled.GetWidth() != outWidth) || (resampled.GetHeight() != outHeight))
-			resampled.Resample(outWidth, outHeight, tImage::tResampleFilter(Config.ResampleFilter), tImage::tResampleEdgeMode(Config.ResampleEdgeMode));
-
-		tFrame* frame = new tFrame(resampled.StealPixels(), outWidth, outHeight, currPic->Duration);
-		frames.Append(frame);
+		tImage::tPicture* resampled = new tImage::tPicture(*currPic);
+		resampled->Duration = currPic->Duration;
+		Downscale::HalveToward(*resampled, outWidth, outHeight, filter);
+		pictures.Append(resampled);
 	}
+	Resampler::Resample(pictures, outWidth, outHeight, filter, tImage::tResampleEdgeMode(Config.ResampleEdgeMode));
+
+	tList<tFrame> frames;
+	for (tImage::tPicture* resampled = pictures.First(); resampled; resampled = resampled->Next())
+		frames.Append(new tFrame(resampled->StealPixels(), outWidth, outHeight, resampled->Duration));
 
 	bool success = false;
 	switch (Config.SaveFileTypeMultiFrame)
@@ -15,6 +15,7 @@
 #include "imgui.h"
 #include "OpenSaveDialogs.h"
 #include "Image.h"
+#include "Resampler.h"
 #include "TacentView.h"
 #include "ImFileDialog.h"
 #include "FileDialog.h"
@@ -427,7 +428,7 @@ bool Viewer::SaveResizeImageAs(Image& img, const tString& outFile, int width, in
 	tMath::tiClampMin(outH, 4);
 
 	if ((outPic.GetWidth() != outW) || (outPic.GetHeight() != outH))
-		outPic.Resample(outW, outH, tImage::tResampleFilter(Config.ResampleFilter), tImage::tResampleEdgeMode(Config.ResampleEdgeMode));
+		Resampler::Resample(outPic, outW, outH, tImage::tResampleFilter(Config.ResampleFilter), tImage::tResampleEdgeMode(Config.ResampleEdgeMode));
 
 	bool success = false;
 	tImage::tPicture::tColourFormat colourFmt = outPic.IsOpaque() ? tImage::tPicture::tColourFormat::Colour : tImage::tPicture::tColourFormat::ColourAndAlpha;
@@ -455,9 +456,7 @@ void Viewer::DoSaveAsModal(bool saveAsPressed)
 	if (!ImGui::BeginPopupModal("Save As", &isOpenSaveAs, ImGuiWindowFlags_AlwaysAutoResize))
 		return;
 	
-	tAssert(CurrImage);
-	tPicture* picture = CurrImage->GetCurrentPic();
-	tAssert(picture);
+	tAssert(CurrImage && CurrImage->IsLoaded());
 
 	tString extension = DoSaveFiletype();
 	ImGui::Separator();
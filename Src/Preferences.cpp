@@ -18,6 +18,7 @@
 #include "Preferences.h"
 #include "Settings.h"
 #include "Image.h"
+#include "Compress.h"
 #include "TacentView.h"
 #include "Version.cmake.h"
 using namespace tMath;
@@ -128,8 +129,11 @@ void Viewer::ShowPreferencesWindow(bool* popen)
 			ShowHelpMark("Approx memory use limit of this app. Minimum 256 MB.");
 			tMath::tiClampMin(Config.MaxImageMemMB, 256);
 			ImGui::InputInt("Max Cache Files", &Config.MaxCacheFiles); ImGui::SameLine();
-			ShowHelpMark("Maximum number of cache files that may be created. Minimum 200.");
+			ShowHelpMark("Maximum number of thumbnails kept in the cache. The least recently viewed are removed first. Minimum 200.");
 			tMath::tiClampMin(Config.MaxCacheFiles, 200);
+			ImGui::Combo("Cache Compression", &Config.ThumbnailCompression, Compress::MethodNames, int(Compress::Method::NumMethods));
+			ImGui::SameLine();
+			ShowHelpMark("How newly cached thumbnails are stored. Lossless is exact and several times smaller than None.\nLossy keeps luma within one level and halves chroma resolution for smaller files.\nThumbnails already in the cache are unaffected.");
 			if (!DeleteAllCacheFilesOnExit)
 			{
 				if (ImGui::Button("Clear Cache"))
@@ -147,6 +151,19 @@ void Viewer::ShowPreferencesWindow(bool* popen)
 			ShowHelpMark("Maximum number of Ctrl-Z undo steps.");
 			tMath::tiClamp(Config.MaxUndoSteps, 1, 32);
 
+			if (ImGui::InputInt("Undo Budget (MB)", &Config.UndoBudgetMB, 64, 256))
+			{
+				tMath::tiClamp(Config.UndoBudgetMB, 64, 65536);
+				Undo::Maintain();
+			}
+			ImGui::SameLine();
+			ShowHelpMark("Memory for undo history across all images. Older steps are compressed in the background,\nthen moved to a scratch file in the cache directory, and dropped once that is full too.");
+			ImGui::Text("Undo uses %.1f MB in memory and %.1f MB on disk.", double(Undo::GetMemoryBytes())/(1024.0*1024.0), double(Undo::GetDiskBytes())/(1024.0*1024.0));
+
+			ImGui::InputInt("Upload Budget (ms)", &Config.TextureUploadBudget); ImGui::SameLine();
+			ShowHelpMark("Time per frame spent sending big images to the GPU. Big images appear blurry and sharpen\nover several frames. Lower keeps the UI smoother, higher shows them sharp sooner.");
+			tMath::tiClamp(Config.TextureUploadBudget, 1, 100);
+
 			ImGui::NewLine();
 			ImGui::Separator();
 			ImGui::NewLine();
@@ -164,6 +181,9 @@ void Viewer::ShowPreferencesWindow(bool* popen)
 			ImGui::SameLine();
 			ShowHelpMark("Filtering method to use when generating minification mipmaps.\nUse None for no mipmapping.");
 
+			ImGui::Checkbox("Compress Big Textures", &Config.CompressTextures); ImGui::SameLine();
+			ShowHelpMark("Big images are displayed from BC1 or BC3 compressed textures made on the worker\nthreads. They use 4 to 8 times less video memory so more stay resident. Zooming\nto 200% or more switches to the exact texture. Applies to images loaded afterwards.");
+
 			ImGui::NewLine();
 			ImGui::Separator();
 			ImGui::NewLine();
@@ -184,8 +184,7 @@ void Viewer::ShowPropertyEditorWindow(bool* popen)
 		}
 		else
 		{
-			tImage::tPicture* currFramePic = CurrImage->GetCurrentPic();
-			float duration = currFramePic->Duration;
+			float duration = CurrImage->GetCurrentFrameDuration();
 			char frameDurText[64];
 			if (ImGui::InputFloat("Seconds", &duration, 0.01f, 0.1f, "%.4f", ImGuiInputTextFlags_EnterReturnsTrue))
 			{
@@ -0,0 +1,915 @@
+// Resampler.cpp
+//
+// A separable resampler for all the tResampleFilter kernels. Each axis is a pass of fixed-point multiply-adds, vectorized
+// with SSE2, AVX2, or NEON, with rows split across the worker pool. When reducing, the kernels are widened by the
+// reduction factor so every source pixel contributes. Filter weights depend only on the source and destination lengths
+// and the filter, so they are computed once and cached. An affine warp with the same kernels handles rotations.
+//
+// Copyright (c) 2021 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define RESAMPLER_SSE2
+#include <emmintrin.h>
+#if defined(__AVX2__)
+#define RESAMPLER_AVX2
+#include <immintrin.h>
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define RESAMPLER_NEON
+#include <arm_neon.h>
+#endif
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <Foundation/tFundamentals.h>
+#include "Resampler.h"
+#include "WorkerPool.h"
+using namespace tImage;
+namespace Viewer { extern Worker::Pool WorkerPool; }
+
+
+namespace Resampler
+{
+	// Weights have 14 fractional bits. That leaves room in a signed 16-bit multiply for the overshoot of the sharper
+	// kernels, and the sums of products fit in 32 bits.
+	const int WeightBits = 14;
+	const int WeightOne = 1 << WeightBits;
+	const int WeightRound = 1 << (WeightBits-1);
+
+	// Enough multiply-adds per chunk that the job overhead is small next to the work.
+	const int MinTapsPerChunk = 256*1024;
+	const int MaxCachedTables = 64;
+
+	// The weights for one axis. Every destination pixel has the same number of taps, rounded up to an even number so
+	// the vector loops can take them in pairs. Unused taps have zero weight. Taps may reach past either end of the
+	// source, and the edge mode decides what is read there.
+	struct Table
+	{
+		int SrcLen				= 0;
+		int DstLen				= 0;
+		int NumTaps				= 0;
+		int PadBefore			= 0;		// How far the taps reach before the first source pixel.
+		int PadAfter			= 0;		// How far the taps reach after the last source pixel.
+		std::vector<int> Start;				// First source pixel for each destination pixel.
+		std::vector<int16> Weights;			// NumTaps for each destination pixel. They sum to WeightOne.
+	};
+	typedef std::shared_ptr<const Table> TableRef;
+
+	struct TableKey
+	{
+		int SrcLen;
+		int DstLen;
+		tResampleFilter Filter;
+		bool operator<(const TableKey& k) const																			{ return (SrcLen != k.SrcLen) ? (SrcLen < k.SrcLen) : (DstLen != k.DstLen) ? (DstLen < k.DstLen) : (Filter < k.Filter); }
+	};
+
+	// Tables are built on whichever thread needs them, and mipmap and thumbnail jobs resample on workers.
+	std::mutex CacheMutex;
+	std::map<TableKey, TableRef> Cache;
+
+	float GetRadius(tResampleFilter);
+	float EvalKernel(tResampleFilter, float x);
+	float EvalCubic(float x, float b, float c);
+	float EvalLanczos(float x, float a);
+	TableRef BuildTable(int srcLen, int dstLen, tResampleFilter);
+	TableRef GetTable(int srcLen, int dstLen, tResampleFilter);
+	int MapIndex(int index, int length, tResampleEdgeMode);
+
+	// Rounds the weights to fixed point so they sum to exactly WeightOne.
+	void QuantiseWeights(int16* dst, const double* weights, int numTaps, double sum);
+
+	// Every warp pixel lands at a different offset, so its positions are rounded to one of WarpPhases sub-pixel offsets
+	// and the weights for each offset are worked out up front. A position between the pixel centres i and i+1 takes the
+	// taps from i-Reach+1 to i+Reach. Both axes share the table.
+	const int WarpPhases = 64;
+	struct PhaseTable
+	{
+		int Reach				= 0;
+		int NumTaps				= 0;
+		std::vector<int16> Weights;			// NumTaps for each phase. They sum to WeightOne.
+	};
+	PhaseTable BuildPhaseTable(tResampleFilter, float filterScale);
+
+	// One destination pixel from numTaps consecutive source pixels, which must be an even number. Returned as the four
+	// bytes of the pixel.
+	uint32 ResamplePixel(const uint8* src, const int16* weights, int numTaps);
+
+	// Horizontal. Src points at the first source pixel of a row that may be read from -PadBefore to SrcLen+PadAfter.
+	void ResampleRow(uint8* dst, const uint8* src, const Table&);
+
+	// Vertical. Writes numBytes of one destination row from numTaps source rows.
+	void ResampleColumns(uint8* dst, const uint8* const* rows, const int16* weights, int numTaps, int numBytes);
+
+	// Rows begin to end of the destination. The horizontal pass keeps the row count and the vertical keeps the width.
+	void HorizontalPass(tPixel* dst, const tPixel* src, int srcW, int begin, int end, const Table&, tResampleEdgeMode);
+	void VerticalPass(tPixel* dst, const tPixel* src, int width, int srcH, int begin, int end, const Table&, tResampleEdgeMode);
+
+	// Rows begin to end of a warp. Without a phase table the warp is nearest.
+	void WarpRows(tPixel* dst, const tPixel* src, int srcW, int srcH, int dstW, int begin, int end, const Affine&, const PhaseTable*, const tPixel& fill);
+
+	int32 LoadPair(const int16* weights)																				{ int32 pair; memcpy(&pair, weights, 4); return pair; }
+	uint8 Clamp255(int v)																								{ return uint8(tMath::tClamp(v, 0, 255)); }
+}
+
+
+float Resampler::GetRadius(tResampleFilter filter)
+{
+	switch (filter)
+	{
+		case tResampleFilter::Nearest:			return 0.0f;
+		case tResampleFilter::Box:				return 0.5f;
+		case tResampleFilter::Bilinear:			return 1.0f;
+		case tResampleFilter::Lanczos_Narrow:	return 2.0f;
+		case tResampleFilter::Lanczos_Normal:	return 3.0f;
+		case tResampleFilter::Lanczos_Wide:		return 4.0f;
+		default:								return 2.0f;		// All the bicubics.
+	}
+}
+
+
+float Resampler::EvalCubic(float x, float b, float c)
+{
+	// Mitchell-Netravali. C is the negated 'a' of the Keys family.
+	if (x < 1.0f)
+		return ((12.0f - 9.0f*b - 6.0f*c)*x*x*x + (-18.0f + 12.0f*b + 6.0f*c)*x*x + (6.0f - 2.0f*b)) / 6.0f;
+	if (x < 2.0f)
+		return ((-b - 6.0f*c)*x*x*x + (6.0f*b + 30.0f*c)*x*x + (-12.0f*b - 48.0f*c)*x + (8.0f*b + 24.0f*c)) / 6.0f;
+	return 0.0f;
+}
+
+
+float Resampler::EvalLanczos(float x, float a)
+{
+	if (x >= a)
+		return 0.0f;
+	if (x < 1.0e-6f)
+		return 1.0f;
+
+	float px = tMath::Pi * x;
+	return a * std::sin(px) * std::sin(px / a) / (px * px);
+}
+
+
+float Resampler::EvalKernel(tResampleFilter filter, float x)
+{
+	x = std::fabs(x);
+	switch (filter)
+	{
+		case tResampleFilter::Box:					return (x <= 0.5f) ? 1.0f : 0.0f;
+		case tResampleFilter::Bilinear:				return tMath::tMax(1.0f - x, 0.0f);
+		case tResampleFilter::Bicubic_Standard:		return EvalCubic(x, 0.0f, 0.75f);
+		case tResampleFilter::Bicubic_CatmullRom:	return EvalCubic(x, 0.0f, 0.5f);
+		case tResampleFilter::Bicubic_Mitchell:		return EvalCubic(x, 1.0f/3.0f, 1.0f/3.0f);
+		case tResampleFilter::Bicubic_Cardinal:		return EvalCubic(x, 0.0f, 1.0f);
+		case tResampleFilter::Bicubic_BSpline:		return EvalCubic(x, 1.0f, 0.0f);
+		case tResampleFilter::Lanczos_Narrow:		return EvalLanczos(x, 2.0f);
+		case tResampleFilter::Lanczos_Normal:		return EvalLanczos(x, 3.0f);
+		case tResampleFilter::Lanczos_Wide:			return EvalLanczos(x, 4.0f);
+		default:									return (x < 0.5f) ? 1.0f : 0.0f;
+	}
+}
+
+
+Resampler::TableRef Resampler::BuildTable(int srcLen, int dstLen, tResampleFilter filter)
+{
+	std::shared_ptr<Table> table = std::make_shared<Table>();
+	table->SrcLen = srcLen;
+	table->DstLen = dstLen;
+
+	// Pixel centres are at half integers. Reducing stretches the kernel over the source so it covers the whole
+	// footprint of each destination pixel.
+	double scale = double(srcLen) / double(dstLen);
+	double filterScale = tMath::tMax(scale, 1.0);
+	double support = double(GetRadius(filter)) * filterScale;
+	int numTaps = (filter == tResampleFilter::Nearest) ? 1 : int(std::ceil(2.0*support)) + 1;
+	numTaps = (numTaps + 1) & ~1;
+	table->NumTaps = numTaps;
+	table->Start.resize(dstLen);
+	table->Weights.assign(size_t(dstLen)*numTaps, 0);
+
+	std::vector<double> weights(numTaps);
+	int minStart = 0;
+	int maxEnd = srcLen;
+	for (int i = 0; i < dstLen; i++)
+	{
+		double centre = (double(i) + 0.5) * scale;
+		int16* dst = &table->Weights[size_t(i)*numTaps];
+		int start = 0;
+		double sum = 0.0;
+		if (filter != tResampleFilter::Nearest)
+		{
+			// The first pixel whose centre is inside the support.
+			start = int(std::floor(centre - support - 0.5)) + 1;
+			for (int t = 0; t < numTaps; t++)
+			{
+				weights[t] = EvalKernel(filter, float((double(start + t) + 0.5 - centre) / filterScale));
+				sum += weights[t];
+			}
+		}
+
+		// Nearest, or a kernel that missed every pixel centre, takes the pixel under the centre.
+		if (sum == 0.0)
+		{
+			start = tMath::tMin(int(centre), srcLen-1);
+			for (int t = 0; t < numTaps; t++)
+				weights[t] = (t == 0) ? 1.0 : 0.0;
+			sum = 1.0;
+		}
+
+		QuantiseWeights(dst, weights.data(), numTaps, sum);
+		table->Start[i] = start;
+		minStart = tMath::tMin(minStart, start);
+		maxEnd = tMath::tMax(maxEnd, start + numTaps);
+	}
+
+	table->PadBefore = -minStart;
+	table->PadAfter = maxEnd - srcLen;
+	return table;
+}
+
+
+void Resampler::QuantiseWeights(int16* dst, const double* weights, int numTaps, double sum)
+{
+	// Rounding error goes to the biggest weight so flat areas come out unchanged.
+	int total = 0;
+	int biggest = 0;
+	for (int t = 0; t < numTaps; t++)
+	{
+		int w = tMath::tClamp(int(std::lround(weights[t] / sum * double(WeightOne))), -32768, 32767);
+		dst[t] = int16(w);
+		total += w;
+		if (tMath::tAbs(w) > tMath::tAbs(int(dst[biggest])))
+			biggest = t;
+	}
+	dst[biggest] = int16(tMath::tClamp(int(dst[biggest]) + WeightOne - total, -32768, 32767));
+}
+
+
+Resampler::PhaseTable Resampler::BuildPhaseTable(tResampleFilter filter, float filterScale)
+{
+	// The taps reach far enough either side to cover the support at every phase, and are always an even number.
+	PhaseTable table;
+	double support = double(GetRadius(filter)) * double(filterScale);
+	table.Reach = tMath::tMax(int(std::ceil(support)), 1);
+	table.NumTaps = 2*table.Reach;
+	table.Weights.assign(size_t(WarpPhases)*table.NumTaps, 0);
+
+	std::vector<double> weights(table.NumTaps);
+	for (int p = 0; p < WarpPhases; p++)
+	{
+		double phase = double(p) / double(WarpPhases);
+		double sum = 0.0;
+		for (int t = 0; t < table.NumTaps; t++)
+		{
+			weights[t] = EvalKernel(filter, float((double(t - table.Reach + 1) - phase) / double(filterScale)));
+			sum += weights[t];
+		}
+
+		// A kernel that missed every pixel centre takes the pixel under the position.
+		if (sum == 0.0)
+		{
+			int under = (phase < 0.5) ? table.Reach-1 : table.Reach;
+			for (int t = 0; t < table.NumTaps; t++)
+				weights[t] = (t == under) ? 1.0 : 0.0;
+			sum = 1.0;
+		}
+
+		QuantiseWeights(&table.Weights[size_t(p)*table.NumTaps], weights.data(), table.NumTaps, sum);
+	}
+
+	return table;
+}
+
+
+Resampler::TableRef Resampler::GetTable(int srcLen, int dstLen, tResampleFilter filter)
+{
+	TableKey key = { srcLen, dstLen, filter };
+	{
+		std::lock_guard<std::mutex> lock(CacheMutex);
+		auto found = Cache.find(key);
+		if (found != Cache.end())
+			return found->second;
+	}
+
+	// Built outside the lock. Two threads may both build the same table, which is harmless.
+	TableRef table = BuildTable(srcLen, dstLen, filter);
+	std::lock_guard<std::mutex> lock(CacheMutex);
+	if (int(Cache.size()) >= MaxCachedTables)
+		Cache.clear();
+	Cache[key] = table;
+	return table;
+}
+
+
+void Resampler::ClearWeightCache()
+{
+	std::lock_guard<std::mutex> lock(CacheMutex);
+	Cache.clear();
+}
+
+
+int Resampler::MapIndex(int index, int length, tResampleEdgeMode edgeMode)
+{
+	if (edgeMode == tResampleEdgeMode::Wrap)
+		return ((index % length) + length) % length;
+
+	return tMath::tClamp(index, 0, length-1);
+}
+
+
+uint32 Resampler::ResamplePixel(const uint8* src, const int16* weights, int numTaps)
+{
+	#if defined(RESAMPLER_SSE2)
+	// Four taps per iteration. Widened to 16 bits, the low and high halves of a pixel pair are interleaved so each
+	// 32-bit lane of the madd is one channel of both pixels.
+	const __m128i zero = _mm_setzero_si128();
+	__m128i acc = _mm_set1_epi32(WeightRound);
+	int t = 0;
+	for (; t + 4 <= numTaps; t += 4)
+	{
+		__m128i pixels = _mm_loadu_si128((const __m128i*)(src + t*4));
+		__m128i lo = _mm_unpacklo_epi8(pixels, zero);
+		__m128i hi = _mm_unpackhi_epi8(pixels, zero);
+		lo = _mm_unpacklo_epi16(lo, _mm_srli_si128(lo, 8));
+		hi = _mm_unpacklo_epi16(hi, _mm_srli_si128(hi, 8));
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(lo, _mm_set1_epi32(LoadPair(weights + t))));
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(hi, _mm_set1_epi32(LoadPair(weights + t + 2))));
+	}
+	if (t < numTaps)
+	{
+		__m128i pixels = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(src + t*4)), zero);
+		pixels = _mm_unpacklo_epi16(pixels, _mm_srli_si128(pixels, 8));
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(pixels, _mm_set1_epi32(LoadPair(weights + t))));
+	}
+
+	acc = _mm_srai_epi32(acc, WeightBits);
+	acc = _mm_packs_epi32(acc, acc);
+	acc = _mm_packus_epi16(acc, acc);
+	return uint32(_mm_cvtsi128_si32(acc));
+
+	#elif defined(RESAMPLER_NEON)
+	// NEON multiplies by a scalar, so there's no need to interleave. Each tap is one widening multiply-add.
+	int32x4_t acc = vdupq_n_s32(WeightRound);
+	for (int t = 0; t < numTaps; t += 2)
+	{
+		int16x8_t pixels = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(src + t*4)));
+		acc = vmlal_n_s16(acc, vget_low_s16(pixels), weights[t]);
+		acc = vmlal_n_s16(acc, vget_high_s16(pixels), weights[t+1]);
+	}
+
+	int16x4_t narrow = vqmovn_s32(vshrq_n_s32(acc, WeightBits));
+	uint8x8_t bytes = vqmovun_s16(vcombine_s16(narrow, narrow));
+	return vget_lane_u32(vreinterpret_u32_u8(bytes), 0);
+
+	#else
+	int acc[4] = { WeightRound, WeightRound, WeightRound, WeightRound };
+	for (int t = 0; t < numTaps; t++)
+		for (int c = 0; c < 4; c++)
+			acc[c] += int(src[t*4 + c]) * int(weights[t]);
+
+	uint8 bytes[4];
+	for (int c = 0; c < 4; c++)
+		bytes[c] = Clamp255(acc[c] >> WeightBits);
+	uint32 pixel;
+	memcpy(&pixel, bytes, 4);
+	return pixel;
+	#endif
+}
+
+
+void Resampler::ResampleRow(uint8* dst, const uint8* src, const Table& table)
+{
+	int numTaps = table.NumTaps;
+	int dstW = table.DstLen;
+	int x = 0;
+
+	#if defined(RESAMPLER_AVX2)
+	// Two destination pixels per iteration, one in each 128-bit lane. Source pixels are taken in pairs and interleaved
+	// by channel so each madd multiplies two taps and adds them.
+	for (; x + 2 <= dstW; x += 2)
+	{
+		const uint8* srcA = src + table.Start[x]*4;
+		const uint8* srcB = src + table.Start[x+1]*4;
+		const int16* weightsA = &table.Weights[size_t(x)*numTaps];
+		const int16* weightsB = weightsA + numTaps;
+		__m256i acc = _mm256_set1_epi32(WeightRound);
+		for (int t = 0; t < numTaps; t += 2)
+		{
+			__m128i pairs = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)(srcA + t*4)), _mm_loadl_epi64((const __m128i*)(srcB + t*4)));
+			__m256i pixels = _mm256_cvtepu8_epi16(pairs);
+			pixels = _mm256_unpacklo_epi16(pixels, _mm256_srli_si256(pixels, 8));
+			__m256i weights = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_set1_epi32(LoadPair(weightsA + t))), _mm_set1_epi32(LoadPair(weightsB + t)), 1);
+			acc = _mm256_add_epi32(acc, _mm256_madd_epi16(pixels, weights));
+		}
+
+		acc = _mm256_srai_epi32(acc, WeightBits);
+		acc = _mm256_packs_epi32(acc, acc);
+		acc = _mm256_packus_epi16(acc, acc);
+		int32 pixelA = _mm_cvtsi128_si32(_mm256_castsi256_si128(acc));
+		int32 pixelB = _mm_cvtsi128_si32(_mm256_extracti128_si256(acc, 1));
+		memcpy(dst + x*4, &pixelA, 4);
+		memcpy(dst + x*4 + 4, &pixelB, 4);
+	}
+	#endif
+
+	for (; x < dstW; x++)
+	{
+		uint32 pixel = ResamplePixel(src + table.Start[x]*4, &table.Weights[size_t(x)*numTaps], numTaps);
+		memcpy(dst + x*4, &pixel, 4);
+	}
+}
+
+
+void Resampler::ResampleColumns(uint8* dst, const uint8* const* rows, const int16* weights, int numTaps, int numBytes)
+{
+	int i = 0;
+
+	#if defined(RESAMPLER_AVX2)
+	// 32 bytes per iteration. Bytes from two rows are interleaved so each madd takes a pair of taps. The unpacks and
+	// packs both work within 128-bit lanes, so the bytes come back out in order.
+	const __m256i zero256 = _mm256_setzero_si256();
+	for (; i + 32 <= numBytes; i += 32)
+	{
+		__m256i acc0 = _mm256_set1_epi32(WeightRound);
+		__m256i acc1 = acc0;
+		__m256i acc2 = acc0;
+		__m256i acc3 = acc0;
+		for (int t = 0; t < numTaps; t += 2)
+		{
+			__m256i a = _mm256_loadu_si256((const __m256i*)(rows[t] + i));
+			__m256i b = _mm256_loadu_si256((const __m256i*)(rows[t+1] + i));
+			__m256i w = _mm256_set1_epi32(LoadPair(weights + t));
+			__m256i lo = _mm256_unpacklo_epi8(a, b);
+			__m256i hi = _mm256_unpackhi_epi8(a, b);
+			acc0 = _mm256_add_epi32(acc0, _mm256_madd_epi16(_mm256_unpacklo_epi8(lo, zero256), w));
+			acc1 = _mm256_add_epi32(acc1, _mm256_madd_epi16(_mm256_unpackhi_epi8(lo, zero256), w));
+			acc2 = _mm256_add_epi32(acc2, _mm256_madd_epi16(_mm256_unpacklo_epi8(hi, zero256), w));
+			acc3 = _mm256_add_epi32(acc3, _mm256_madd_epi16(_mm256_unpackhi_epi8(hi, zero256), w));
+		}
+
+		__m256i p01 = _mm256_packs_epi32(_mm256_srai_epi32(acc0, WeightBits), _mm256_srai_epi32(acc1, WeightBits));
+		__m256i p23 = _mm256_packs_epi32(_mm256_srai_epi32(acc2, WeightBits), _mm256_srai_epi32(acc3, WeightBits));
+		_mm256_storeu_si256((__m256i*)(dst + i), _mm256_packus_epi16(p01, p23));
+	}
+	#endif
+
+	#if defined(RESAMPLER_SSE2)
+	const __m128i zero = _mm_setzero_si128();
+	for (; i + 16 <= numBytes; i += 16)
+	{
+		__m128i acc0 = _mm_set1_epi32(WeightRound);
+		__m128i acc1 = acc0;
+		__m128i acc2 = acc0;
+		__m128i acc3 = acc0;
+		for (int t = 0; t < numTaps; t += 2)
+		{
+			__m128i a = _mm_loadu_si128((const __m128i*)(rows[t] + i));
+			__m128i b = _mm_loadu_si128((const __m128i*)(rows[t+1] + i));
+			__m128i w = _mm_set1_epi32(LoadPair(weights + t));
+			__m128i lo = _mm_unpacklo_epi8(a, b);
+			__m128i hi = _mm_unpackhi_epi8(a, b);
+			acc0 = _mm_add_epi32(acc0, _mm_madd_epi16(_mm_unpacklo_epi8(lo, zero), w));
+			acc1 = _mm_add_epi32(acc1, _mm_madd_epi16(_mm_unpackhi_epi8(lo, zero), w));
+			acc2 = _mm_add_epi32(acc2, _mm_madd_epi16(_mm_unpacklo_epi8(hi, zero), w));
+			acc3 = _mm_add_epi32(acc3, _mm_madd_epi16(_mm_unpackhi_epi8(hi, zero), w));
+		}
+
+		__m128i p01 = _mm_packs_epi32(_mm_srai_epi32(acc0, WeightBits), _mm_srai_epi32(acc1, WeightBits));
+		__m128i p23 = _mm_packs_epi32(_mm_srai_epi32(acc2, WeightBits), _mm_srai_epi32(acc3, WeightBits));
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(p01, p23));
+	}
+
+	#elif defined(RESAMPLER_NEON)
+	for (; i + 16 <= numBytes; i += 16)
+	{
+		int32x4_t acc0 = vdupq_n_s32(WeightRound);
+		int32x4_t acc1 = acc0;
+		int32x4_t acc2 = acc0;
+		int32x4_t acc3 = acc0;
+		for (int t = 0; t < numTaps; t++)
+		{
+			uint8x16_t a = vld1q_u8(rows[t] + i);
+			int16x8_t lo = vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(a)));
+			int16x8_t hi = vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(a)));
+			acc0 = vmlal_n_s16(acc0, vget_low_s16(lo), weights[t]);
+			acc1 = vmlal_n_s16(acc1, vget_high_s16(lo), weights[t]);
+			acc2 = vmlal_n_s16(acc2, vget_low_s16(hi), weights[t]);
+			acc3 = vmlal_n_s16(acc3, vget_high_s16(hi), weights[t]);
+		}
+
+		int16x8_t p01 = vcombine_s16(vqmovn_s32(vshrq_n_s32(acc0, WeightBits)), vqmovn_s32(vshrq_n_s32(acc1, WeightBits)));
+		int16x8_t p23 = vcombine_s16(vqmovn_s32(vshrq_n_s32(acc2, WeightBits)), vqmovn_s32(vshrq_n_s32(acc3, WeightBits)));
+		vst1q_u8(dst + i, vcombine_u8(vqmovun_s16(p01), vqmovun_s16(p23)));
+	}
+	#endif
+
+	for (; i < numBytes; i++)
+	{
+		int acc = WeightRound;
+		for (int t = 0; t < numTaps; t++)
+			acc += int(rows[t][i]) * int(weights[t]);
+		dst[i] = Clamp255(acc >> WeightBits);
+	}
+}
+
+
+void Resampler::HorizontalPass(tPixel* dst, const tPixel* src, int srcW, int begin, int end, const Table& table, tResampleEdgeMode edgeMode)
+{
+	// Rows are copied into a padded buffer when the taps reach past the ends, so the row kernel never has to check.
+	bool padded = (table.PadBefore > 0) || (table.PadAfter > 0);
+	std::vector<tPixel> buffer(padded ? table.PadBefore + srcW + table.PadAfter : 0);
+	for (int y = begin; y < end; y++)
+	{
+		const tPixel* row = src + size_t(y)*srcW;
+		if (padded)
+		{
+			tPixel* first = buffer.data() + table.PadBefore;
+			for (int x = -table.PadBefore; x < 0; x++)
+				first[x] = row[MapIndex(x, srcW, edgeMode)];
+			memcpy(first, row, srcW*sizeof(tPixel));
+			for (int x = srcW; x < srcW + table.PadAfter; x++)
+				first[x] = row[MapIndex(x, srcW, edgeMode)];
+			row = first;
+		}
+
+		ResampleRow((uint8*)(dst + size_t(y)*table.DstLen), (const uint8*)row, table);
+	}
+}
+
+
+void Resampler::VerticalPass(tPixel* dst, const tPixel* src, int width, int srcH, int begin, int end, const Table& table, tResampleEdgeMode edgeMode)
+{
+	std::vector<const uint8*> rows(table.NumTaps);
+	for (int y = begin; y < end; y++)
+	{
+		int start = table.Start[y];
+		for (int t = 0; t < table.NumTaps; t++)
+			rows[t] = (const uint8*)(src + size_t(MapIndex(start + t, srcH, edgeMode))*width);
+
+		ResampleColumns((uint8*)(dst + size_t(y)*width), rows.data(), &table.Weights[size_t(y)*table.NumTaps], table.NumTaps, width*4);
+	}
+}
+
+
+bool Resampler::Resample(const std::vector<Task>& tasks, tResampleFilter filter, tResampleEdgeMode edgeMode)
+{
+	if (filter == tResampleFilter::None)
+		return false;
+
+	for (const Task& task : tasks)
+		if (!task.Src || !task.Dst || (task.SrcW < 1) || (task.SrcH < 1) || (task.DstW < 1) || (task.DstH < 1))
+			return false;
+
+	// Every task is at most two passes. When both axes change, the first pass writes to an intermediate image and the
+	// order is whichever does fewer multiply-adds.
+	struct Pass
+	{
+		const Table* Horizontal		= nullptr;		// Exactly one of these is set.
+		const Table* Vertical		= nullptr;
+		const tPixel* Src			= nullptr;
+		int SrcW					= 0;
+		int SrcH					= 0;
+		tPixel* Dst					= nullptr;
+		int NumRows					= 0;
+		int RowsPerChunk			= 1;
+	};
+	struct Chunk
+	{
+		const Pass* Work;
+		int Begin;
+		int End;
+	};
+
+	int numTasks = int(tasks.size());
+	std::vector<TableRef> tables;
+	std::vector<std::unique_ptr<tPixel[]>> intermediates(numTasks);
+	std::vector<Pass> passes[2];
+	passes[0].reserve(numTasks);
+	passes[1].reserve(numTasks);
+	for (int t = 0; t < numTasks; t++)
+	{
+		const Task& task = tasks[t];
+		TableRef horizontal = (task.SrcW != task.DstW) ? GetTable(task.SrcW, task.DstW, filter) : nullptr;
+		TableRef vertical = (task.SrcH != task.DstH) ? GetTable(task.SrcH, task.DstH, filter) : nullptr;
+		if (horizontal)
+			tables.push_back(horizontal);
+		if (vertical)
+			tables.push_back(vertical);
+
+		Pass h;
+		h.Horizontal = horizontal.get();
+		h.NumRows = vertical ? task.SrcH : task.DstH;
+		h.RowsPerChunk = horizontal ? tMath::tMax(MinTapsPerChunk / (task.DstW * horizontal->NumTaps), 1) : 1;
+
+		Pass v;
+		v.Vertical = vertical.get();
+		v.NumRows = task.DstH;
+
+		if (horizontal && vertical)
+		{
+			int64 hFirst = int64(task.SrcH)*task.DstW*horizontal->NumTaps + int64(task.DstH)*task.DstW*vertical->NumTaps;
+			int64 vFirst = int64(task.DstH)*task.SrcW*vertical->NumTaps + int64(task.DstH)*task.DstW*horizontal->NumTaps;
+			bool verticalFirst = (vFirst < hFirst);
+			int midW = verticalFirst ? task.SrcW : task.DstW;
+			int midH = verticalFirst ? task.DstH : task.SrcH;
+			intermediates[t].reset(new tPixel[size_t(midW)*midH]);
+			tPixel* mid = intermediates[t].get();
+
+			h.NumRows = midH;
+			v.SrcW = midW;
+			v.RowsPerChunk = tMath::tMax(MinTapsPerChunk / (midW * vertical->NumTaps), 1);
+			if (verticalFirst)
+			{
+				v.Src = task.Src;		v.SrcH = task.SrcH;		v.Dst = mid;
+				h.Src = mid;			h.SrcW = task.SrcW;		h.Dst = task.Dst;
+				passes[0].push_back(v);
+				passes[1].push_back(h);
+			}
+			else
+			{
+				h.Src = task.Src;		h.SrcW = task.SrcW;		h.Dst = mid;
+				v.Src = mid;			v.SrcH = task.SrcH;		v.Dst = task.Dst;
+				passes[0].push_back(h);
+				passes[1].push_back(v);
+			}
+		}
+		else if (horizontal)
+		{
+			h.Src = task.Src;	h.SrcW = task.SrcW;		h.Dst = task.Dst;
+			passes[0].push_back(h);
+		}
+		else if (vertical)
+		{
+			v.Src = task.Src;	v.SrcW = task.SrcW;		v.SrcH = task.SrcH;		v.Dst = task.Dst;
+			v.RowsPerChunk = tMath::tMax(MinTapsPerChunk / (task.SrcW * vertical->NumTaps), 1);
+			passes[0].push_back(v);
+		}
+		else
+		{
+			memcpy(task.Dst, task.Src, size_t(task.SrcW)*task.SrcH*sizeof(tPixel));
+		}
+	}
+
+	// The chunks of every task go into one parallel loop per pass, so frames run side by side.
+	std::vector<Chunk> chunks;
+	for (int p = 0; p < 2; p++)
+	{
+		chunks.clear();
+		for (const Pass& pass : passes[p])
+			for (int begin = 0; begin < pass.NumRows; begin += pass.RowsPerChunk)
+				chunks.push_back({ &pass, begin, tMath::tMin(begin + pass.RowsPerChunk, pass.NumRows) });
+
+		if (chunks.empty())
+			continue;
+
+		const Chunk* chunkData = chunks.data();
+		Viewer::WorkerPool.ParallelFor
+		(
+			int(chunks.size()), 1,
+			[=](int begin, int end)
+			{
+				for (int c = begin; c < end; c++)
+				{
+					const Chunk& chunk = chunkData[c];
+					const Pass& pass = *chunk.Work;
+					if (pass.Horizontal)
+						HorizontalPass(pass.Dst, pass.Src, pass.SrcW, chunk.Begin, chunk.End, *pass.Horizontal, edgeMode);
+					else
+						VerticalPass(pass.Dst, pass.Src, pass.SrcW, pass.SrcH, chunk.Begin, chunk.End, *pass.Vertical, edgeMode);
+				}
+			}
+		);
+	}
+
+	return true;
+}
+
+
+bool Resampler::Resample(const tPixel* src, int srcW, int srcH, tPixel* dst, int dstW, int dstH, tResampleFilter filter, tResampleEdgeMode edgeMode)
+{
+	Task task;
+	task.Src = src;		task.SrcW = srcW;	task.SrcH = srcH;
+	task.Dst = dst;		task.DstW = dstW;	task.DstH = dstH;
+	return Resample(std::vector<Task>(1, task), filter, edgeMode);
+}
+
+
+bool Resampler::Resample(const std::vector<tPicture*>& pictures, int width, int height, tResampleFilter filter, tResampleEdgeMode edgeMode)
+{
+	if ((width < 1) || (height < 1))
+		return false;
+
+	std::vector<Task> tasks;
+	std::vector<tPicture*> changed;
+	for (tPicture* picture : pictures)
+	{
+		if (!picture->IsValid())
+			return false;
+		if ((picture->GetWidth() == width) && (picture->GetHeight() == height))
+			continue;
+
+		Task task;
+		task.Src = picture->GetPixels();	task.SrcW = picture->GetWidth();	task.SrcH = picture->GetHeight();
+		task.DstW = width;					task.DstH = height;
+		tasks.push_back(task);
+		changed.push_back(picture);
+	}
+
+	for (Task& task : tasks)
+		task.Dst = new tPixel[size_t(width)*height];
+
+	bool success = Resample(tasks, filter, edgeMode);
+	for (int t = 0; t < int(tasks.size()); t++)
+	{
+		if (!success)
+		{
+			delete[] tasks[t].Dst;
+			continue;
+		}
+
+		float duration = changed[t]->Duration;
+		changed[t]->Set(width, height, tasks[t].Dst, false);
+		changed[t]->Duration = duration;
+	}
+
+	return success;
+}
+
+
+bool Resampler::Resample(tPicture& picture, int width, int height, tResampleFilter filter, tResampleEdgeMode edgeMode)
+{
+	return Resample(std::vector<tPicture*>(1, &picture), width, height, filter, edgeMode);
+}
+
+
+bool Resampler::Resample(tList<tPicture>& pictures, int width, int height, tResampleFilter filter, tResampleEdgeMode edgeMode)
+{
+	std::vector<tPicture*> list;
+	for (tPicture* picture = pictures.First(); picture; picture = picture->Next())
+		list.push_back(picture);
+
+	return Resample(list, width, height, filter, edgeMode);
+}
+
+
+void Resampler::WarpRows(tPixel* dst, const tPixel* src, int srcW, int srcH, int dstW, int begin, int end, const Affine& map, const PhaseTable* phases, const tPixel& fill)
+{
+	int numTaps = phases ? phases->NumTaps : 0;
+	int reach = phases ? phases->Reach : 0;
+	std::vector<tPixel> clamped(numTaps);
+	std::vector<tPixel> column(numTaps);
+	for (int y = begin; y < end; y++)
+	{
+		tPixel* row = dst + size_t(y)*dstW;
+		float cy = float(y) + 0.5f;
+		for (int x = 0; x < dstW; x++)
+		{
+			float cx = float(x) + 0.5f;
+			float sx = map.M00*cx + map.M01*cy + map.TX;
+			float sy = map.M10*cx + map.M11*cy + map.TY;
+			if ((sx < 0.0f) || (sy < 0.0f) || (sx > float(srcW)) || (sy > float(srcH)))
+			{
+				row[x] = fill;
+				continue;
+			}
+
+			// Inside the source, taps past the edge are clamped so the border doesn't pick up the fill.
+			if (!phases)
+			{
+				int ix = tMath::tClamp(int(sx), 0, srcW-1);
+				int iy = tMath::tClamp(int(sy), 0, srcH-1);
+				row[x] = src[size_t(iy)*srcW + ix];
+				continue;
+			}
+
+			// Rounding to the nearest phase may carry over to the next pixel.
+			float u = sx - 0.5f;
+			float v = sy - 0.5f;
+			int ix = int(std::floor(u));
+			int iy = int(std::floor(v));
+			int phaseX = int((u - float(ix))*float(WarpPhases) + 0.5f);
+			int phaseY = int((v - float(iy))*float(WarpPhases) + 0.5f);
+			if (phaseX == WarpPhases)
+			{
+				ix++;
+				phaseX = 0;
+			}
+			if (phaseY == WarpPhases)
+			{
+				iy++;
+				phaseY = 0;
+			}
+
+			// Each tap row is resampled across to one pixel, and then that column is resampled down, both with the
+			// same fixed-point code as the separable passes. Rows with no weight are skipped.
+			const int16* weightsX = &phases->Weights[size_t(phaseX)*numTaps];
+			const int16* weightsY = &phases->Weights[size_t(phaseY)*numTaps];
+			int startX = ix - reach + 1;
+			int startY = iy - reach + 1;
+			bool inside = (startX >= 0) && (startX + numTaps <= srcW);
+			for (int t = 0; t < numTaps; t++)
+			{
+				if (weightsY[t] == 0)
+					continue;
+
+				const tPixel* srcRow = src + size_t(tMath::tClamp(startY + t, 0, srcH-1))*srcW;
+				if (!inside)
+				{
+					for (int s = 0; s < numTaps; s++)
+						clamped[s] = srcRow[tMath::tClamp(startX + s, 0, srcW-1)];
+				}
+
+				const tPixel* taps = inside ? (srcRow + startX) : clamped.data();
+				uint32 pixel = ResamplePixel((const uint8*)taps, weightsX, numTaps);
+				memcpy(&column[t], &pixel, 4);
+			}
+
+			uint32 pixel = ResamplePixel((const uint8*)column.data(), weightsY, numTaps);
+			memcpy(&row[x], &pixel, 4);
+		}
+	}
+}
+
+
+bool Resampler::Warp(const tPixel* src, int srcW, int srcH, tPixel* dst, int dstW, int dstH, const Affine& map, tResampleFilter filter, const tPixel& fill)
+{
+	if (!src || !dst || (srcW <= 0) || (srcH <= 0) || (dstW <= 0) || (dstH <= 0) || (filter == tResampleFilter::None))
+		return false;
+
+	// How far apart neighbouring destination pixels land in the source. The kernel is widened by the larger of the two
+	// so a rotated reduction still covers its whole footprint.
+	float stepX = std::sqrt(map.M00*map.M00 + map.M10*map.M10);
+	float stepY = std::sqrt(map.M01*map.M01 + map.M11*map.M11);
+	float filterScale = tMath::tMax(stepX, stepY, 1.0f);
+
+	// The weights are worked out once for the whole warp. Each pixel is a row of taps for every tap row, and one more
+	// row down the column.
+	PhaseTable phaseTable;
+	if (filter != tResampleFilter::Nearest)
+		phaseTable = BuildPhaseTable(filter, filterScale);
+	const PhaseTable* phases = (filter != tResampleFilter::Nearest) ? &phaseTable : nullptr;
+	int taps = tMath::tMax(phaseTable.NumTaps, 1);
+	int grain = tMath::tMax(1, MinTapsPerChunk / (dstW*taps*(taps+1)));
+	Viewer::WorkerPool.ParallelFor
+	(
+		dstH, grain,
+		[=, &map, &fill](int begin, int end) { WarpRows(dst, src, srcW, srcH, dstW, begin, end, map, phases, fill); }
+	);
+	return true;
+}
+
+
+// The crop is the centred rectangle the rotate dialog has always cut from the rotated canvas. Only its size is worked out
+// here, and the map goes from the output straight back to the unrotated source.
+void Resampler::GetRotateCropMap(Affine& map, int& dstW, int& dstH, int srcW, int srcH, float angle, bool resize)
+{
+	float cosA = std::cos(angle);
+	float sinA = std::sin(angle);
+	int rotW = int(std::ceil(std::fabs(float(srcW)*cosA) + std::fabs(float(srcH)*sinA) - 0.001f));
+	int rotH = int(std::ceil(std::fabs(float(srcW)*sinA) + std::fabs(float(srcH)*cosA) - 0.001f));
+
+	int origW = srcW;
+	int origH = srcH;
+	bool aspectFlip = ((origW > origH) && (rotW < rotH)) || ((origW < origH) && (rotW > rotH));
+	if (aspectFlip)
+		std::swap(origW, origH);
+
+	int dx = rotW - origW;
+	int dy = rotH - origH;
+	int newW = origW - dx;
+	int newH = origH - dy;
+	if (dx > origW/2)
+	{
+		newW = origW - origW/2;
+		newH = (newW*origH)/origW;
+	}
+	else if (dy > origH/2)
+	{
+		newH = origH - origH/2;
+		newW = (newH*origW)/origH;
+	}
+	newW = tMath::tMax(newW, 1);
+	newH = tMath::tMax(newH, 1);
+
+	dstW = resize ? origW : newW;
+	dstH = resize ? origH : newH;
+	float scaleX = float(newW) / float(dstW);
+	float scaleY = float(newH) / float(dstH);
+
+	// Output centre to crop centre, which is the canvas centre, then rotated back about the source centre.
+	map.M00 = cosA*scaleX;		map.M01 = sinA*scaleY;
+	map.M10 = -sinA*scaleX;		map.M11 = cosA*scaleY;
+	map.TX = 0.5f*float(srcW) - (map.M00*0.5f*float(dstW) + map.M01*0.5f*float(dstH));
+	map.TY = 0.5f*float(srcH) - (map.M10*0.5f*float(dstW) + map.M11*0.5f*float(dstH));
+}
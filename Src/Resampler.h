@@ -0,0 +1,81 @@
+// Resampler.h
+//
+// A separable resampler for all the tResampleFilter kernels. Each axis is a pass of fixed-point multiply-adds, vectorized
+// with SSE2, AVX2, or NEON, with rows split across the worker pool. When reducing, the kernels are widened by the
+// reduction factor so every source pixel contributes. Filter weights depend only on the source and destination lengths
+// and the filter, so they are computed once and cached. An affine warp with the same kernels handles rotations.
+//
+// Copyright (c) 2021 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <vector>
+#include <Foundation/tList.h>
+#include <Image/tPicture.h>
+#include <Image/tResample.h>
+namespace Resampler
+{
+
+
+// One image to resample. Dst must hold DstW*DstH pixels and must not overlap Src.
+struct Task
+{
+	const tPixel* Src	= nullptr;
+	int SrcW			= 0;
+	int SrcH			= 0;
+	tPixel* Dst			= nullptr;
+	int DstW			= 0;
+	int DstH			= 0;
+};
+
+// Runs all the tasks together. Every pass splits the rows of all the tasks across the worker pool, so many small frames
+// keep every thread as busy as one big image. Called from a worker thread, or with the pool not running, the tasks run
+// on the calling thread. An axis that doesn't change size is copied, not filtered. Returns false if any task is
+// invalid or the filter is None, in which case nothing is written.
+bool Resample(const std::vector<Task>&, tImage::tResampleFilter, tImage::tResampleEdgeMode = tImage::tResampleEdgeMode::Clamp);
+
+// Same argument order as tImage::Resample.
+bool Resample(const tPixel* src, int srcW, int srcH, tPixel* dst, int dstW, int dstH, tImage::tResampleFilter, tImage::tResampleEdgeMode = tImage::tResampleEdgeMode::Clamp);
+
+// Resizes the pictures in place as one batch. Pictures already the right size are left alone. The frame durations are
+// kept.
+bool Resample(tImage::tPicture&, int width, int height, tImage::tResampleFilter, tImage::tResampleEdgeMode = tImage::tResampleEdgeMode::Clamp);
+bool Resample(const std::vector<tImage::tPicture*>&, int width, int height, tImage::tResampleFilter, tImage::tResampleEdgeMode = tImage::tResampleEdgeMode::Clamp);
+bool Resample(tList<tImage::tPicture>&, int width, int height, tImage::tResampleFilter, tImage::tResampleEdgeMode = tImage::tResampleEdgeMode::Clamp);
+
+// Maps destination pixel centres to source positions: SrcX = M00*x + M01*y + TX and SrcY = M10*x + M11*y + TY. Pixel
+// centres are at half integers.
+struct Affine
+{
+	float M00			= 1.0f;
+	float M01			= 0.0f;
+	float M10			= 0.0f;
+	float M11			= 1.0f;
+	float TX			= 0.0f;
+	float TY			= 0.0f;
+};
+
+// Samples the source once for each destination pixel through the map, so rotating, cropping, and scaling together
+// need no intermediate images. Where a destination pixel covers more than one source pixel the kernel is widened, as
+// when reducing. Positions are rounded to 1/64 of a pixel so the fixed-point weights can be worked out up front, and
+// then each pixel is the same vectorized multiply-adds as the separable passes. Destination pixels that map outside the
+// source get the fill colour. Returns false if the filter is None or either image is empty.
+bool Warp(const tPixel* src, int srcW, int srcH, tPixel* dst, int dstW, int dstH, const Affine&, tImage::tResampleFilter, const tPixel& fill);
+
+// The map for the rotate dialog's crop modes, straight from the output back to the unrotated source. The output is the
+// centred crop the dialog has always cut from the rotated canvas or, with resize, that crop scaled back up to the
+// source size with any aspect flip. Angles are as tPicture::RotateCenter takes them.
+void GetRotateCropMap(Affine&, int& dstW, int& dstH, int srcW, int srcH, float angle, bool resize);
+
+// The weight cache is bounded and cleared when full. This frees it early.
+void ClearWeightCache();
+
+
+}
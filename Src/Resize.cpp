@@ -128,7 +128,6 @@ void Viewer::DoResizeCrop(int srcW, int srcH, int dstW, int dstH)
 {
 	if ((dstW != srcW) || (dstH != srcH))
 	{
-		CurrImage->Unbind();
 		if (Config.CropAnchor == -1)
 		{
 			int originX = (Viewer::CursorX * (srcW - dstW)) / srcW;
@@ -159,9 +158,8 @@ void Viewer::DoFillColourInterface(const char* toolTipText)
 		ShowToolTip(toolTipText);
 
 	ImGui::SameLine();
-	tPicture* picture = CurrImage ? CurrImage->GetCurrentPic() : nullptr;
-	if (ImGui::Button("Origin", tVector2(63, 0)) && picture)
-		Config.FillColour = picture->GetPixel(0, 0);
+	if (ImGui::Button("Origin", tVector2(63, 0)) && CurrImage && CurrImage->GetCurrentPic())
+		Config.FillColour = CurrImage->GetCurrentPic()->GetPixel(0, 0);
 	ShowToolTip("Pick the colour from pixel (0, 0) in the current image.");
 
 	ImGui::SameLine();
@@ -185,9 +183,9 @@ void Viewer::DoResizeImageModal(bool resizeImagePressed)
 	if (!ImGui::BeginPopupModal("Resize Image", &isOpenResizeImage, ImGuiWindowFlags_AlwaysAutoResize))
 		return;
 
-	tAssert(CurrImage);		tPicture* picture = CurrImage->GetCurrentPic();		tAssert(picture);
-	int srcW				= picture->GetWidth();
-	int srcH				= picture->GetHeight();
+	tAssert(CurrImage);
+	int srcW				= CurrImage->GetCurrentFrameWidth();
+	int srcH				= CurrImage->GetCurrentFrameHeight();
 	static int dstW			= 512;
 	static int dstH			= 512;
 	if (resizeImagePressed)	{ dstW = srcW; dstH = srcH; }
@@ -283,11 +281,8 @@ void Viewer::DoResizeCanvasModal(bool resizeCanvasPressed)
 void Viewer::DoResizeCanvasAnchorTab(bool justOpened)
 {
 	tAssert(CurrImage);
-	tPicture* picture = CurrImage->GetCurrentPic();
-	tAssert(picture);
-
-	int srcW					= picture->GetWidth();
-	int srcH					= picture->GetHeight();
+	int srcW					= CurrImage->GetCurrentFrameWidth();
+	int srcH					= CurrImage->GetCurrentFrameHeight();
 	static int dstW				= 512;
 	static int dstH				= 512;
 	if (justOpened)
@@ -393,10 +388,8 @@ void Viewer::DoResizeCanvasRemoveBordersTab(bool justOpened)
 void Viewer::DoResizeCanvasAspectTab(bool justOpened)
 {
 	tAssert(CurrImage);
-	tPicture* picture = CurrImage->GetCurrentPic();
-	tAssert(picture);
-	int srcW = picture->GetWidth();
-	int srcH = picture->GetHeight();
+	int srcW = CurrImage->GetCurrentFrameWidth();
+	int srcH = CurrImage->GetCurrentFrameHeight();
 
 	ImGui::NewLine();
 	ImGui::PushItemWidth(100);
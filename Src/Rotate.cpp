@@ -96,53 +96,22 @@ void Viewer::DoRotateImageModal(bool rotateImagePressed)
 	ImGui::SetCursorPosX(ImGui::GetWindowContentRegionMax().x - 100.0f);
 	if (ImGui::Button("Rotate", tVector2(100, 0)))
 	{
-		tPicture* picture = CurrImage->GetCurrentPic(); tAssert(picture);
-		int origW = picture->GetWidth();
-		int origH = picture->GetHeight();
-
 		CurrImage->Unbind();
-		CurrImage->Rotate
-		(
-			tDegToRad(RotateAnglePreview), Config.FillColour,
-			tResampleFilter(Config.ResampleFilterRotateUp),
-			tResampleFilter(Config.ResampleFilterRotateDown)
-		);
-
-		if ((Config.RotateMode == int(Settings::RotMode::Crop)) || (Config.RotateMode == int(Settings::RotMode::CropResize)))
+		bool crop = (Config.RotateMode == int(Settings::RotMode::Crop));
+		bool cropResize = (Config.RotateMode == int(Settings::RotMode::CropResize));
+		if (crop || cropResize)
 		{
-			// If one of the crop modes is selected we need to crop the edges. Since rectangles are made of lines and there
-			// is symmetry and we can compute the reduced size by subtracting the original size from the rotated size.
-			int rotW = picture->GetWidth();
-			int rotH = picture->GetHeight();
-			bool aspectFlip = ((origW > origH) && (rotW < rotH)) || ((origW < origH) && (rotW > rotH));
-			if (aspectFlip)
-				tSwap(origW, origH);
-
-			int dx = rotW - origW;
-			int dy = rotH - origH;
-			int newW = origW - dx;
-			int newH = origH - dy;
-
-			if (dx > origW/2)
-			{
-				newW = origW - origW/2;
-				newH = (newW*origH)/origW;
-			}
-			else if (dy > origH/2)
-			{
-				newH = origH - origH/2;
-				newW = (newH*origW)/origH;
-			}
-
-			// The above code has been tested with a 1x1 input and (newH,newW) result correcty as (1,1). 
-			CurrImage->Crop(newW, newH, tPicture::Anchor::MiddleMiddle);
+			// The crop modes rotate, crop, and resize in one pass so there's one undo step and no intermediate images.
+			CurrImage->RotateCrop(tDegToRad(RotateAnglePreview), cropResize, Config.FillColour, tResampleFilter(Config.ResampleFilterRotateUp));
 		}
-
-		if (Config.RotateMode == int(Settings::RotMode::CropResize))
+		else
 		{
-			// The crop is done. Now resample.
-			tResampleFilter filter = (Config.ResampleFilterRotateUp != int(tResampleFilter::None)) ? tResampleFilter(Config.ResampleFilterRotateUp) : tResampleFilter::Nearest;
-			CurrImage->Resample(origW, origH, filter, tResampleEdgeMode::Clamp);
+			CurrImage->Rotate
+			(
+				tDegToRad(RotateAnglePreview), Config.FillColour,
+				tResampleFilter(Config.ResampleFilterRotateUp),
+				tResampleFilter(Config.ResampleFilterRotateDown)
+			);
 		}
 
 		CurrImage->Bind();
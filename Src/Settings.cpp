@@ -91,11 +91,15 @@ void Viewer::Settings::ResetBehaviourSettings()
 	ResizeAspectMode			= 0;
 	MaxImageMemMB				= 1024;
 	MaxCacheFiles				= 7000;
+	ThumbnailCompression		= 1;
 	MaxUndoSteps				= 16;
+	UndoBudgetMB				= 1024;
+	TextureUploadBudget			= 4;
 	StrictLoading				= false;
 	DetectAPNGInsidePNG			= true;
 	MipmapFilter				= int(tImage::tResampleFilter::Bilinear);
 	MipmapChaining				= true;
+	CompressTextures			= false;
 	AutoPlayAnimatedImages		= true;
 	MonitorGamma				= tMath::DefaultGamma;
 }
@@ -197,11 +201,15 @@ void Viewer::Settings::Load(const tString& filename)
 				ReadItem(ResizeAspectMode);
 				ReadItem(MaxImageMemMB);
 				ReadItem(MaxCacheFiles);
+				ReadItem(ThumbnailCompression);
 				ReadItem(MaxUndoSteps);
+				ReadItem(UndoBudgetMB);
+				ReadItem(TextureUploadBudget);
 				ReadItem(StrictLoading);
 				ReadItem(DetectAPNGInsidePNG);
 				ReadItem(MipmapFilter);
 				ReadItem(MipmapChaining);
+				ReadItem(CompressTextures);
 				ReadItem(AutoPropertyWindow);
 				ReadItem(AutoPlayAnimatedImages);
 				ReadItem(MonitorGamma);
@@ -236,7 +244,10 @@ void Viewer::Settings::Load(const tString& filename)
 	tiClamp		(ResizeAspectMode, 0, 1);
 	tiClampMin	(MaxImageMemMB, 256);
 	tiClampMin	(MaxCacheFiles, 200);	
+	tiClamp		(ThumbnailCompression, 0, 2);
 	tiClamp		(MaxUndoSteps, 1, 32);
+	tiClamp		(UndoBudgetMB, 64, 65536);
+	tiClamp		(TextureUploadBudget, 1, 100);
 	tiClamp		(MipmapFilter, 0, int(tImage::tResampleFilter::NumFilters));	// None allowed.
 	tiClamp		(SaveAllSizeMode, 0, 3);
 	tiClamp		(SaveFileJpegQuality, 1, 100);
@@ -316,11 +327,15 @@ bool Viewer::Settings::Save(const tString& filename)
 	WriteItem(ResizeAspectMode);
 	WriteItem(MaxImageMemMB);
 	WriteItem(MaxCacheFiles);
+	WriteItem(ThumbnailCompression);
 	WriteItem(MaxUndoSteps);
+	WriteItem(UndoBudgetMB);
+	WriteItem(TextureUploadBudget);
 	WriteItem(StrictLoading);
 	WriteItem(DetectAPNGInsidePNG);
 	WriteItem(MipmapFilter);
 	WriteItem(MipmapChaining);
+	WriteItem(CompressTextures);
 	WriteItem(AutoPropertyWindow);
 	WriteItem(AutoPlayAnimatedImages);
 	WriteItem(MonitorGamma);
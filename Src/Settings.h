@@ -109,12 +109,16 @@ namespace Viewer
 		int ResizeAspectDen;
 		int ResizeAspectMode;				// 0 = Crop Mode. 1 = Letterbox Mode.
 		int MaxImageMemMB;					// Max image mem before unloading images.
-		int MaxCacheFiles;					// Max number of cache files before removing oldest.
+		int MaxCacheFiles;					// Max number of cached thumbnails before evicting least recently used.
+		int ThumbnailCompression;			// Matches Compress::Method. 0 = None. 1 = Lossless. 2 = Lossy.
 		int MaxUndoSteps;
+		int UndoBudgetMB;					// Memory for undo history across all images. Beyond it steps are spilled to disk, then dropped.
+		int TextureUploadBudget;			// Milliseconds per frame spent uploading big images to the GPU.
 		bool StrictLoading;					// No attempt to display ill-formed images.
 		bool DetectAPNGInsidePNG;			// Look for APNG data (animated) hidden inside a regular PNG file.
 		int MipmapFilter;					// Matches tImage::tResampleFilter. Use None for no mipmaps.
 		bool MipmapChaining;				// True for faster mipmap generation. False for a lot slower and slightly better results.
+		bool CompressTextures;				// Big images are shown from BC1/BC3 textures encoded on the workers. Uses 4 to 8x less VRAM.
 		bool AutoPropertyWindow;			// Auto display property editor window for supported file types.
 		bool AutoPlayAnimatedImages;		// Automatically play animated gifs, apngs, and WebPs.
 		float MonitorGamma;					// Used when displaying HDR formats to do gamma correction.
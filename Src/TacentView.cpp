@@ -51,6 +51,14 @@
 #include "Rotate.h"
 #include "OpenSaveDialogs.h"
 #include "Settings.h"
+#include "WorkerPool.h"
+#include "ThumbnailCache.h"
+#include "ThumbnailAtlas.h"
+#include "TextureStream.h"
+#include "TiledTexture.h"
+#include "DisplayShader.h"
+#include "Benchmark.h"
+#include "CacheWarmer.h"
 #include "Version.cmake.h"
 using namespace tStd;
 using namespace tSystem;
@@ -60,6 +68,8 @@ using namespace tMath;
 namespace Viewer
 {
 	tCommand::tParam ImageFileParam(1, "ImageFile", "File to open.");
+	tCommand::tOption BenchmarkOption("Run a benchmark and exit. Use 'all' to run every benchmark.", "benchmark", 1);
+	tCommand::tOption WarmThumbnailsOption("Cache thumbnails for every image under a directory and exit.", "warm-thumbnails", 1);
 	NavLogBar NavBar;
 	tString ImagesDir;
 	tList<tStringItem> ImagesSubDirs;
@@ -67,6 +77,11 @@ namespace Viewer
 	tItList<Image> ImagesLoadTimeSorted(tListMode::External);		// We don't need static here cuz the list is only used after main().
 	tuint256 ImagesHash												= 0;
 	Image* CurrImage												= nullptr;
+	Worker::Pool WorkerPool;
+	ThumbnailCache ThumbCache;
+	ThumbnailAtlas ThumbAtlas;
+	DisplayShader Display;
+	DisplayShader::Params DisplayParams;
 	
 	void LoadAppImages(const tString& dataDir);
 	void UnloadAppImages();
@@ -174,6 +189,7 @@ namespace Viewer
 	const float ZoomMax							= 2500.0f;
 	uint64 FrameNumber							= 0;
 	tVector2 ToolImageSize						(24.0f, 24.0f);
+	uint CheckerboardTexID						= 0;
 
 	void DrawBackground(float bgX, float bgY, float bgW, float bgH);
 	void DrawNavBar(float x, float y, float w, float h);
@@ -183,12 +199,6 @@ namespace Viewer
 
 	// When compare functions are used to sort, they result in ascending order if they return a < b.
 	bool Compare_AlphabeticalAscending(const tStringItem& a, const tStringItem& b)										{ return tStricmp(a.Chars(), b.Chars()) < 0; }
-	bool Compare_FileCreationTimeAscending(const tStringItem& a, const tStringItem& b)
-	{
-		tFileInfo ia; tGetFileInfo(ia, a);
-		tFileInfo ib; tGetFileInfo(ib, b);
-		return ia.CreationTime < ib.CreationTime;
-	}
 	bool Compare_ImageLoadTimeAscending(const Image& a, const Image& b)													{ return a.GetLoadedTime() < b.GetLoadedTime(); }
 	bool Compare_ImageFileNameAscending(const Image& a, const Image& b)													{ return tStricmp(a.Filename.Chars(), b.Filename.Chars()) < 0; }
 	bool Compare_ImageFileNameDescending(const Image& a, const Image& b)												{ return tStricmp(a.Filename.Chars(), b.Filename.Chars()) > 0; }
@@ -213,7 +223,6 @@ namespace Viewer
 
 	tString FindImageFilesInCurrentFolder(tList<tStringItem>& foundFiles);	// Returns the image folder.
 	tuint256 ComputeImagesHash(const tList<tStringItem>& files);
-	int RemoveOldCacheFiles(const tString& cacheDir);						// Returns num removed.
 
 	enum CursorMove
 	{
@@ -225,8 +234,15 @@ namespace Viewer
 	};
 	CursorMove RequestCursorMove = CursorMove_None;
 
+	// The main loop sleeps until something needs a redraw. Input is followed by a few more frames so ImGui can
+	// settle, for example to show a popup opened by a click. GetWaitTimeout returns 0 to draw right away and a
+	// negative value to wait for the next event however long it takes.
+	const int SettleFrames						= 3;
+	int RedrawFrames							= SettleFrames;
+	double GetWaitTimeout();
+
 	void Update(GLFWwindow* window, double dt, bool dopoll = true);
-	void WindowRefreshFun(GLFWwindow* window)																			{ Update(window, 0.0, false); }
+	void WindowRefreshFun(GLFWwindow* window)																			{ RedrawFrames = SettleFrames; Update(window, 0.0, false); }
 	void KeyCallback(GLFWwindow*, int key, int scancode, int action, int modifiers);
 	void MouseButtonCallback(GLFWwindow*, int mouseButton, int x, int y);
 	void CursorPosCallback(GLFWwindow*, double x, double y);
@@ -441,6 +457,7 @@ void Viewer::LoadCurrImage()
 	if (!CurrImage->IsLoaded())
 		imgJustLoaded = CurrImage->Load();
 
+	CurrImage->PrefetchMipmaps();
 	AutoPropertyWindow();
 	if
 	(
@@ -642,50 +659,45 @@ void Viewer::DrawBackground(float bgX, float bgY, float bgW, float bgH)
 
 		case int(Settings::BGStyle::Checkerboard):
 		{
-			// Semitransparent checkerboard background.
-			int x = 0;
-			int y = 0;
-			bool lineStartToggle = false;
-			float checkSize = 16.0f;
-			while (y*checkSize < bgH)
+			// Semitransparent checkerboard background. It's a 2x2 texture repeated over a single quad with nearest
+			// filtering, so the cost doesn't depend on the window size. Each texel is one check.
+			if (CheckerboardTexID == 0)
 			{
-				bool colourToggle = lineStartToggle;
-
-				while (x*checkSize < bgW)
+				uint8 checks[16] =
 				{
-					if (colourToggle)
-						glColor4f(0.3f, 0.3f, 0.35f, 1.0f);
-					else
-						glColor4f(0.4f, 0.4f, 0.45f, 1.0f);
-
-					colourToggle = !colourToggle;
-
-					float cw = checkSize;
-					if ((x+1)*checkSize > bgW)
-						cw -= (x+1)*checkSize - bgW;
-
-					float ch = checkSize;
-					if ((y+1)*checkSize > bgH)
-						ch -= (y+1)*checkSize - bgH;
-
-					float l = tMath::tRound(bgX+x*checkSize);
-					float r = tMath::tRound(bgX+x*checkSize+cw);
-					float b = tMath::tRound(bgY+y*checkSize);
-					float t = tMath::tRound(bgY+y*checkSize+ch);
-
-					glBegin(GL_QUADS);
-					glVertex2f(l, b);
-					glVertex2f(l, t);
-					glVertex2f(r, t);
-					glVertex2f(r, b);
-					glEnd();
-
-					x++;
-				}
-				x = 0;
-				y++;
-				lineStartToggle = !lineStartToggle;
+					102, 102, 115, 255,		77,  77,  89,  255,
+					77,  77,  89,  255,		102, 102, 115, 255
+				};
+
+				glGenTextures(1, &CheckerboardTexID);
+				glBindTexture(GL_TEXTURE_2D, CheckerboardTexID);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+				glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+				glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 2, 2, 0, GL_RGBA, GL_UNSIGNED_BYTE, checks);
 			}
+
+			// The checks start at the bottom-left corner. Partial checks are cut off at the right and top.
+			float checkSize = 16.0f;
+			float l = tMath::tRound(bgX);
+			float r = tMath::tRound(bgX+bgW);
+			float b = tMath::tRound(bgY);
+			float t = tMath::tRound(bgY+bgH);
+			float u = (r-l) / (2.0f*checkSize);
+			float v = (t-b) / (2.0f*checkSize);
+
+			glColor4f(1.0f, 1.0f, 1.0f, 1.0f);
+			glEnable(GL_TEXTURE_2D);
+			glBindTexture(GL_TEXTURE_2D, CheckerboardTexID);
+			glBegin(GL_QUADS);
+			glTexCoord2f(0.0f, 0.0f);	glVertex2f(l, b);
+			glTexCoord2f(0.0f, v);		glVertex2f(l, t);
+			glTexCoord2f(u, v);			glVertex2f(r, t);
+			glTexCoord2f(u, 0.0f);		glVertex2f(r, b);
+			glEnd();
+			glDisable(GL_TEXTURE_2D);
 			break;
 		}
 
@@ -812,6 +824,35 @@ void Viewer::ProgressArc(float radius, float percent, const ImVec4& colour, cons
 }
 
 
+double Viewer::GetWaitTimeout()
+{
+	// These change every frame. The workers wake us when a job finishes, so pending thumbnails and mipmaps don't need
+	// to be here.
+	if
+	(
+		(RedrawFrames > 0) || SlideshowPlaying || LMBDown || RMBDown || WorkerPool.HasCompleted() ||
+		TextureStream::AnyActive() || TiledTexture::AnyPending()
+	)
+		return 0.0;
+
+	// Timers. Waking right when the next animation frame is due keeps playback timing as precise as drawing every
+	// frame did.
+	double timeout = -1.0;
+	if (CurrImage && CurrImage->FramePlaying && (CurrImage->GetNumFrames() > 1))
+		timeout = tMath::tMax(double(CurrImage->FrameCurrCountdown), 0.0);
+
+	// The on-screen controls hide when this runs out.
+	if (DisappearCountdown > 0.0)
+		timeout = (timeout < 0.0) ? DisappearCountdown : tMath::tMin(timeout, DisappearCountdown);
+
+	// Keep the text cursor blinking.
+	if (ImGui::GetIO().WantTextInput)
+		timeout = (timeout < 0.0) ? 0.1 : tMath::tMin(timeout, 0.1);
+
+	return timeout;
+}
+
+
 void Viewer::Update(GLFWwindow* window, double dt, bool dopoll)
 {
 	// Poll and handle events like inputs, window resize, etc. You can read the io.WantCaptureMouse,
@@ -825,6 +866,15 @@ void Viewer::Update(GLFWwindow* window, double dt, bool dopoll)
 	if (dopoll)
 		glfwPollEvents();
 
+	if (RedrawFrames > 0)
+		RedrawFrames--;
+
+	// Hand finished background work (thumbnails etc) back to its owners. This is the only place OnComplete is called.
+	WorkerPool.DrainCompleted();
+	if (CurrImage && CurrImage->ConsumeEditApplied())
+		SetWindowTitle();
+	TextureStream::BeginFrame(float(Config.TextureUploadBudget));
+
 	if (Config.TransparentWorkArea)
 		glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
 	else
@@ -921,6 +971,10 @@ void Viewer::Update(GLFWwindow* window, double dt, bool dopoll)
 			ZoomPercent = 100.0f * draww / iw;
 		}
 
+		// Block compression smears neighbouring texels together. Once each texel covers a couple of screen pixels that
+		// shows, so the exact texture is used instead.
+		CurrImage->SetExactDisplay(ZoomPercent >= 200.0f);
+
 		float w = iw * ZoomPercent/100.0f;
 		float h = ih * ZoomPercent/100.0f;
 
@@ -978,8 +1032,13 @@ void Viewer::Update(GLFWwindow* window, double dt, bool dopoll)
 		else
 			DrawBackground(left, bottom, right-left, top-bottom);
 
+		// A big image that is still streaming to the GPU may have nothing drawable yet. Only the background shows.
+		// Images bigger than the maximum texture size have no single texture and are drawn in tiles.
 		glColor4f(1.0f, 1.0f, 1.0f, 1.0f);
-		CurrImage->Bind();
+		if (Config.Tile && CurrImage->GetOrientation().IsCropped())
+			CurrImage->BakeOrientation();
+		bool haveTexture = (CurrImage->Bind() != 0);
+		TiledTexture* tiled = CurrImage->GetTiledTexture();
 		glEnable(GL_TEXTURE_2D);
 
 		if (RotateAnglePreview != 0.0f)
@@ -994,24 +1053,62 @@ void Viewer::Update(GLFWwindow* window, double dt, bool dopoll)
 			glMultMatrixf(rotMat.E);
 		}
 
-		glBegin(GL_QUADS);
-		if (!Config.Tile)
-		{
-			glTexCoord2f(0.0f + umarg + uoff, 0.0f + vmarg + voff); glVertex2f(left,  bottom);
-			glTexCoord2f(0.0f + umarg + uoff, 1.0f - vmarg + voff); glVertex2f(left,  top);
-			glTexCoord2f(1.0f - umarg + uoff, 1.0f - vmarg + voff); glVertex2f(right, top);
-			glTexCoord2f(1.0f - umarg + uoff, 0.0f + vmarg + voff); glVertex2f(right, bottom);
-		}
-		else
+		// The quad and the part of the image in it. When tiling, the quad fills the draw area and the uvs go past 0..1.
+		float quadL = left;		float quadR = right;	float quadB = bottom;	float quadT = top;
+		float texU0 = 0.0f + umarg + uoff;				float texU1 = 1.0f - umarg + uoff;
+		float texV0 = 0.0f + vmarg + voff;				float texV1 = 1.0f - vmarg + voff;
+		if (Config.Tile)
 		{
 			float repU = draww/(right-left);	float offU = (1.0f-repU)/2.0f;
 			float repV = drawh/(top-bottom);	float offV = (1.0f-repV)/2.0f;
-			glTexCoord2f(offU + 0.0f + umarg + uoff,	offV + 0.0f + vmarg + voff);	glVertex2f(hmargin,			vmargin);
-			glTexCoord2f(offU + 0.0f + umarg + uoff,	offV + repV - vmarg + voff);	glVertex2f(hmargin,			vmargin+drawh);
-			glTexCoord2f(offU + repU - umarg + uoff,	offV + repV - vmarg + voff);	glVertex2f(hmargin+draww,	vmargin+drawh);
-			glTexCoord2f(offU + repU - umarg + uoff,	offV + 0.0f + vmarg + voff);	glVertex2f(hmargin+draww,	vmargin);
+			quadL = hmargin;	quadR = hmargin+draww;	quadB = vmargin;	quadT = vmargin+drawh;
+			texU0 = offU + 0.0f + umarg + uoff;			texU1 = offU + repU - umarg + uoff;
+			texV0 = offV + 0.0f + vmarg + voff;			texV1 = offV + repV - vmarg + voff;
 		}
-		glEnd();
+
+		// Pending turns and flips aren't in the texture yet. The quad is drawn the way round the texture is stored, with
+		// the uvs mapped to match, and turned into place about its centre. A pending crop is the part of the texture the
+		// uvs cover. Tiling repeats the whole texture, so there the crop is baked above.
+		Transpose::Orientation orient = CurrImage->GetOrientation();
+		if (!orient.IsIdentity())
+		{
+			int storedW = 0;	int storedH = 0;
+			CurrImage->GetStoredSize(storedW, storedH);
+			float centreX = (quadL+quadR)/2.0f;		float halfW = (quadR-quadL)/2.0f;
+			float centreY = (quadB+quadT)/2.0f;		float halfH = (quadT-quadB)/2.0f;
+			if (orient.Transposed)
+				tMath::tSwap(halfW, halfH);
+			quadL = centreX - halfW;	quadR = centreX + halfW;	quadB = centreY - halfH;	quadT = centreY + halfH;
+
+			float u0 = texU0;	float v0 = texV0;	orient.MapUV(u0, v0, storedW, storedH);
+			float u1 = texU1;	float v1 = texV1;	orient.MapUV(u1, v1, storedW, storedH);
+			texU0 = tMath::tMin(u0, u1);	texU1 = tMath::tMax(u0, u1);
+			texV0 = tMath::tMin(v0, v1);	texV1 = tMath::tMax(v0, v1);
+
+			float orientMat[16];
+			orient.GetMatrix(orientMat, centreX, centreY);
+			glPushMatrix();
+			glMultMatrixf(orientMat);
+		}
+
+		Display.Begin(DisplayParams);
+		if (haveTexture)
+		{
+			glBegin(GL_QUADS);
+			glTexCoord2f(texU0, texV0); glVertex2f(quadL, quadB);
+			glTexCoord2f(texU0, texV1); glVertex2f(quadL, quadT);
+			glTexCoord2f(texU1, texV1); glVertex2f(quadR, quadT);
+			glTexCoord2f(texU1, texV0); glVertex2f(quadR, quadB);
+			glEnd();
+		}
+		else if (tiled)
+		{
+			tiled->Draw(quadL, quadR, quadB, quadT, texU0, texV0, texU1, texV1, Config.Tile);
+		}
+		Display.End();
+
+		if (!orient.IsIdentity())
+			glPopMatrix();
 
 		if (RotateAnglePreview != 0.0f)
 	 		glPopMatrix();
@@ -1421,7 +1518,6 @@ void Viewer::Update(GLFWwindow* window, double dt, bool dopoll)
 
 			if (ImGui::MenuItem("Flip Vertically", "Ctrl <", false, CurrImage && !CurrImage->IsAltPictureEnabled()))
 			{
-				CurrImage->Unbind();
 				CurrImage->Flip(false);
 				CurrImage->Bind();
 				SetWindowTitle();
@@ -1429,7 +1525,6 @@ void Viewer::Update(GLFWwindow* window, double dt, bool dopoll)
 
 			if (ImGui::MenuItem("Flip Horizontally", "Ctrl >", false, CurrImage && !CurrImage->IsAltPictureEnabled()))
 			{
-				CurrImage->Unbind();
 				CurrImage->Flip(true);
 				CurrImage->Bind();
 				SetWindowTitle();
@@ -1437,7 +1532,6 @@ void Viewer::Update(GLFWwindow* window, double dt, bool dopoll)
 
 			if (ImGui::MenuItem("Rotate Anti-Clockwise", "<", false, CurrImage && !CurrImage->IsAltPictureEnabled()))
 			{
-				CurrImage->Unbind();
 				CurrImage->Rotate90(true);
 				CurrImage->Bind();
 				SetWindowTitle();
@@ -1445,7 +1539,6 @@ void Viewer::Update(GLFWwindow* window, double dt, bool dopoll)
 
 			if (ImGui::MenuItem("Rotate Clockwise", ">", false, CurrImage && !CurrImage->IsAltPictureEnabled()))
 			{
-				CurrImage->Unbind();
 				CurrImage->Rotate90(false);
 				CurrImage->Bind();
 				SetWindowTitle();
@@ -1548,6 +1641,23 @@ void Viewer::Update(GLFWwindow* window, double dt, bool dopoll)
 			if (ImGui::Button("Reset Pan"))
 				ResetPan();
 
+			// Display settings only change shader uniforms, so they're free to adjust while looking.
+			if (Display.IsValid())
+			{
+				ImGui::Separator();
+				ImGui::PushItemWidth(100);
+				int channels = int(DisplayParams.Show);
+				if (ImGui::Combo("Channels", &channels, DisplayShader::ChannelsNames, int(DisplayShader::Channels::NumChannels)))
+					DisplayParams.Show = DisplayShader::Channels(channels);
+				ImGui::SliderFloat("Exposure", &DisplayParams.Exposure, -8.0f, 8.0f, "%.1f stops");
+				ImGui::SliderFloat("Gamma", &DisplayParams.Gamma, 0.2f, 5.0f, "%.2f");
+				ImGui::PopItemWidth();
+				ImGui::MenuItem("Premultiplied Alpha", "", &DisplayParams.Premultiplied);
+				ImGui::MenuItem("Invert Colours", "", &DisplayParams.Invert);
+				if (ImGui::Button("Reset Display"))
+					DisplayParams.Reset();
+			}
+
 			ImGui::PopStyleVar();
 			ImGui::EndMenu();
 		}
@@ -1584,7 +1694,6 @@ void Viewer::Update(GLFWwindow* window, double dt, bool dopoll)
 			transAvail ? ColourEnabledTint : ColourDisabledTint) && transAvail
 		)
 		{
-			CurrImage->Unbind();
 			CurrImage->Flip(false);
 			CurrImage->Bind();
 			SetWindowTitle();
@@ -1597,7 +1706,6 @@ void Viewer::Update(GLFWwindow* window, double dt, bool dopoll)
 			transAvail ? ColourEnabledTint : ColourDisabledTint) && transAvail
 		)
 		{
-			CurrImage->Unbind();
 			CurrImage->Flip(true);
 			CurrImage->Bind();
 			SetWindowTitle();
@@ -1610,7 +1718,6 @@ void Viewer::Update(GLFWwindow* window, double dt, bool dopoll)
 			transAvail ? ColourEnabledTint : ColourDisabledTint) && transAvail
 		)
 		{
-			CurrImage->Unbind();
 			CurrImage->Rotate90(true);
 			CurrImage->Bind();
 			SetWindowTitle();
@@ -1623,7 +1730,6 @@ void Viewer::Update(GLFWwindow* window, double dt, bool dopoll)
 			transAvail ? ColourEnabledTint : ColourDisabledTint) && transAvail
 		)
 		{
-			CurrImage->Unbind();
 			CurrImage->Rotate90(false);
 			CurrImage->Bind();
 			SetWindowTitle();
@@ -1769,6 +1875,9 @@ void Viewer::Update(GLFWwindow* window, double dt, bool dopoll)
 	if (Config.ShowPixelEditor)
 		ShowPixelEditorOverlay(&Config.ShowPixelEditor);
 
+	if (CurrImage && CurrImage->IsEditing())
+		ShowEditProgressOverlay(0.0f, float(topUIHeight), float(dispw), float(disph - bottomUIHeight - topUIHeight));
+
 	if (Config.ContentViewShow)
 		ShowContentViewDialog(&Config.ContentViewShow);
 
@@ -1986,7 +2095,6 @@ void Viewer::ZoomDownscaleOnly()
 void Viewer::Undo()
 {
 	tAssert(CurrImage && CurrImage->IsUndoAvailable());
-	CurrImage->Unbind();
 	CurrImage->Undo();
 	CurrImage->Bind();
 	SetWindowTitle();
@@ -1996,7 +2104,6 @@ void Viewer::Undo()
 void Viewer::Redo()
 {
 	tAssert(CurrImage && CurrImage->IsRedoAvailable());
-	CurrImage->Unbind();
 	CurrImage->Redo();
 	CurrImage->Bind();
 	SetWindowTitle();
@@ -2005,6 +2112,7 @@ void Viewer::Redo()
 
 void Viewer::KeyCallback(GLFWwindow* window, int key, int scancode, int action, int modifiers)
 {
+	RedrawFrames = SettleFrames;
 	if ((action != GLFW_PRESS) && (action != GLFW_REPEAT))
 		return;
 
@@ -2109,7 +2217,6 @@ void Viewer::KeyCallback(GLFWwindow* window, int key, int scancode, int action,
 		case GLFW_KEY_COMMA:
 			if (CurrImage && !CurrImage->IsAltPictureEnabled())
 			{
-				CurrImage->Unbind();
 				if (modifiers == GLFW_MOD_CONTROL)
 					CurrImage->Flip(false);
 				else
@@ -2122,7 +2229,6 @@ void Viewer::KeyCallback(GLFWwindow* window, int key, int scancode, int action,
 		case GLFW_KEY_PERIOD:
 			if (CurrImage && !CurrImage->IsAltPictureEnabled())
 			{
-				CurrImage->Unbind();
 				if (modifiers == GLFW_MOD_CONTROL)
 					CurrImage->Flip(true);
 				else
@@ -2298,6 +2404,7 @@ void Viewer::KeyCallback(GLFWwindow* window, int key, int scancode, int action,
 
 void Viewer::MouseButtonCallback(GLFWwindow* window, int mouseButton, int press, int mods)
 {
+	RedrawFrames = SettleFrames;
 	if (ImGui::GetIO().WantCaptureMouse)
 		return;
 
@@ -2351,6 +2458,7 @@ void Viewer::MouseButtonCallback(GLFWwindow* window, int mouseButton, int press,
 
 void Viewer::CursorPosCallback(GLFWwindow* window, double x, double y)
 {
+	RedrawFrames = SettleFrames;
 	if (ImGui::GetIO().WantCaptureMouse)
 		return;
 
@@ -2360,6 +2468,7 @@ void Viewer::CursorPosCallback(GLFWwindow* window, double x, double y)
 
 void Viewer::ScrollWheelCallback(GLFWwindow* window, double x, double y)
 {
+	RedrawFrames = SettleFrames;
 	if (ImGui::GetIO().WantCaptureMouse)
 		return;
 
@@ -2374,6 +2483,7 @@ void Viewer::ScrollWheelCallback(GLFWwindow* window, double x, double y)
 
 void Viewer::FileDropCallback(GLFWwindow* window, int count, const char** files)
 {
+	RedrawFrames = SettleFrames;
 	if (count < 1)
 		return;
 
@@ -2386,6 +2496,7 @@ void Viewer::FileDropCallback(GLFWwindow* window, int count, const char** files)
 
 void Viewer::FocusCallback(GLFWwindow* window, int gotFocus)
 {
+	RedrawFrames = SettleFrames;
 	if (!gotFocus)
 		return;
 
@@ -2416,37 +2527,11 @@ void Viewer::FocusCallback(GLFWwindow* window, int gotFocus)
 
 void Viewer::IconifyCallback(GLFWwindow* window, int iconified)
 {
+	RedrawFrames = SettleFrames;
 	WindowIconified = iconified;
 }
 
 
-int Viewer::RemoveOldCacheFiles(const tString& cacheDir)
-{
-	tList<tStringItem> cacheFiles;
-	tSystem::tFindFiles(cacheFiles, cacheDir, "bin");
-	int numFiles = cacheFiles.NumItems();
-	if (numFiles <= Config.MaxCacheFiles)
-		return 0;
-
-	cacheFiles.Sort(Compare_FileCreationTimeAscending);
-	int targetCount = tClampMin(Config.MaxCacheFiles - 100, 0);
-
-	int numToRemove = numFiles - targetCount;
-	tAssert(numToRemove >= 0);
-	int deletedCount = 0;
-	while (numToRemove)
-	{
-		tStringItem* head = cacheFiles.Remove();
-		if (tDeleteFile(*head))
-			deletedCount++;
-		delete head;
-		numToRemove--;
-	}
-
-	return deletedCount;
-}
-
-
 void Viewer::LoadAppImages(const tString& dataDir)
 {
 	ReticleImage			.Load(dataDir + "Reticle.png");
@@ -2520,6 +2605,10 @@ void Viewer::UnloadAppImages()
 	UpFolderImage			.Unload();
 	CropImage				.Unload();
 	DefaultThumbnailImage	.Unload();
+
+	if (CheckerboardTexID != 0)
+		glDeleteTextures(1, &CheckerboardTexID);
+	CheckerboardTexID = 0;
 }
 
 
@@ -2552,10 +2641,17 @@ int main(int argc, char** argv)
 	tPrintf("LD_LIBRARY_PATH  : %s\n", ldLibraryPath.Chars());
 	#endif
 
+	// Benchmarks and cache warming are headless. They don't initialize GLFW so they also work on machines without a
+	// display. Without GLFW the settings fall back to a default screen size, which is fine as they are never saved.
+	bool headless = Viewer::BenchmarkOption.IsPresent() || Viewer::WarmThumbnailsOption.IsPresent();
+
 	// Setup window
-	glfwSetErrorCallback(Viewer::GlfwErrorCallback);
-	if (!glfwInit())
-		return 1;
+	if (!headless)
+	{
+		glfwSetErrorCallback(Viewer::GlfwErrorCallback);
+		if (!glfwInit())
+			return 1;
+	}
 
 	int glfwMajor = 0; int glfwMinor = 0; int glfwRev = 0;
 	glfwGetVersion(&glfwMajor, &glfwMinor, &glfwRev);
@@ -2594,10 +2690,27 @@ int main(int argc, char** argv)
 
 	if (!tSystem::tDirExists(Viewer::Image::ThumbCacheDir))
 		tSystem::tCreateDir(Viewer::Image::ThumbCacheDir);
+	Viewer::ThumbCache.Open(Viewer::Image::ThumbCacheDir);
 	
 	Viewer::Config.Load(cfgFile);
 	Viewer::PendingTransparentWorkArea = Viewer::Config.TransparentWorkArea;
 
+	// Leave two cores free unless we are on a three core or lower machine, in which case we always use a min of 2 threads.
+	// Warming the cache is all the process does, so it gets every core.
+	int numCores = tSystem::tGetNumCores();
+	Viewer::WorkerPool.Startup(Viewer::WarmThumbnailsOption.IsPresent() ? tMath::tClampMin(numCores, 2) : tMath::tClampMin(numCores - 2, 2));
+
+	// Headless modes only need the pool and the cache.
+	if (headless)
+	{
+		int result = Viewer::BenchmarkOption.IsPresent() ?
+			Benchmark::Run(Viewer::BenchmarkOption.Arg1()) :
+			CacheWarmer::Run(Viewer::WarmThumbnailsOption.Arg1());
+		Viewer::WorkerPool.Shutdown();
+		Viewer::ThumbCache.Close();
+		return result;
+	}
+
 	// We start with window invisible. For windows DwmSetWindowAttribute won't redraw properly otherwise.
 	// For all plats, we want to position the window before displaying it.
 	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
@@ -2708,6 +2821,7 @@ int main(int argc, char** argv)
 	io.Fonts->AddFontFromFileTTF(fontFile.Chars(), 14.0f);
 
 	Viewer::LoadAppImages(dataDir);
+	Viewer::Display.Init();
 	Viewer::PopulateImages();
 	if (Viewer::ImageFileParam.IsPresent())
 		Viewer::SetCurrentImage(Viewer::ImageFileParam.Get());
@@ -2776,25 +2890,43 @@ int main(int argc, char** argv)
 		glDeleteTextures(1, &texID);
 	};
 
-	// Main loop.
+	// Main loop. It sleeps until there is input, a worker finishes a job, or a timer is due. Workers wake it with an
+	// empty event.
+	Viewer::WorkerPool.SetCompletedCallback(glfwPostEmptyEvent);
 	static double lastUpdateTime = glfwGetTime();
 	while (!glfwWindowShouldClose(Viewer::Window))
 	{
-		double currUpdateTime = glfwGetTime();
-		Viewer::Update(Viewer::Window, currUpdateTime - lastUpdateTime);
-		
-		// I don't seem to be able to get Linux to v-sync. This stops it using all the CPU.
+		double timeout = Viewer::GetWaitTimeout();
+
+		// I don't seem to be able to get Linux to v-sync. When drawing continuously this stops it using all the CPU.
+		// Waiting rather than sleeping means input still gets through right away.
 		#ifdef PLATFORM_LINUX
-		tSystem::tSleep(16);
+		if (timeout == 0.0)
+			timeout = tMath::tMax(1.0/60.0 - (glfwGetTime() - lastUpdateTime), 0.0);
 		#endif
-		
+
+		if (timeout < 0.0)
+			glfwWaitEvents();
+		else if (timeout > 0.0)
+			glfwWaitEventsTimeout(timeout);
+		else
+			glfwPollEvents();
+
+		double currUpdateTime = glfwGetTime();
+		Viewer::Update(Viewer::Window, currUpdateTime - lastUpdateTime, false);
 		lastUpdateTime = currUpdateTime;
 	}
+	Viewer::WorkerPool.SetCompletedCallback(nullptr);
 
-	// This is important. We need the destructors to run BEFORE we shutdown GLFW. Deconstructing the images may block for a bit while shutting
-	// down worker threads. We could show a 'shutting down' popup here if we wanted -- if Image::ThumbnailNumThreadsRunning is > 0.
+	// This is important. We need the destructors to run BEFORE we shutdown GLFW. Deleting the images cancels their queued
+	// thumbnail jobs. Shutting down the pool may block for a bit while running jobs finish. We could show a 'shutting down'
+	// popup here if we wanted -- if WorkerPool.IsBusy() is true.
 	Viewer::Images.Clear();	
 	Viewer::UnloadAppImages();
+	Viewer::ThumbAtlas.Clear();
+	Viewer::Display.Shutdown();
+	Viewer::WorkerPool.Shutdown();
+	Undo::Shutdown();
 
 	// Get current window geometry and set in config file if we're not in fullscreen mode and not iconified.
 	if (!Viewer::FullscreenMode && !Viewer::WindowIconified)
@@ -2814,10 +2946,17 @@ int main(int argc, char** argv)
 	glfwDestroyWindow(Viewer::Window);
 	glfwTerminate();
 
-	// Before we go, lets clear out any old cache files.
+	// Before we go, evict the least recently used thumbnails and compact the cache. The workers are shut down by
+	// now so nothing else in this process is writing to it.
 	if (Viewer::DeleteAllCacheFilesOnExit)
+	{
+		Viewer::ThumbCache.Close();
 		tSystem::tDeleteDir(Viewer::Image::ThumbCacheDir);
+	}
 	else
-		Viewer::RemoveOldCacheFiles(Viewer::Image::ThumbCacheDir);
+	{
+		Viewer::ThumbCache.Maintain(Viewer::Config.MaxCacheFiles);
+		Viewer::ThumbCache.Close();
+	}
 	return 0;
 }
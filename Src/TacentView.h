@@ -17,7 +17,8 @@
 #include <Math/tVector4.h>
 #include <System/tCommand.h>
 #include "Settings.h"
-namespace Viewer { class Image; }
+namespace Viewer { class Image; class ThumbnailCache; class ThumbnailAtlas; }
+namespace Worker { class Pool; }
 class tColouri;
 
 
@@ -25,6 +26,9 @@ namespace Viewer
 {
 	extern Settings Config;
 	extern Image* CurrImage;
+	extern Worker::Pool WorkerPool;
+	extern ThumbnailCache ThumbCache;
+	extern ThumbnailAtlas ThumbAtlas;
 	extern tString ImagesDir;
 	extern tList<tStringItem> ImagesSubDirs;
 	extern tList<Viewer::Image> Images;
@@ -0,0 +1,158 @@
+// TextureStream.cpp
+//
+// Uploads big textures to the GPU a horizontal band at a time, spread over several frames, so opening a very large
+// image doesn't stall the UI. Bands go through pixel buffer objects when available so the driver can copy them to
+// VRAM asynchronously. Levels are uploaded smallest first and the texture's base level follows the finest level that
+// is complete, so a blurry version is drawable almost immediately and sharpens as the upload proceeds.
+//
+// Copyright (c) 2021 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <Foundation/tStandard.h>
+#include <Foundation/tFundamentals.h>
+#include "TextureStream.h"
+using namespace tStd;
+using namespace Viewer;
+
+
+TextureStream::Clock::time_point TextureStream::FrameDeadline;
+int TextureStream::NumActive = 0;
+
+
+TextureStream::TextureStream(uint texID, const std::vector<Level>& levels, GLint srcFormat, GLenum srcType, GLint dstFormat, bool compressed) :
+	TexID(texID),
+	SrcFormat(srcFormat),
+	SrcType(srcType),
+	DstFormat(dstFormat),
+	Compressed(compressed),
+	Levels(levels)
+{
+	glBindTexture(GL_TEXTURE_2D, TexID);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, (Levels.size() > 1) ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+	for (int level = 0; level < int(Levels.size()); level++)
+	{
+		const Level& lev = Levels[level];
+		if (Compressed)
+			glCompressedTexImage2D(GL_TEXTURE_2D, level, DstFormat, lev.Width, lev.Height, 0, lev.NumBytes, nullptr);
+		else
+			glTexImage2D(GL_TEXTURE_2D, level, DstFormat, lev.Width, lev.Height, 0, SrcFormat, SrcType, nullptr);
+	}
+
+	// Until a level is complete the base level is the smallest so sampling never reads a level still being filled.
+	CurrLevel = int(Levels.size()) - 1;
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, tMath::tMax(CurrLevel, 0));
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, tMath::tMax(CurrLevel, 0));
+
+	// Pixel buffer objects are core in 2.1. Without them bands go straight from main memory, which still spreads the
+	// work over frames but the copy happens inside the glTexSubImage2D call.
+	UseBuffers = GLAD_GL_VERSION_2_1 ? true : false;
+	if (UseBuffers)
+		glGenBuffers(NumBuffers, Buffers);
+
+	NumActive++;
+}
+
+
+TextureStream::~TextureStream()
+{
+	if (UseBuffers)
+		glDeleteBuffers(NumBuffers, Buffers);
+
+	if (!IsComplete())
+		NumActive--;
+}
+
+
+void TextureStream::BeginFrame(float budgetMilliseconds)
+{
+	FrameDeadline = Clock::now() + std::chrono::microseconds(int(budgetMilliseconds * 1000.0f));
+}
+
+
+bool TextureStream::Update()
+{
+	if (IsComplete())
+		return true;
+
+	glBindTexture(GL_TEXTURE_2D, TexID);
+	do
+	{
+		UploadBand();
+	}
+	while (!IsComplete() && (Clock::now() < FrameDeadline));
+
+	return IsDrawable();
+}
+
+
+void TextureStream::UploadBand()
+{
+	const Level& level = Levels[CurrLevel];
+	int levelRows = GetNumRows(level);
+	int rowBytes = level.NumBytes / levelRows;
+	int numRows = tMath::tClamp(BandBytes / tMath::tMax(rowBytes, 1), 1, levelRows - CurrRow);
+	int bandBytes = numRows * rowBytes;
+	const uint8* src = level.Data + CurrRow*rowBytes;
+
+	// A compressed band is whole rows of blocks. Only the last one may stop short of a multiple of 4 texels.
+	int y = Compressed ? CurrRow*4 : CurrRow;
+	int height = Compressed ? tMath::tMin(numRows*4, level.Height - y) : numRows;
+
+	// Rows of 3-byte pixels aren't 4-byte aligned.
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	if (UseBuffers)
+	{
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, Buffers[NextBuffer]);
+		NextBuffer = (NextBuffer + 1) % NumBuffers;
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, bandBytes, nullptr, GL_STREAM_DRAW);
+		void* mapped = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+		if (mapped)
+		{
+			tMemcpy(mapped, src, bandBytes);
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+			SubImage(level, y, height, bandBytes, nullptr);
+		}
+		else
+		{
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			SubImage(level, y, height, bandBytes, src);
+		}
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	}
+	else
+	{
+		SubImage(level, y, height, bandBytes, src);
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+	CurrRow += numRows;
+	if (CurrRow < levelRows)
+		return;
+
+	CompleteLevel = CurrLevel;
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, CompleteLevel);
+
+	CurrLevel--;
+	CurrRow = 0;
+	if (IsComplete())
+		NumActive--;
+}
+
+
+void TextureStream::SubImage(const Level& level, int y, int height, int numBytes, const uint8* data)
+{
+	if (Compressed)
+		glCompressedTexSubImage2D(GL_TEXTURE_2D, CurrLevel, 0, y, level.Width, height, DstFormat, numBytes, data);
+	else
+		glTexSubImage2D(GL_TEXTURE_2D, CurrLevel, 0, y, level.Width, height, SrcFormat, SrcType, data);
+}
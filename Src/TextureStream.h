@@ -0,0 +1,92 @@
+// TextureStream.h
+//
+// Uploads big textures to the GPU a horizontal band at a time, spread over several frames, so opening a very large
+// image doesn't stall the UI. Bands go through pixel buffer objects when available so the driver can copy them to
+// VRAM asynchronously. Levels are uploaded smallest first and the texture's base level follows the finest level that
+// is complete, so a blurry version is drawable almost immediately and sharpens as the upload proceeds.
+//
+// Copyright (c) 2021 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <vector>
+#include <chrono>
+#include <glad/glad.h>
+#include <Foundation/tPlatform.h>
+namespace Viewer
+{
+
+
+class TextureStream
+{
+public:
+	// Mipmap levels, largest first. The stream does not own the data. It must stay valid until the stream completes or
+	// is deleted.
+	struct Level
+	{
+		const uint8* Data;
+		int Width;
+		int Height;
+		int NumBytes;
+	};
+
+	// Storage for every level is allocated on the texture immediately, but no pixel data is uploaded until Update is
+	// called. The texture must already be generated. Compressed levels hold 4x4 blocks of the dstFormat and are
+	// uploaded a row of blocks at a time. The src format and type are ignored for them.
+	TextureStream(uint texID, const std::vector<Level>&, GLint srcFormat, GLenum srcType, GLint dstFormat, bool compressed = false);
+	~TextureStream();
+
+	// Small textures upload quickly enough to do in one go.
+	static bool ShouldStream(int numBytes)																				{ return numBytes > StreamThresholdBytes; }
+
+	// Call once per frame. All streams share the per-frame budget.
+	static void BeginFrame(float budgetMilliseconds);
+	static bool AnyActive()																								{ return NumActive > 0; }
+	static bool HasBudget()																								{ return Clock::now() < FrameDeadline; }
+
+	// Uploads bands until the frame's budget is used up. At least one band is uploaded per call so a stream always
+	// makes progress. Returns true if at least one level is complete and the texture can be drawn.
+	bool Update();
+	bool IsComplete() const																								{ return CurrLevel < 0; }
+	bool IsDrawable() const																								{ return CompleteLevel >= 0; }
+	uint GetTexID() const																								{ return TexID; }
+
+private:
+	void UploadBand();
+	void SubImage(const Level&, int y, int height, int numBytes, const uint8* data);
+	int GetNumRows(const Level& level) const																			{ return Compressed ? (level.Height + 3) / 4 : level.Height; }
+
+	// About a millisecond of copying on a typical machine. Big enough that per-band overhead doesn't matter.
+	const static int BandBytes = 4*1024*1024;
+	const static int StreamThresholdBytes = 16*1024*1024;
+	const static int NumBuffers = 2;
+
+	uint TexID						= 0;
+	GLint SrcFormat					= 0;
+	GLenum SrcType					= 0;
+	GLint DstFormat					= 0;
+	bool Compressed					= false;
+	std::vector<Level> Levels;
+	int CurrLevel					= -1;		// Level being uploaded. Counts down to 0 and is -1 when complete.
+	int CurrRow						= 0;		// In blocks for compressed levels.
+	int CompleteLevel				= -1;		// Finest level fully uploaded, or -1.
+
+	// Bands alternate between the buffers. Each is orphaned before being refilled so we never wait on the GPU.
+	bool UseBuffers					= false;
+	uint Buffers[NumBuffers]		= { 0 };
+	int NextBuffer					= 0;
+
+	typedef std::chrono::steady_clock Clock;
+	static Clock::time_point FrameDeadline;
+	static int NumActive;
+};
+
+
+}
@@ -0,0 +1,236 @@
+// ThumbnailAtlas.cpp
+//
+// Packs thumbnails into a few large textures so the content view can draw them with one draw call per page instead
+// of one per thumbnail. Each page is a grid of equal slots sized for one thumbnail pyramid level. When there is no
+// room the least recently drawn slot is reused.
+//
+// Copyright (c) 2021 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <glad/glad.h>
+#include "ThumbnailAtlas.h"
+#include "Image.h"
+using namespace tMath;
+using namespace tImage;
+using namespace Viewer;
+
+
+void ThumbnailAtlas::InitPage(Page& page, int level)
+{
+	page.Level = level;
+	page.SlotWidth = Image::ThumbWidth >> level;
+	page.SlotHeight = Image::ThumbHeight >> level;
+	page.Columns = PageSize / page.SlotWidth;
+	int rows = PageSize / page.SlotHeight;
+
+	// Reusing a page for another level empties every slot, which invalidates all handles into it.
+	page.Slots.assign(page.Columns * rows, Slot());
+	page.NumOccupied = 0;
+
+	if (page.TexID == 0)
+	{
+		glGenTextures(1, &page.TexID);
+		glBindTexture(GL_TEXTURE_2D, page.TexID);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, PageSize, PageSize, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+	}
+}
+
+
+bool ThumbnailAtlas::FindFreeSlot(int level, int& pageIndex, int& slotIndex)
+{
+	for (int p = 0; p < int(Pages.size()); p++)
+	{
+		Page& page = Pages[p];
+		if ((page.Level != level) || (page.NumOccupied >= int(page.Slots.size())))
+			continue;
+
+		for (int s = 0; s < int(page.Slots.size()); s++)
+		{
+			if (!page.Slots[s].Occupied)
+			{
+				pageIndex = p;
+				slotIndex = s;
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+
+bool ThumbnailAtlas::FindEvictableSlot(int level, int& pageIndex, int& slotIndex)
+{
+	uint64 oldest = Frame;
+	for (int p = 0; p < int(Pages.size()); p++)
+	{
+		Page& page = Pages[p];
+		if (page.Level != level)
+			continue;
+
+		for (int s = 0; s < int(page.Slots.size()); s++)
+		{
+			if (page.Slots[s].LastUsed < oldest)
+			{
+				oldest = page.Slots[s].LastUsed;
+				pageIndex = p;
+				slotIndex = s;
+			}
+		}
+	}
+
+	return oldest < Frame;
+}
+
+
+bool ThumbnailAtlas::FindEvictablePage(int& pageIndex)
+{
+	// A page is only recycled for another level if none of its slots were drawn this frame. Prefer the page that has
+	// gone longest without being drawn.
+	uint64 oldest = Frame;
+	for (int p = 0; p < int(Pages.size()); p++)
+	{
+		uint64 newest = 0;
+		for (const Slot& slot : Pages[p].Slots)
+			newest = tMax(newest, slot.LastUsed);
+
+		if (newest < oldest)
+		{
+			oldest = newest;
+			pageIndex = p;
+		}
+	}
+
+	return oldest < Frame;
+}
+
+
+ThumbnailAtlas::Handle ThumbnailAtlas::Add(const tPicture& picture, int level)
+{
+	Handle handle;
+	if (!picture.IsValid() || (level < 0) || (level >= Image::NumThumbLevels))
+		return handle;
+
+	int w = picture.GetWidth();
+	int h = picture.GetHeight();
+	if ((w > (Image::ThumbWidth >> level)) || (h > (Image::ThumbHeight >> level)))
+		return handle;
+
+	int pageIndex = -1;
+	int slotIndex = -1;
+	if (!FindFreeSlot(level, pageIndex, slotIndex))
+	{
+		if (int(Pages.size()) < MaxPages)
+		{
+			Pages.push_back(Page());
+			pageIndex = int(Pages.size()) - 1;
+			InitPage(Pages[pageIndex], level);
+			slotIndex = 0;
+		}
+		else if (FindEvictableSlot(level, pageIndex, slotIndex))
+		{
+			Pages[pageIndex].Slots[slotIndex].Occupied = false;
+			Pages[pageIndex].NumOccupied--;
+		}
+		else if (FindEvictablePage(pageIndex))
+		{
+			InitPage(Pages[pageIndex], level);
+			slotIndex = 0;
+		}
+		else
+		{
+			return handle;
+		}
+	}
+
+	Page& page = Pages[pageIndex];
+	Slot& slot = page.Slots[slotIndex];
+	slot.Occupied = true;
+	slot.Generation = NextGeneration++;
+	slot.Width = w;
+	slot.Height = h;
+	slot.LastUsed = Frame;
+	page.NumOccupied++;
+
+	int x = (slotIndex % page.Columns) * page.SlotWidth;
+	int y = (slotIndex / page.Columns) * page.SlotHeight;
+	glBindTexture(GL_TEXTURE_2D, page.TexID);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, w, h, GL_RGBA, GL_UNSIGNED_BYTE, picture.GetPixels());
+
+	handle.Page = pageIndex;
+	handle.Slot = slotIndex;
+	handle.Generation = slot.Generation;
+	return handle;
+}
+
+
+bool ThumbnailAtlas::IsValid(const Handle& handle) const
+{
+	if ((handle.Page < 0) || (handle.Page >= int(Pages.size())))
+		return false;
+
+	const Page& page = Pages[handle.Page];
+	if ((handle.Slot < 0) || (handle.Slot >= int(page.Slots.size())))
+		return false;
+
+	const Slot& slot = page.Slots[handle.Slot];
+	return slot.Occupied && (slot.Generation == handle.Generation);
+}
+
+
+void ThumbnailAtlas::Remove(Handle& handle)
+{
+	if (IsValid(handle))
+	{
+		Page& page = Pages[handle.Page];
+		Slot& slot = page.Slots[handle.Slot];
+		slot.Occupied = false;
+		slot.LastUsed = 0;
+		page.NumOccupied--;
+	}
+	handle = Handle();
+}
+
+
+uint64 ThumbnailAtlas::Use(const Handle& handle, tVector2& uv0, tVector2& uv1)
+{
+	if (!IsValid(handle))
+		return 0;
+
+	Page& page = Pages[handle.Page];
+	Slot& slot = page.Slots[handle.Slot];
+	slot.LastUsed = Frame;
+
+	// Inset by half a texel so linear filtering never reads a neighbouring slot.
+	float x = float((handle.Slot % page.Columns) * page.SlotWidth);
+	float y = float((handle.Slot / page.Columns) * page.SlotHeight);
+	float scale = 1.0f / float(PageSize);
+	float u0 = (x + 0.5f) * scale;
+	float u1 = (x + float(slot.Width) - 0.5f) * scale;
+	float v0 = (y + 0.5f) * scale;
+	float v1 = (y + float(slot.Height) - 0.5f) * scale;
+	uv0.x = u0; uv0.y = v1;
+	uv1.x = u1; uv1.y = v0;
+	return page.TexID;
+}
+
+
+void ThumbnailAtlas::Clear()
+{
+	for (Page& page : Pages)
+		if (page.TexID != 0)
+			glDeleteTextures(1, &page.TexID);
+	Pages.clear();
+}
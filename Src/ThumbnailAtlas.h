@@ -0,0 +1,95 @@
+// ThumbnailAtlas.h
+//
+// Packs thumbnails into a few large textures so the content view can draw them with one draw call per page instead
+// of one per thumbnail. Each page is a grid of equal slots sized for one thumbnail pyramid level. When there is no
+// room the least recently drawn slot is reused.
+//
+// Copyright (c) 2021 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <vector>
+#include <Foundation/tPlatform.h>
+#include <Math/tVector2.h>
+#include <Image/tPicture.h>
+namespace Viewer
+{
+
+
+class ThumbnailAtlas
+{
+public:
+	ThumbnailAtlas()																									{ }
+
+	// Does not free the textures. Call Clear while the GL context is still current.
+	~ThumbnailAtlas()																									{ }
+
+	const static int PageSize = 2048;
+	const static int MaxPages = 6;
+
+	// A handle stays valid until the slot is removed or evicted. Every allocation gets a new generation so a stale
+	// handle is detected rather than drawing someone else's thumbnail.
+	struct Handle
+	{
+		int Page			= -1;
+		int Slot			= -1;
+		uint32 Generation	= 0;
+	};
+
+	// Call once per frame before any Use calls. Slots used in the current frame are never evicted.
+	void BeginFrame()																									{ Frame++; }
+
+	// Uploads the picture into a free slot for the given pyramid level. Returns an invalid handle if the picture is
+	// too big for the level's slots or every candidate slot was drawn this frame.
+	Handle Add(const tImage::tPicture&, int level);
+	bool IsValid(const Handle&) const;
+	void Remove(Handle&);
+
+	// Marks the slot as drawn this frame and returns the page texture ID along with the slot's UVs. The UVs are
+	// flipped vertically to match tPicture's bottom-up rows, so uv0 is the top-left corner for drawing.
+	uint64 Use(const Handle&, tMath::tVector2& uv0, tMath::tVector2& uv1);
+
+	// Deletes all page textures. Outstanding handles become invalid.
+	void Clear();
+	int GetNumPages() const																								{ return int(Pages.size()); }
+
+private:
+	struct Slot
+	{
+		uint32 Generation	= 0;
+		uint64 LastUsed		= 0;
+		bool Occupied		= false;
+		int Width			= 0;
+		int Height			= 0;
+	};
+
+	struct Page
+	{
+		uint TexID			= 0;
+		int Level			= 0;
+		int SlotWidth		= 0;
+		int SlotHeight		= 0;
+		int Columns			= 0;
+		int NumOccupied		= 0;
+		std::vector<Slot> Slots;
+	};
+
+	void InitPage(Page&, int level);
+	bool FindFreeSlot(int level, int& page, int& slot);
+	bool FindEvictableSlot(int level, int& page, int& slot);
+	bool FindEvictablePage(int& page);
+
+	std::vector<Page> Pages;
+	uint64 Frame = 1;
+	uint32 NextGeneration = 1;
+};
+
+
+}
@@ -0,0 +1,738 @@
+// ThumbnailCache.cpp
+//
+// A single packed store for cached thumbnails. Entries are appended to a pack file and found through a memory-mapped
+// open-addressing hash index keyed by the 256-bit thumbnail hash. A lookup is one probe into the index plus one read
+// from the pack. Several viewer processes may share the same cache directory. A lock file serializes writers across
+// processes and a shared mutex does the same between threads of one process.
+//
+// Copyright (c) 2021 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <ctime>
+#include <cstring>
+#include <algorithm>
+#ifdef PLATFORM_WINDOWS
+#include <Windows.h>
+#endif
+#ifdef PLATFORM_LINUX
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cerrno>
+#endif
+#include <Foundation/tFundamentals.h>
+#include <System/tFile.h>
+#include <System/tPrint.h>
+#include "ThumbnailCache.h"
+using namespace tMath;
+using namespace Viewer;
+
+
+namespace Viewer
+{
+	const uint32 ThumbCacheIndexMagic	= 0x58444E49;	// 'INDX'
+	const uint32 ThumbCacheRecordMagic	= 0x43455254;	// 'TREC'
+	const uint32 ThumbCacheVersion		= 1;
+	const uint32 ThumbCacheMinSlots		= 8192;
+	const char* ThumbCachePackName		= "Thumbnails.pack";
+	const char* ThumbCacheIndexName		= "Thumbnails.index";
+	const char* ThumbCacheLockName		= "Thumbnails.lock";
+
+	// Thin wrappers over the platform file API. Offsets are 64-bit since the pack can exceed 4GB.
+	namespace CacheFile
+	{
+		#ifdef PLATFORM_WINDOWS
+		typedef HANDLE Handle;
+		const Handle Invalid = INVALID_HANDLE_VALUE;
+		#else
+		typedef int Handle;
+		const Handle Invalid = -1;
+		#endif
+
+		Handle Open(const tString& path);
+		void Close(Handle);
+		bool ReadAt(Handle, uint64 offset, void* dest, uint64 numBytes);
+		bool WriteAt(Handle, uint64 offset, const void* src, uint64 numBytes);
+		uint64 GetSize(Handle);
+		bool SetSize(Handle, uint64 size);
+		void Lock(Handle, bool exclusive);
+		void Unlock(Handle);
+	}
+
+	// Readers only hold the shared lock, so the access time they write must be an atomic store. It's a hint for
+	// eviction, so relaxed ordering is enough. The slots are 8-byte aligned in the mapping.
+	void StoreRelaxed(uint64& dest, uint64 value);
+}
+
+
+void Viewer::StoreRelaxed(uint64& dest, uint64 value)
+{
+	#ifdef PLATFORM_WINDOWS
+	InterlockedExchange64((volatile LONG64*)&dest, LONG64(value));
+	#else
+	__atomic_store_n(&dest, value, __ATOMIC_RELAXED);
+	#endif
+}
+
+
+#ifdef PLATFORM_WINDOWS
+
+
+CacheFile::Handle CacheFile::Open(const tString& path)
+{
+	return CreateFileA
+	(
+		path.Chars(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr
+	);
+}
+
+
+void CacheFile::Close(Handle file)
+{
+	if (file != Invalid)
+		CloseHandle(file);
+}
+
+
+bool CacheFile::ReadAt(Handle file, uint64 offset, void* dest, uint64 numBytes)
+{
+	uint8* dst = (uint8*)dest;
+	while (numBytes > 0)
+	{
+		OVERLAPPED ov = { };
+		ov.Offset = DWORD(offset & 0xFFFFFFFF);
+		ov.OffsetHigh = DWORD(offset >> 32);
+		DWORD chunk = DWORD(tMin(numBytes, uint64(0x40000000)));
+		DWORD numRead = 0;
+		if (!ReadFile(file, dst, chunk, &numRead, &ov) || (numRead == 0))
+			return false;
+		dst += numRead; offset += numRead; numBytes -= numRead;
+	}
+	return true;
+}
+
+
+bool CacheFile::WriteAt(Handle file, uint64 offset, const void* src, uint64 numBytes)
+{
+	const uint8* s = (const uint8*)src;
+	while (numBytes > 0)
+	{
+		OVERLAPPED ov = { };
+		ov.Offset = DWORD(offset & 0xFFFFFFFF);
+		ov.OffsetHigh = DWORD(offset >> 32);
+		DWORD chunk = DWORD(tMin(numBytes, uint64(0x40000000)));
+		DWORD numWritten = 0;
+		if (!WriteFile(file, s, chunk, &numWritten, &ov) || (numWritten == 0))
+			return false;
+		s += numWritten; offset += numWritten; numBytes -= numWritten;
+	}
+	return true;
+}
+
+
+uint64 CacheFile::GetSize(Handle file)
+{
+	LARGE_INTEGER size;
+	return GetFileSizeEx(file, &size) ? uint64(size.QuadPart) : 0;
+}
+
+
+bool CacheFile::SetSize(Handle file, uint64 size)
+{
+	LARGE_INTEGER pos; pos.QuadPart = LONGLONG(size);
+	return SetFilePointerEx(file, pos, nullptr, FILE_BEGIN) && SetEndOfFile(file);
+}
+
+
+void CacheFile::Lock(Handle file, bool exclusive)
+{
+	OVERLAPPED ov = { };
+	LockFileEx(file, exclusive ? LOCKFILE_EXCLUSIVE_LOCK : 0, 0, MAXDWORD, MAXDWORD, &ov);
+}
+
+
+void CacheFile::Unlock(Handle file)
+{
+	OVERLAPPED ov = { };
+	UnlockFileEx(file, 0, MAXDWORD, MAXDWORD, &ov);
+}
+
+
+#else
+
+
+CacheFile::Handle CacheFile::Open(const tString& path)
+{
+	return open(path.Chars(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+}
+
+
+void CacheFile::Close(Handle file)
+{
+	if (file != Invalid)
+		close(file);
+}
+
+
+bool CacheFile::ReadAt(Handle file, uint64 offset, void* dest, uint64 numBytes)
+{
+	uint8* dst = (uint8*)dest;
+	while (numBytes > 0)
+	{
+		ssize_t numRead = pread(file, dst, size_t(numBytes), off_t(offset));
+		if ((numRead < 0) && (errno == EINTR))
+			continue;
+		if (numRead <= 0)
+			return false;
+		dst += numRead; offset += numRead; numBytes -= numRead;
+	}
+	return true;
+}
+
+
+bool CacheFile::WriteAt(Handle file, uint64 offset, const void* src, uint64 numBytes)
+{
+	const uint8* s = (const uint8*)src;
+	while (numBytes > 0)
+	{
+		ssize_t numWritten = pwrite(file, s, size_t(numBytes), off_t(offset));
+		if ((numWritten < 0) && (errno == EINTR))
+			continue;
+		if (numWritten <= 0)
+			return false;
+		s += numWritten; offset += numWritten; numBytes -= numWritten;
+	}
+	return true;
+}
+
+
+uint64 CacheFile::GetSize(Handle file)
+{
+	struct stat info;
+	return (fstat(file, &info) == 0) ? uint64(info.st_size) : 0;
+}
+
+
+bool CacheFile::SetSize(Handle file, uint64 size)
+{
+	return ftruncate(file, off_t(size)) == 0;
+}
+
+
+void CacheFile::Lock(Handle file, bool exclusive)
+{
+	while ((flock(file, exclusive ? LOCK_EX : LOCK_SH) != 0) && (errno == EINTR)) { }
+}
+
+
+void CacheFile::Unlock(Handle file)
+{
+	flock(file, LOCK_UN);
+}
+
+
+#endif
+
+
+bool ThumbnailCache::Open(const tString& cacheDir)
+{
+	if (IsOpen())
+		return true;
+
+	tStaticAssert(sizeof(IndexHeader) == 64);
+	tStaticAssert(sizeof(tuint256) == KeySize);
+	Dir = cacheDir;
+	bool createdIndex = !tSystem::tFileExists(Dir + ThumbCacheIndexName);
+	LockHandle	= CacheFile::Open(Dir + ThumbCacheLockName);
+	PackFile	= CacheFile::Open(Dir + ThumbCachePackName);
+	IndexFile	= CacheFile::Open(Dir + ThumbCacheIndexName);
+	FilesOpen = true;
+	if ((LockHandle == CacheFile::Invalid) || (PackFile == CacheFile::Invalid) || (IndexFile == CacheFile::Invalid))
+	{
+		tPrintf("Warning: Unable to open thumbnail cache in %s\n", Dir.Chars());
+		Close();
+		return false;
+	}
+
+	// Another process may be creating or growing the index, so validation happens under the exclusive lock.
+	std::unique_lock<std::shared_mutex> lock(Mutex);
+	LockExclusive();
+	uint64 indexSize = CacheFile::GetSize(IndexFile);
+	IndexHeader existing;
+	bool valid =
+		(indexSize >= sizeof(IndexHeader)) && CacheFile::ReadAt(IndexFile, 0, &existing, sizeof(IndexHeader)) &&
+		(existing.Magic == ThumbCacheIndexMagic) && (existing.Version == ThumbCacheVersion) && !existing.Compacting &&
+		(existing.NumSlots >= ThumbCacheMinSlots) && ((existing.NumSlots & (existing.NumSlots-1)) == 0) &&
+		(indexSize >= sizeof(IndexHeader) + uint64(existing.NumSlots)*sizeof(Slot));
+
+	bool ok = MapIndex(valid ? existing.NumSlots : ThumbCacheMinSlots);
+	if (ok && !valid)
+		ResetIndex();
+	UnlockExclusive();
+	lock.unlock();
+
+	if (!ok)
+	{
+		tPrintf("Warning: Unable to map thumbnail cache index in %s\n", Dir.Chars());
+		Close();
+		return false;
+	}
+
+	if (createdIndex)
+	{
+		tList<tStringItem> legacyFiles;
+		tSystem::tFindFiles(legacyFiles, Dir, "bin");
+		for (tStringItem* file = legacyFiles.First(); file; file = file->Next())
+			tSystem::tDeleteFile(*file);
+	}
+
+	return true;
+}
+
+
+void ThumbnailCache::Close()
+{
+	std::unique_lock<std::shared_mutex> lock(Mutex);
+	UnmapIndex();
+	if (!FilesOpen)
+		return;
+
+	CacheFile::Close(IndexFile);
+	CacheFile::Close(PackFile);
+	CacheFile::Close(LockHandle);
+	IndexFile = PackFile = LockHandle = CacheFile::Invalid;
+	FilesOpen = false;
+}
+
+
+bool ThumbnailCache::MapIndex(uint32 numSlots)
+{
+	UnmapIndex();
+	uint64 size = sizeof(IndexHeader) + uint64(numSlots)*sizeof(Slot);
+
+	#ifdef PLATFORM_WINDOWS
+	// Creating a mapping larger than the file extends the file.
+	Mapping = CreateFileMappingA(HANDLE(IndexFile), nullptr, PAGE_READWRITE, DWORD(size >> 32), DWORD(size & 0xFFFFFFFF), nullptr);
+	if (!Mapping)
+		return false;
+	void* data = MapViewOfFile(Mapping, FILE_MAP_ALL_ACCESS, 0, 0, SIZE_T(size));
+	if (!data)
+	{
+		CloseHandle(Mapping);
+		Mapping = nullptr;
+		return false;
+	}
+	#else
+	if ((CacheFile::GetSize(IndexFile) < size) && !CacheFile::SetSize(IndexFile, size))
+		return false;
+	void* data = mmap(nullptr, size_t(size), PROT_READ | PROT_WRITE, MAP_SHARED, IndexFile, 0);
+	if (data == MAP_FAILED)
+		return false;
+	#endif
+
+	Header = (IndexHeader*)data;
+	Slots = (Slot*)(Header + 1);
+	MappedSlots = numSlots;
+	MappedSize = size;
+	return true;
+}
+
+
+void ThumbnailCache::UnmapIndex()
+{
+	if (!Header)
+		return;
+
+	#ifdef PLATFORM_WINDOWS
+	UnmapViewOfFile(Header);
+	CloseHandle(Mapping);
+	Mapping = nullptr;
+	#else
+	munmap(Header, size_t(MappedSize));
+	#endif
+
+	Header = nullptr;
+	Slots = nullptr;
+	MappedSlots = 0;
+	MappedSize = 0;
+}
+
+
+bool ThumbnailCache::RemapIfStale()
+{
+	// Another process grew the index since we mapped it.
+	if (Header && (Header->NumSlots != MappedSlots))
+		return MapIndex(Header->NumSlots);
+	return Header != nullptr;
+}
+
+
+void ThumbnailCache::ResetIndex()
+{
+	tMemset(Header, 0, int(sizeof(IndexHeader)));
+	std::memset(Slots, 0, size_t(MappedSlots)*sizeof(Slot));
+	Header->Magic		= ThumbCacheIndexMagic;
+	Header->Version		= ThumbCacheVersion;
+	Header->NumSlots	= MappedSlots;
+	CacheFile::SetSize(PackFile, 0);
+}
+
+
+void ThumbnailCache::LockShared()
+{
+	std::lock_guard<std::mutex> guard(FileLockMutex);
+	if (FileLockSharedCount++ == 0)
+		CacheFile::Lock(LockHandle, false);
+}
+
+
+void ThumbnailCache::UnlockShared()
+{
+	std::lock_guard<std::mutex> guard(FileLockMutex);
+	if (--FileLockSharedCount == 0)
+		CacheFile::Unlock(LockHandle);
+}
+
+
+void ThumbnailCache::LockExclusive()
+{
+	// The caller holds Mutex exclusively so there are no shared holders in this process.
+	CacheFile::Lock(LockHandle, true);
+}
+
+
+void ThumbnailCache::UnlockExclusive()
+{
+	CacheFile::Unlock(LockHandle);
+}
+
+
+ThumbnailCache::ReadLock::ReadLock(ThumbnailCache& cache) :
+	Cache(cache)
+{
+	while (true)
+	{
+		Cache.Mutex.lock_shared();
+		if (!Cache.Header)
+		{
+			Cache.Mutex.unlock_shared();
+			return;
+		}
+
+		Cache.LockShared();
+		if (Cache.Header->NumSlots == Cache.MappedSlots)
+		{
+			Locked = true;
+			return;
+		}
+
+		// The mapping is stale. Remapping needs the exclusive lock, then we try again.
+		Cache.UnlockShared();
+		Cache.Mutex.unlock_shared();
+		WriteLock remap(Cache);
+	}
+}
+
+
+ThumbnailCache::ReadLock::~ReadLock()
+{
+	if (!Locked)
+		return;
+
+	Cache.UnlockShared();
+	Cache.Mutex.unlock_shared();
+}
+
+
+ThumbnailCache::WriteLock::WriteLock(ThumbnailCache& cache) :
+	Cache(cache)
+{
+	Cache.Mutex.lock();
+	if (!Cache.Header)
+	{
+		Cache.Mutex.unlock();
+		return;
+	}
+
+	Cache.LockExclusive();
+	if (!Cache.RemapIfStale())
+	{
+		Cache.UnlockExclusive();
+		Cache.Mutex.unlock();
+		return;
+	}
+	Locked = true;
+}
+
+
+ThumbnailCache::WriteLock::~WriteLock()
+{
+	if (!Locked)
+		return;
+
+	Cache.UnlockExclusive();
+	Cache.Mutex.unlock();
+}
+
+
+int ThumbnailCache::FindSlot(const uint8* key) const
+{
+	// The key is already a good hash so the low bits index directly. Linear probing with backward-shift deletion
+	// means an empty slot always ends the probe sequence.
+	uint64 h; tMemcpy(&h, key, sizeof(h));
+	uint32 mask = MappedSlots - 1;
+	for (uint32 i = uint32(h) & mask, n = 0; n < MappedSlots; i = (i + 1) & mask, n++)
+	{
+		const Slot& slot = Slots[i];
+		if (!slot.Used)
+			return -1;
+		if (tMemcmp(slot.Key, key, KeySize) == 0)
+			return int(i);
+	}
+	return -1;
+}
+
+
+int ThumbnailCache::FindInsertSlot(const uint8* key) const
+{
+	uint64 h; tMemcpy(&h, key, sizeof(h));
+	uint32 mask = MappedSlots - 1;
+	for (uint32 i = uint32(h) & mask, n = 0; n < MappedSlots; i = (i + 1) & mask, n++)
+	{
+		const Slot& slot = Slots[i];
+		if (!slot.Used || (tMemcmp(slot.Key, key, KeySize) == 0))
+			return int(i);
+	}
+	return -1;
+}
+
+
+void ThumbnailCache::RemoveSlot(int index)
+{
+	// Backward-shift deletion. Move later entries of the same cluster back into the hole if their home slot allows it.
+	uint32 mask = MappedSlots - 1;
+	uint32 hole = uint32(index);
+	Header->DeadBytes += sizeof(RecordHeader) + Slots[hole].Size;
+	Header->NumEntries--;
+	for (uint32 i = (hole + 1) & mask; Slots[i].Used; i = (i + 1) & mask)
+	{
+		uint64 h; tMemcpy(&h, Slots[i].Key, sizeof(h));
+		uint32 home = uint32(h) & mask;
+
+		// The entry can move to the hole if the hole lies cyclically in [home, i).
+		bool canMove = (hole <= i) ? ((home <= hole) || (home > i)) : ((home <= hole) && (home > i));
+		if (canMove)
+		{
+			Slots[hole] = Slots[i];
+			hole = i;
+		}
+	}
+	tMemset(&Slots[hole], 0, int(sizeof(Slot)));
+}
+
+
+bool ThumbnailCache::Grow()
+{
+	std::vector<Slot> entries;
+	entries.reserve(Header->NumEntries);
+	for (uint32 s = 0; s < MappedSlots; s++)
+		if (Slots[s].Used)
+			entries.push_back(Slots[s]);
+
+	uint32 numSlots = MappedSlots * 2;
+	if (!MapIndex(numSlots))
+		return false;
+
+	Header->NumSlots = numSlots;
+	std::memset(Slots, 0, size_t(numSlots)*sizeof(Slot));
+	for (const Slot& entry : entries)
+		Slots[FindInsertSlot(entry.Key)] = entry;
+
+	return true;
+}
+
+
+bool ThumbnailCache::Get(const tuint256& key, std::vector<uint8>& data)
+{
+	ReadLock lock(*this);
+	if (!lock.Locked)
+		return false;
+
+	int index = FindSlot((const uint8*)&key);
+	if (index < 0)
+		return false;
+
+	Slot& slot = Slots[index];
+	data.resize(sizeof(RecordHeader) + slot.Size);
+	if (!CacheFile::ReadAt(PackFile, slot.Offset, data.data(), data.size()))
+		return false;
+
+	const RecordHeader* record = (const RecordHeader*)data.data();
+	if ((record->Magic != ThumbCacheRecordMagic) || (record->Size != slot.Size) || tMemcmp(record->Key, &key, KeySize))
+		return false;
+
+	// Concurrent readers may overwrite each other's time. It only steers eviction so a lost update doesn't matter.
+	StoreRelaxed(slot.LastAccess, uint64(std::time(nullptr)));
+	data.erase(data.begin(), data.begin() + sizeof(RecordHeader));
+	return true;
+}
+
+
+bool ThumbnailCache::Contains(const tuint256& key)
+{
+	ReadLock lock(*this);
+	return lock.Locked && (FindSlot((const uint8*)&key) >= 0);
+}
+
+
+int ThumbnailCache::GetNumEntries()
+{
+	ReadLock lock(*this);
+	return lock.Locked ? int(Header->NumEntries) : 0;
+}
+
+
+uint64 ThumbnailCache::GetDiskSize()
+{
+	ReadLock lock(*this);
+	return lock.Locked ? (Header->PackSize + MappedSize) : 0;
+}
+
+
+bool ThumbnailCache::Put(const tuint256& key, const uint8* data, int numBytes)
+{
+	if (!data || (numBytes <= 0))
+		return false;
+
+	WriteLock lock(*this);
+	if (!lock.Locked)
+		return false;
+
+	// Keep the load factor at or under a half.
+	if (((Header->NumEntries + 1) * 2 > MappedSlots) && !Grow())
+		return false;
+
+	// Append the record first. If we crash before the index is updated the bytes past PackSize get overwritten later.
+	RecordHeader record;
+	record.Magic = ThumbCacheRecordMagic;
+	record.Size = uint32(numBytes);
+	tMemcpy(record.Key, &key, KeySize);
+	uint64 offset = Header->PackSize;
+	if
+	(
+		!CacheFile::WriteAt(PackFile, offset, &record, sizeof(RecordHeader)) ||
+		!CacheFile::WriteAt(PackFile, offset + sizeof(RecordHeader), data, uint64(numBytes))
+	)
+		return false;
+
+	int index = FindInsertSlot(record.Key);
+	Slot& slot = Slots[index];
+	if (slot.Used)
+		Header->DeadBytes += sizeof(RecordHeader) + slot.Size;
+	else
+		Header->NumEntries++;
+
+	tMemcpy(slot.Key, record.Key, KeySize);
+	slot.Offset = offset;
+	slot.Size = uint32(numBytes);
+	slot.Used = 1;
+	slot.LastAccess = uint64(std::time(nullptr));
+	Header->PackSize = offset + sizeof(RecordHeader) + uint64(numBytes);
+	return true;
+}
+
+
+int ThumbnailCache::Maintain(int maxEntries)
+{
+	WriteLock lock(*this);
+	if (!lock.Locked)
+		return 0;
+
+	// Evict least recently used down to 100 below the limit so we don't end up doing this every time.
+	int numEvicted = 0;
+	if (int(Header->NumEntries) > maxEntries)
+	{
+		std::vector<std::pair<uint64, int>> byAccess;
+		for (uint32 s = 0; s < MappedSlots; s++)
+			if (Slots[s].Used)
+				byAccess.push_back(std::make_pair(Slots[s].LastAccess, int(s)));
+		std::sort(byAccess.begin(), byAccess.end());
+
+		// Removing shifts entries, so evict by key rather than by slot index.
+		int target = tClampMin(maxEntries - 100, 0);
+		int numToEvict = int(Header->NumEntries) - target;
+		std::vector<tuint256> evict;
+		for (int e = 0; e < numToEvict; e++)
+		{
+			tuint256 key;
+			tMemcpy(&key, Slots[byAccess[e].second].Key, KeySize);
+			evict.push_back(key);
+		}
+
+		for (const tuint256& key : evict)
+		{
+			int index = FindSlot((const uint8*)&key);
+			if (index >= 0)
+			{
+				RemoveSlot(index);
+				numEvicted++;
+			}
+		}
+	}
+
+	// Compact once a quarter of the pack is dead.
+	if ((Header->DeadBytes > 0) && (Header->DeadBytes*4 >= Header->PackSize))
+		Compact();
+
+	return numEvicted;
+}
+
+
+void ThumbnailCache::Compact()
+{
+	// Live records are slid down over the dead space in offset order. Records only ever move towards the start of the
+	// file so nothing is overwritten before it is copied. The Compacting flag makes a crash here reset the store on
+	// the next open rather than leave the index pointing at moved data.
+	Header->Compacting = 1;
+
+	std::vector<std::pair<uint64, uint32>> byOffset;
+	for (uint32 s = 0; s < MappedSlots; s++)
+		if (Slots[s].Used)
+			byOffset.push_back(std::make_pair(Slots[s].Offset, s));
+	std::sort(byOffset.begin(), byOffset.end());
+
+	std::vector<uint8> buffer;
+	uint64 writePos = 0;
+	for (const auto& entry : byOffset)
+	{
+		Slot& slot = Slots[entry.second];
+		uint64 recordSize = sizeof(RecordHeader) + slot.Size;
+		if (slot.Offset != writePos)
+		{
+			buffer.resize(size_t(recordSize));
+			if (!CacheFile::ReadAt(PackFile, slot.Offset, buffer.data(), recordSize) || !CacheFile::WriteAt(PackFile, writePos, buffer.data(), recordSize))
+			{
+				tPrintf("Warning: Thumbnail cache compaction failed. Resetting cache.\n");
+				ResetIndex();
+				return;
+			}
+			slot.Offset = writePos;
+		}
+		writePos += recordSize;
+	}
+
+	Header->PackSize = writePos;
+	Header->DeadBytes = 0;
+	CacheFile::SetSize(PackFile, writePos);
+	Header->Compacting = 0;
+}
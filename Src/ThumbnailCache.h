@@ -0,0 +1,142 @@
+// ThumbnailCache.h
+//
+// A single packed store for cached thumbnails. Entries are appended to a pack file and found through a memory-mapped
+// open-addressing hash index keyed by the 256-bit thumbnail hash. A lookup is one probe into the index plus one read
+// from the pack. Several viewer processes may share the same cache directory. A lock file serializes writers across
+// processes and a shared mutex does the same between threads of one process.
+//
+// Copyright (c) 2021 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
+#include <Foundation/tString.h>
+#include <Foundation/tFixInt.h>
+namespace Viewer
+{
+
+
+class ThumbnailCache
+{
+public:
+	ThumbnailCache()																									{ }
+	~ThumbnailCache()																									{ Close(); }
+
+	// Opens (creating if necessary) the store in cacheDir. The directory must exist. Legacy one-file-per-thumbnail
+	// .bin files are removed the first time the store is created.
+	bool Open(const tString& cacheDir);
+	void Close();
+	bool IsOpen() const																									{ return Header != nullptr; }
+
+	// All of these are thread-safe. Get fills data with the entry payload and marks it as recently used.
+	bool Get(const tuint256& key, std::vector<uint8>& data);
+	bool Contains(const tuint256& key);
+	bool Put(const tuint256& key, const uint8* data, int numBytes);
+	int GetNumEntries();
+
+	// Evicts least recently accessed entries when there are more than maxEntries, and compacts the pack file when
+	// enough of it is dead. Returns the number of entries evicted.
+	int Maintain(int maxEntries);
+
+	// Rough on-disk size of the store in bytes (pack plus index).
+	uint64 GetDiskSize();
+
+private:
+	#ifdef PLATFORM_WINDOWS
+	typedef void* FileHandle;
+	#else
+	typedef int FileHandle;
+	#endif
+
+	const static int KeySize = 32;
+	struct IndexHeader
+	{
+		uint32 Magic;
+		uint32 Version;
+		uint32 NumSlots;
+		uint32 NumEntries;
+		uint64 PackSize;			// Bytes of the pack file in use. Anything after this is garbage from a crashed writer.
+		uint64 DeadBytes;			// Bytes in the pack owned by overwritten or evicted entries.
+		uint32 Compacting;			// Non-zero while a compaction is in progress. If set on open the store is reset.
+		uint32 Pad[7];
+	};
+
+	struct Slot
+	{
+		uint8 Key[KeySize];
+		uint64 Offset;				// Offset of the record header in the pack.
+		uint32 Size;				// Payload size in bytes.
+		uint32 Used;
+		uint64 LastAccess;			// Seconds since epoch. Only a hint for eviction.
+	};
+
+	// Each pack record is a RecordHeader followed by the payload. The header lets Get verify the read.
+	struct RecordHeader
+	{
+		uint32 Magic;
+		uint32 Size;
+		uint8 Key[KeySize];
+	};
+
+	// These helpers must be called with the appropriate lock held.
+	int FindSlot(const uint8* key) const;									// Returns -1 if not found.
+	int FindInsertSlot(const uint8* key) const;							// Returns the matching or first empty slot.
+	void RemoveSlot(int index);
+	bool Grow();
+	bool MapIndex(uint32 numSlots);
+	void UnmapIndex();
+	bool RemapIfStale();
+	void ResetIndex();
+	void Compact();
+
+	void LockShared();
+	void UnlockShared();
+	void LockExclusive();
+	void UnlockExclusive();
+
+	struct ReadLock
+	{
+		ReadLock(ThumbnailCache&);
+		~ReadLock();
+		ThumbnailCache& Cache;
+		bool Locked = false;
+	};
+	struct WriteLock
+	{
+		WriteLock(ThumbnailCache&);
+		~WriteLock();
+		ThumbnailCache& Cache;
+		bool Locked = false;
+	};
+
+	tString Dir;
+	FileHandle PackFile;
+	FileHandle IndexFile;
+	FileHandle LockHandle;
+	bool FilesOpen						= false;
+	IndexHeader* Header					= nullptr;
+	Slot* Slots							= nullptr;
+	uint32 MappedSlots					= 0;
+	uint64 MappedSize					= 0;
+	#ifdef PLATFORM_WINDOWS
+	void* Mapping						= nullptr;
+	#endif
+
+	// The in-process mutex guards the mapping and keeps threads from fighting over the OS file lock. Shared file locks
+	// are counted because they belong to the file handle, not the thread.
+	std::shared_mutex Mutex;
+	std::mutex FileLockMutex;
+	int FileLockSharedCount				= 0;
+};
+
+
+}
@@ -0,0 +1,264 @@
+// TiledTexture.cpp
+//
+// Draws pictures that are bigger than the largest texture the driver supports. The picture and each of its mipmap
+// levels are split into tiles, each with its own texture, and only the tiles covering the visible part of the image at
+// the level being drawn are kept on the GPU.
+//
+// Copyright (c) 2021 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <glad/glad.h>
+#include <Foundation/tFundamentals.h>
+#include "TiledTexture.h"
+using namespace tMath;
+using namespace Viewer;
+
+
+int TiledTexture::MaxTextureSize = 0;
+bool TiledTexture::Pending = false;
+
+
+TiledTexture::~TiledTexture()
+{
+	for (Tile& tile : Tiles)
+		glDeleteTextures(1, &tile.TexID);
+}
+
+
+bool TiledTexture::NeedsTiling(int width, int height)
+{
+	if (MaxTextureSize <= 0)
+	{
+		// Headless runs never load GL.
+		if (!glGetIntegerv)
+			return false;
+
+		glGetIntegerv(GL_MAX_TEXTURE_SIZE, &MaxTextureSize);
+		if (MaxTextureSize <= 0)
+			return false;
+	}
+
+	return (width > MaxTextureSize) || (height > MaxTextureSize);
+}
+
+
+int TiledTexture::GetFallbackLevel() const
+{
+	int numLevels = int(Levels.size());
+	for (int level = 0; level < numLevels; level++)
+		if ((Levels[level].Width <= TileSize) && (Levels[level].Height <= TileSize))
+			return level;
+
+	return numLevels - 1;
+}
+
+
+void TiledTexture::Draw(float left, float right, float bottom, float top, float u0, float v0, float u1, float v1, bool repeat)
+{
+	Frame++;
+	NumUploads = 0;
+	Pending = false;
+	if (Levels.empty() || (u1 <= u0) || (v1 <= v0) || (right <= left) || (top <= bottom))
+		return;
+
+	View view;
+	view.Left		= left;
+	view.Bottom		= bottom;
+	view.U0			= u0;
+	view.V0			= v0;
+	view.PixelsPerU	= (right-left) / (u1-u0);
+	view.PixelsPerV	= (top-bottom) / (v1-v0);
+
+	// Like GL_LINEAR_MIPMAP_NEAREST, a level is picked once there are more than root 2 texels per pixel.
+	int numLevels = int(Levels.size());
+	float texelsPerPixel = tMin(float(Levels[0].Width) / view.PixelsPerU, float(Levels[0].Height) / view.PixelsPerV);
+	int level = 0;
+	while ((level < numLevels-1) && (texelsPerPixel > 1.41421356f))
+	{
+		texelsPerPixel *= 0.5f;
+		level++;
+	}
+
+	// The whole image at the fallback level fits in one tile. It is always kept so there is something to draw while
+	// finer tiles load, and it is uploaded whatever the budget.
+	int fallback = GetFallbackLevel();
+	if ((GetNumTilesX(fallback) == 1) && (GetNumTilesY(fallback) == 1))
+	{
+		Tile* tile = FindTile(fallback, 0, 0);
+		if (!tile)
+			tile = MakeResident(fallback, 0, 0);
+		if (tile)
+			tile->LastUsed = Frame;
+	}
+
+	// With repeat on every whole-number offset of the uvs is another copy of the image.
+	int repeatX0 = 0;	int repeatX1 = 0;
+	int repeatY0 = 0;	int repeatY1 = 0;
+	if (repeat)
+	{
+		repeatX0 = int(tFloor(u0));		repeatX1 = tMin(int(tCeiling(u1)) - 1, repeatX0 + MaxRepeats - 1);
+		repeatY0 = int(tFloor(v0));		repeatY1 = tMin(int(tCeiling(v1)) - 1, repeatY0 + MaxRepeats - 1);
+	}
+
+	for (int ry = repeatY0; ry <= repeatY1; ry++)
+	{
+		for (int rx = repeatX0; rx <= repeatX1; rx++)
+		{
+			float ua = tMax(u0 - float(rx), 0.0f);		float ub = tMin(u1 - float(rx), 1.0f);
+			float va = tMax(v0 - float(ry), 0.0f);		float vb = tMin(v1 - float(ry), 1.0f);
+			if ((ua < ub) && (va < vb))
+				DrawRegion(view, level, ua, va, ub, vb, float(rx), float(ry));
+		}
+	}
+
+	EvictUnused();
+}
+
+
+void TiledTexture::DrawRegion(const View& view, int level, float ua, float va, float ub, float vb, float repeatU, float repeatV)
+{
+	const TextureStream::Level& lev = Levels[level];
+	float levW = float(lev.Width);
+	float levH = float(lev.Height);
+	int x0 = tClamp(int(ua*levW) / TileSize, 0, GetNumTilesX(level)-1);
+	int x1 = tClamp((int(tCeiling(ub*levW)) - 1) / TileSize, 0, GetNumTilesX(level)-1);
+	int y0 = tClamp(int(va*levH) / TileSize, 0, GetNumTilesY(level)-1);
+	int y1 = tClamp((int(tCeiling(vb*levH)) - 1) / TileSize, 0, GetNumTilesY(level)-1);
+
+	for (int y = y0; y <= y1; y++)
+	{
+		for (int x = x0; x <= x1; x++)
+		{
+			// The part of the region this tile covers.
+			float tua = tMax(ua, float(x*TileSize) / levW);
+			float tub = tMin(ub, float(tMin((x+1)*TileSize, lev.Width)) / levW);
+			float tva = tMax(va, float(y*TileSize) / levH);
+			float tvb = tMin(vb, float(tMin((y+1)*TileSize, lev.Height)) / levH);
+			if ((tua >= tub) || (tva >= tvb))
+				continue;
+
+			// One upload is always allowed so the view fills in even if a stream used up the budget.
+			Tile* tile = FindTile(level, x, y);
+			if (!tile && ((NumUploads == 0) || TextureStream::HasBudget()))
+				tile = MakeResident(level, x, y);
+
+			// Until then the finest coarser tile that is resident is drawn. Tiles are the same size at every level,
+			// so a tile's area one level up is in the tile at half its column and row.
+			if (!tile)
+			{
+				Pending = true;
+				for (int coarser = level+1; !tile && (coarser < int(Levels.size())); coarser++)
+					tile = FindTile(coarser, x >> (coarser-level), y >> (coarser-level));
+			}
+
+			if (tile)
+				DrawTile(view, *tile, tua, tva, tub, tvb, repeatU, repeatV);
+		}
+	}
+}
+
+
+void TiledTexture::DrawTile(const View& view, Tile& tile, float ua, float va, float ub, float vb, float repeatU, float repeatV)
+{
+	tile.LastUsed = Frame;
+	const TextureStream::Level& lev = Levels[tile.Level];
+	float s0 = (ua*float(lev.Width) - float(tile.TexX)) / float(tile.TexW);
+	float s1 = (ub*float(lev.Width) - float(tile.TexX)) / float(tile.TexW);
+	float t0 = (va*float(lev.Height) - float(tile.TexY)) / float(tile.TexH);
+	float t1 = (vb*float(lev.Height) - float(tile.TexY)) / float(tile.TexH);
+
+	float x0 = view.Left + (ua + repeatU - view.U0) * view.PixelsPerU;
+	float x1 = view.Left + (ub + repeatU - view.U0) * view.PixelsPerU;
+	float y0 = view.Bottom + (va + repeatV - view.V0) * view.PixelsPerV;
+	float y1 = view.Bottom + (vb + repeatV - view.V0) * view.PixelsPerV;
+
+	glBindTexture(GL_TEXTURE_2D, tile.TexID);
+	glBegin(GL_QUADS);
+	glTexCoord2f(s0, t0); glVertex2f(x0, y0);
+	glTexCoord2f(s0, t1); glVertex2f(x0, y1);
+	glTexCoord2f(s1, t1); glVertex2f(x1, y1);
+	glTexCoord2f(s1, t0); glVertex2f(x1, y0);
+	glEnd();
+}
+
+
+TiledTexture::Tile* TiledTexture::FindTile(int level, int x, int y)
+{
+	for (Tile& tile : Tiles)
+		if ((tile.Level == level) && (tile.X == x) && (tile.Y == y))
+			return &tile;
+
+	return nullptr;
+}
+
+
+TiledTexture::Tile* TiledTexture::MakeResident(int level, int x, int y)
+{
+	const TextureStream::Level& lev = Levels[level];
+	int x0 = x*TileSize;	int x1 = tMin(x0 + TileSize, lev.Width);
+	int y0 = y*TileSize;	int y1 = tMin(y0 + TileSize, lev.Height);
+
+	// At the image edges there is no neighbour to copy a border from. Clamping to the edge texel does the same job.
+	Tile tile;
+	tile.Level	= level;
+	tile.X		= x;
+	tile.Y		= y;
+	tile.TexX	= tMax(x0-1, 0);
+	tile.TexY	= tMax(y0-1, 0);
+	tile.TexW	= tMin(x1+1, lev.Width) - tile.TexX;
+	tile.TexH	= tMin(y1+1, lev.Height) - tile.TexY;
+
+	glGenTextures(1, &tile.TexID);
+	if (tile.TexID == 0)
+		return nullptr;
+
+	glBindTexture(GL_TEXTURE_2D, tile.TexID);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+
+	// The rectangle is uploaded straight out of the level. The unpack row length and skips pick it out.
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, lev.Width);
+	glPixelStorei(GL_UNPACK_SKIP_PIXELS, tile.TexX);
+	glPixelStorei(GL_UNPACK_SKIP_ROWS, tile.TexY);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, tile.TexW, tile.TexH, 0, GL_RGBA, GL_UNSIGNED_BYTE, lev.Data);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+	glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+
+	ResidentBytes += int64(tile.TexW) * int64(tile.TexH) * 4;
+	NumUploads++;
+	Tiles.push_back(tile);
+	return &Tiles.back();
+}
+
+
+void TiledTexture::EvictUnused()
+{
+	// Tiles drawn this frame are kept even if that puts us over budget.
+	while (ResidentBytes > MaxResidentBytes)
+	{
+		int oldest = -1;
+		for (int t = 0; t < int(Tiles.size()); t++)
+			if ((Tiles[t].LastUsed < Frame) && ((oldest < 0) || (Tiles[t].LastUsed < Tiles[oldest].LastUsed)))
+				oldest = t;
+
+		if (oldest < 0)
+			break;
+
+		Tile& tile = Tiles[oldest];
+		glDeleteTextures(1, &tile.TexID);
+		ResidentBytes -= int64(tile.TexW) * int64(tile.TexH) * 4;
+		Tiles[oldest] = Tiles.back();
+		Tiles.pop_back();
+	}
+}
@@ -0,0 +1,99 @@
+// TiledTexture.h
+//
+// Draws pictures that are bigger than the largest texture the driver supports. The picture and each of its mipmap
+// levels are split into tiles, each with its own texture, and only the tiles covering the visible part of the image at
+// the level being drawn are kept on the GPU.
+//
+// Copyright (c) 2021 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <vector>
+#include <Foundation/tPlatform.h>
+#include "TextureStream.h"
+namespace Viewer
+{
+
+
+class TiledTexture
+{
+public:
+	// The levels are R8G8B8A8, the full picture first followed by its mipmaps. As with TextureStream the data is not
+	// owned and must stay valid while the tiled texture exists.
+	TiledTexture(const std::vector<TextureStream::Level>& levels)														: Levels(levels) { }
+
+	// Deletes the tile textures. The GL context must be current.
+	~TiledTexture();
+
+	// True if a picture of the given size is too big for a single texture. Always false before GL is loaded.
+	static bool NeedsTiling(int width, int height);
+
+	// Draws part of the image into the screen rectangle. The uvs are 0 to 1 across the whole image and may go outside
+	// that range if repeat is set. The level drawn is the one closest to one texel per screen pixel. Missing tiles are
+	// uploaded within the per-frame budget shared with TextureStream. Until a tile arrives its area is drawn from a
+	// coarser tile that is already resident. The caller sets the colour and enables texturing.
+	void Draw(float left, float right, float bottom, float top, float u0, float v0, float u1, float v1, bool repeat);
+
+	// True if the last Draw had to leave tiles for a later frame.
+	static bool AnyPending()																							{ return Pending; }
+
+private:
+	// A tile is a TileSize square of one level plus a one texel border copied from its neighbours, so linear filtering
+	// is seamless across tile edges. Border textures are not power-of-2 but GL 2 allows that.
+	const static int TileSize			= 1024;
+	const static int64 MaxResidentBytes	= 256*1024*1024;
+	const static int MaxRepeats			= 32;
+
+	struct Tile
+	{
+		int Level			= 0;
+		int X				= 0;		// Tile column and row within the level.
+		int Y				= 0;
+		uint TexID			= 0;
+		int TexX			= 0;		// Texel rectangle of the level held by the texture, border included.
+		int TexY			= 0;
+		int TexW			= 0;
+		int TexH			= 0;
+		uint64 LastUsed		= 0;
+	};
+
+	// Screen position of the uv origin and the number of screen pixels per unit of uv.
+	struct View
+	{
+		float Left			= 0.0f;
+		float Bottom		= 0.0f;
+		float U0			= 0.0f;
+		float V0			= 0.0f;
+		float PixelsPerU	= 0.0f;
+		float PixelsPerV	= 0.0f;
+	};
+
+	int GetNumTilesX(int level) const																					{ return (Levels[level].Width + TileSize - 1) / TileSize; }
+	int GetNumTilesY(int level) const																					{ return (Levels[level].Height + TileSize - 1) / TileSize; }
+	int GetFallbackLevel() const;
+
+	Tile* FindTile(int level, int x, int y);
+	Tile* MakeResident(int level, int x, int y);
+	void DrawRegion(const View&, int level, float ua, float va, float ub, float vb, float repeatU, float repeatV);
+	void DrawTile(const View&, Tile&, float ua, float va, float ub, float vb, float repeatU, float repeatV);
+	void EvictUnused();
+
+	std::vector<TextureStream::Level> Levels;
+	std::vector<Tile> Tiles;
+	int64 ResidentBytes					= 0;
+	uint64 Frame						= 0;
+	int NumUploads						= 0;		// This frame.
+
+	static int MaxTextureSize;
+	static bool Pending;
+};
+
+
+}
@@ -0,0 +1,438 @@
+// Transpose.cpp
+//
+// Quarter turns and flips of 32-bit pixels. Pictures are walked in 64x64 tiles so the source and destination rows being
+// read and written stay in cache, and each tile is moved as 4x4 blocks transposed in SSE2 or NEON registers. Square
+// pictures are turned in place so no second buffer is needed. Rows are split across the worker pool. An orientation
+// collects turns and flips so they can be drawn without touching the pixels until they're needed.
+//
+// Copyright (c) 2021 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define TRANSPOSE_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define TRANSPOSE_NEON
+#include <arm_neon.h>
+#endif
+#include <cstring>
+#include <Foundation/tFundamentals.h>
+#include "Transpose.h"
+#include "WorkerPool.h"
+using namespace tImage;
+namespace Viewer { extern Worker::Pool WorkerPool; }
+
+
+namespace Transpose
+{
+	// A 64x64 tile is 16KB, so a source tile and the destination tile it lands in fit in L1 together.
+	const int TileSize = 64;
+
+	// Enough pixels per chunk that the job overhead is small next to the copying.
+	const int MinPixelsPerChunk = 256*1024;
+
+	// Row k of d gets column k of the 4x4 block at s. Strides are in pixels and may be negative. TransposeSwap4 puts the
+	// transpose of a at b and of b at a. They may be the same block.
+	void Transpose4(const tPixel* s, int sStride, tPixel* d, int dStride);
+	void TransposeSwap4(tPixel* a, tPixel* b, int stride);
+	void Reverse(tPixel* row, int count);
+	void SwapRows(tPixel* a, tPixel* b, int count);
+
+	void RotateTile(const tPixel* src, int w, int h, tPixel* dst, int x0, int y0, int x1, int y1, bool antiClockwise);
+	void TransposeBandInPlace(tPixel* pixels, int size, int band);
+}
+
+
+#if defined(TRANSPOSE_SSE2)
+
+
+static inline void Transpose4x4(__m128i& r0, __m128i& r1, __m128i& r2, __m128i& r3)
+{
+	__m128i a = _mm_unpacklo_epi32(r0, r1);
+	__m128i b = _mm_unpacklo_epi32(r2, r3);
+	__m128i c = _mm_unpackhi_epi32(r0, r1);
+	__m128i d = _mm_unpackhi_epi32(r2, r3);
+	r0 = _mm_unpacklo_epi64(a, b);
+	r1 = _mm_unpackhi_epi64(a, b);
+	r2 = _mm_unpacklo_epi64(c, d);
+	r3 = _mm_unpackhi_epi64(c, d);
+}
+
+
+static inline __m128i Load(const tPixel* p)																				{ return _mm_loadu_si128((const __m128i*)p); }
+static inline void Store(tPixel* p, __m128i v)																			{ _mm_storeu_si128((__m128i*)p, v); }
+static inline __m128i Reverse4(__m128i v)																				{ return _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3)); }
+
+
+#elif defined(TRANSPOSE_NEON)
+
+
+static inline void Transpose4x4(uint32x4_t& r0, uint32x4_t& r1, uint32x4_t& r2, uint32x4_t& r3)
+{
+	uint32x4x2_t a = vtrnq_u32(r0, r1);
+	uint32x4x2_t b = vtrnq_u32(r2, r3);
+	r0 = vcombine_u32(vget_low_u32(a.val[0]), vget_low_u32(b.val[0]));
+	r1 = vcombine_u32(vget_low_u32(a.val[1]), vget_low_u32(b.val[1]));
+	r2 = vcombine_u32(vget_high_u32(a.val[0]), vget_high_u32(b.val[0]));
+	r3 = vcombine_u32(vget_high_u32(a.val[1]), vget_high_u32(b.val[1]));
+}
+
+
+static inline uint32x4_t Load(const tPixel* p)																			{ return vld1q_u32((const uint32_t*)p); }
+static inline void Store(tPixel* p, uint32x4_t v)																		{ vst1q_u32((uint32_t*)p, v); }
+static inline uint32x4_t Reverse4(uint32x4_t v)																			{ uint32x4_t r = vrev64q_u32(v); return vcombine_u32(vget_high_u32(r), vget_low_u32(r)); }
+
+
+#endif
+
+
+void Transpose::Transpose4(const tPixel* s, int sStride, tPixel* d, int dStride)
+{
+	#if defined(TRANSPOSE_SSE2) || defined(TRANSPOSE_NEON)
+	auto r0 = Load(s);
+	auto r1 = Load(s + sStride);
+	auto r2 = Load(s + 2*sStride);
+	auto r3 = Load(s + 3*sStride);
+	Transpose4x4(r0, r1, r2, r3);
+	Store(d, r0);
+	Store(d + dStride, r1);
+	Store(d + 2*dStride, r2);
+	Store(d + 3*dStride, r3);
+
+	#else
+	for (int k = 0; k < 4; k++)
+		for (int i = 0; i < 4; i++)
+			d[k*dStride + i] = s[i*sStride + k];
+	#endif
+}
+
+
+void Transpose::TransposeSwap4(tPixel* a, tPixel* b, int stride)
+{
+	#if defined(TRANSPOSE_SSE2) || defined(TRANSPOSE_NEON)
+	auto a0 = Load(a);
+	auto a1 = Load(a + stride);
+	auto a2 = Load(a + 2*stride);
+	auto a3 = Load(a + 3*stride);
+	auto b0 = Load(b);
+	auto b1 = Load(b + stride);
+	auto b2 = Load(b + 2*stride);
+	auto b3 = Load(b + 3*stride);
+	Transpose4x4(a0, a1, a2, a3);
+	Transpose4x4(b0, b1, b2, b3);
+	Store(b, a0);
+	Store(b + stride, a1);
+	Store(b + 2*stride, a2);
+	Store(b + 3*stride, a3);
+	Store(a, b0);
+	Store(a + stride, b1);
+	Store(a + 2*stride, b2);
+	Store(a + 3*stride, b3);
+
+	#else
+	tPixel ta[16];
+	tPixel tb[16];
+	Transpose4(a, stride, ta, 4);
+	Transpose4(b, stride, tb, 4);
+	for (int k = 0; k < 4; k++)
+	{
+		std::memcpy(b + k*stride, ta + k*4, 4*sizeof(tPixel));
+		std::memcpy(a + k*stride, tb + k*4, 4*sizeof(tPixel));
+	}
+	#endif
+}
+
+
+void Transpose::Reverse(tPixel* row, int count)
+{
+	int left = 0;
+	int right = count;
+
+	#if defined(TRANSPOSE_SSE2) || defined(TRANSPOSE_NEON)
+	for (; right - left >= 8; left += 4, right -= 4)
+	{
+		auto l = Load(row + left);
+		auto r = Load(row + right - 4);
+		Store(row + left, Reverse4(r));
+		Store(row + right - 4, Reverse4(l));
+	}
+	#endif
+
+	for (right--; left < right; left++, right--)
+		tMath::tSwap(row[left], row[right]);
+}
+
+
+void Transpose::SwapRows(tPixel* a, tPixel* b, int count)
+{
+	// Through a buffer small enough to stay in L1.
+	const int chunk = 1024;
+	tPixel temp[chunk];
+	for (int x = 0; x < count; x += chunk)
+	{
+		int num = tMath::tMin(chunk, count - x);
+		std::memcpy(temp, a + x, num*sizeof(tPixel));
+		std::memcpy(a + x, b + x, num*sizeof(tPixel));
+		std::memcpy(b + x, temp, num*sizeof(tPixel));
+	}
+}
+
+
+void Transpose::RotateTile(const tPixel* src, int w, int h, tPixel* dst, int x0, int y0, int x1, int y1, bool antiClockwise)
+{
+	// Source pixel (x,y) goes to dst[x*h + h-1-y] turning anticlockwise and to dst[(w-1-x)*h + y] turning clockwise. Each
+	// 4x4 block is read bottom up when turning anticlockwise so its columns come out reversed.
+	int y = y0;
+	for (; y + 4 <= y1; y += 4)
+	{
+		int x = x0;
+		for (; x + 4 <= x1; x += 4)
+		{
+			if (antiClockwise)
+				Transpose4(src + (y+3)*w + x, -w, dst + x*h + (h-4-y), h);
+			else
+				Transpose4(src + y*w + x, w, dst + (w-1-x)*h + y, -h);
+		}
+
+		// Tiles are a multiple of 4 wide, so only the last column of tiles has any left over.
+		for (; x < x1; x++)
+			for (int yy = y; yy < y + 4; yy++)
+				dst[antiClockwise ? (x*h + h-1-yy) : ((w-1-x)*h + yy)] = src[yy*w + x];
+	}
+
+	for (; y < y1; y++)
+		for (int x = x0; x < x1; x++)
+			dst[antiClockwise ? (x*h + h-1-y) : ((w-1-x)*h + y)] = src[y*w + x];
+}
+
+
+void Transpose::TransposeBandInPlace(tPixel* pixels, int size, int band)
+{
+	// The band swaps its part of the upper triangle with the mirror part of the lower triangle. That is a column of
+	// tiles no other band touches.
+	int size4 = size & ~3;
+	int y0 = band*TileSize;
+	int y1 = tMath::tMin(y0 + TileSize, size);
+	for (int x0 = y0; x0 < size4; x0 += TileSize)
+	{
+		int x1 = tMath::tMin(x0 + TileSize, size4);
+		for (int y = y0; (y < y1) && (y < size4); y += 4)
+			for (int x = (x0 == y0) ? y : x0; x < x1; x += 4)
+				TransposeSwap4(pixels + y*size + x, pixels + x*size + y, size);
+	}
+
+	// The last few columns when the size isn't a multiple of 4.
+	for (int y = y0; y < y1; y++)
+		for (int x = tMath::tMax(size4, y+1); x < size; x++)
+			tMath::tSwap(pixels[y*size + x], pixels[x*size + y]);
+}
+
+
+void Transpose::Rotate90(const tPixel* src, int w, int h, tPixel* dst, bool antiClockwise)
+{
+	if (!src || !dst || (w <= 0) || (h <= 0))
+		return;
+
+	int numBands = (h + TileSize - 1) / TileSize;
+	int grain = tMath::tMax(1, MinPixelsPerChunk / (w*TileSize));
+	Viewer::WorkerPool.ParallelFor
+	(
+		numBands, grain,
+		[=](int begin, int end)
+		{
+			for (int band = begin; band < end; band++)
+			{
+				int y0 = band*TileSize;
+				int y1 = tMath::tMin(y0 + TileSize, h);
+				for (int x0 = 0; x0 < w; x0 += TileSize)
+					RotateTile(src, w, h, dst, x0, y0, tMath::tMin(x0 + TileSize, w), y1, antiClockwise);
+			}
+		}
+	);
+}
+
+
+void Transpose::Rotate90InPlace(tPixel* pixels, int size, bool antiClockwise)
+{
+	if (!pixels || (size <= 0))
+		return;
+
+	// Bands near the top have the most tiles to swap, so they go one at a time.
+	int numBands = (size + TileSize - 1) / TileSize;
+	Viewer::WorkerPool.ParallelFor
+	(
+		numBands, 1,
+		[=](int begin, int end) { for (int band = begin; band < end; band++) TransposeBandInPlace(pixels, size, band); }
+	);
+
+	// Anticlockwise is the transpose mirrored left to right, and clockwise is it upside down.
+	Flip(pixels, size, size, antiClockwise);
+}
+
+
+void Transpose::Flip(tPixel* pixels, int w, int h, bool horizontal)
+{
+	if (!pixels || (w <= 0) || (h <= 0))
+		return;
+
+	int grain = tMath::tMax(1, MinPixelsPerChunk / w);
+	if (horizontal)
+	{
+		Viewer::WorkerPool.ParallelFor
+		(
+			h, grain,
+			[=](int begin, int end) { for (int y = begin; y < end; y++) Reverse(pixels + y*w, w); }
+		);
+	}
+	else
+	{
+		Viewer::WorkerPool.ParallelFor
+		(
+			h/2, grain,
+			[=](int begin, int end) { for (int y = begin; y < end; y++) SwapRows(pixels + y*w, pixels + (h-1-y)*w, w); }
+		);
+	}
+}
+
+
+void Transpose::Rotate90(tPicture& picture, bool antiClockwise)
+{
+	if (!picture.IsValid())
+		return;
+
+	int w = picture.GetWidth();
+	int h = picture.GetHeight();
+	if (w == h)
+	{
+		Rotate90InPlace(picture.GetPixels(), w, antiClockwise);
+		return;
+	}
+
+	tPixel* rotated = new tPixel[w*h];
+	Rotate90(picture.GetPixels(), w, h, rotated, antiClockwise);
+	float duration = picture.Duration;
+	picture.Set(h, w, rotated, false);
+	picture.Duration = duration;
+}
+
+
+void Transpose::Flip(tPicture& picture, bool horizontal)
+{
+	if (picture.IsValid())
+		Flip(picture.GetPixels(), picture.GetWidth(), picture.GetHeight(), horizontal);
+}
+
+
+void Transpose::Orientation::Rotate90(bool antiClockwise)
+{
+	// Anticlockwise is a transpose then a horizontal flip, and clockwise a transpose then a vertical flip. A transpose
+	// applied after the flips swaps which axis each one is on.
+	bool flipX = FlipX;
+	bool flipY = FlipY;
+	Transposed = !Transposed;
+	FlipX = antiClockwise ? !flipY : flipY;
+	FlipY = antiClockwise ? flipX : !flipX;
+}
+
+
+void Transpose::Orientation::Crop(int x, int y, int cropW, int cropH, int w, int h)
+{
+	// Opposite corners are found in the stored picture, taking in any window there already is. The new window is the
+	// rect between them.
+	int x0 = x;					int y0 = y;					MapPixel(x0, y0, w, h);
+	int x1 = x + cropW - 1;		int y1 = y + cropH - 1;		MapPixel(x1, y1, w, h);
+	CropX = tMath::tMin(x0, x1);
+	CropY = tMath::tMin(y0, y1);
+	CropW = tMath::tAbs(x1 - x0) + 1;
+	CropH = tMath::tAbs(y1 - y0) + 1;
+}
+
+
+void Transpose::Orientation::MapPixel(int& x, int& y, int w, int h) const
+{
+	if (FlipY)
+		y = h-1-y;
+	if (FlipX)
+		x = w-1-x;
+	if (Transposed)
+		tMath::tSwap(x, y);
+	x += CropX;
+	y += CropY;
+}
+
+
+void Transpose::Orientation::MapUV(float& u, float& v, int w, int h) const
+{
+	if (FlipY)
+		v = 1.0f-v;
+	if (FlipX)
+		u = 1.0f-u;
+	if (Transposed)
+		tMath::tSwap(u, v);
+	if (IsCropped() && (w > 0) && (h > 0))
+	{
+		u = (float(CropX) + u*float(CropW)) / float(w);
+		v = (float(CropY) + v*float(CropH)) / float(h);
+	}
+}
+
+
+void Transpose::Orientation::GetMatrix(float matrix[16], float cx, float cy) const
+{
+	float a00 = Transposed ? 0.0f : 1.0f;		float a01 = Transposed ? 1.0f : 0.0f;
+	float a10 = Transposed ? 1.0f : 0.0f;		float a11 = Transposed ? 0.0f : 1.0f;
+	if (FlipX)
+	{
+		a00 = -a00;
+		a01 = -a01;
+	}
+	if (FlipY)
+	{
+		a10 = -a10;
+		a11 = -a11;
+	}
+
+	for (int e = 0; e < 16; e++)
+		matrix[e] = 0.0f;
+	matrix[0] = a00;	matrix[4] = a01;	matrix[12] = cx - (a00*cx + a01*cy);
+	matrix[1] = a10;	matrix[5] = a11;	matrix[13] = cy - (a10*cx + a11*cy);
+	matrix[10] = 1.0f;
+	matrix[15] = 1.0f;
+}
+
+
+void Transpose::Apply(tPicture& picture, const Orientation& orientation)
+{
+	// The window is in stored pixels so it goes first. It's always inside the picture, so nothing is filled.
+	if (orientation.IsCropped() && picture.IsValid())
+	{
+		float duration = picture.Duration;
+		picture.Crop(orientation.CropW, orientation.CropH, orientation.CropX, orientation.CropY);
+		picture.Duration = duration;
+	}
+
+	// A transpose is a turn with one of the flips undone, so either turn will do. Whichever leaves fewer flips wins.
+	bool flipX = orientation.FlipX;
+	bool flipY = orientation.FlipY;
+	if (orientation.Transposed)
+	{
+		bool antiClockwise = (int(!flipX) + int(flipY)) <= (int(flipX) + int(!flipY));
+		Rotate90(picture, antiClockwise);
+		if (antiClockwise)
+			flipX = !flipX;
+		else
+			flipY = !flipY;
+	}
+
+	if (flipX)
+		Flip(picture, true);
+	if (flipY)
+		Flip(picture, false);
+}
@@ -0,0 +1,82 @@
+// Transpose.h
+//
+// Quarter turns and flips of 32-bit pixels. Pictures are walked in 64x64 tiles so the source and destination rows being
+// read and written stay in cache, and each tile is moved as 4x4 blocks transposed in SSE2 or NEON registers. Square
+// pictures are turned in place so no second buffer is needed. Rows are split across the worker pool. An orientation
+// collects turns and flips so they can be drawn without touching the pixels until they're needed.
+//
+// Copyright (c) 2021 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <Foundation/tFundamentals.h>
+#include <Image/tPicture.h>
+namespace Transpose
+{
+
+
+// Rows run bottom to top as in tPicture, so the turn directions match tPicture::Rotate90. Src is w by h and dst, which
+// must not overlap it, is h by w. Called from a worker thread, or with the pool not running, it all runs on the
+// calling thread.
+void Rotate90(const tPixel* src, int w, int h, tPixel* dst, bool antiClockwise);
+
+// A square is transposed in place and then flipped.
+void Rotate90InPlace(tPixel* pixels, int size, bool antiClockwise);
+
+// In place. A horizontal flip mirrors left to right. A half turn is both flips.
+void Flip(tPixel* pixels, int w, int h, bool horizontal);
+
+// Picture versions. Square pictures are turned in place. The frame duration is kept.
+void Rotate90(tImage::tPicture&, bool antiClockwise);
+void Flip(tImage::tPicture&, bool horizontal);
+
+// Any run of quarter turns and flips comes down to an optional transpose followed by optional flips. Collected like
+// this they can be drawn by turning the quad rather than the pixels, and baked later with at most one turn and one
+// flip. A crop inside the picture is kept too, as a window on the stored picture that comes before the turn and flips.
+// It's drawn as a uv sub-rect. Positions and uvs are mapped from the oriented picture back to the stored one.
+struct Orientation
+{
+	bool IsIdentity() const																								{ return !Transposed && !FlipX && !FlipY && !IsCropped(); }
+	bool IsCropped() const																								{ return CropW > 0; }
+	void Rotate90(bool antiClockwise);
+	void Flip(bool horizontal)																							{ if (horizontal) FlipX = !FlipX; else FlipY = !FlipY; }
+
+	// Crops the oriented w by h picture to the rect at x,y, which must be inside it.
+	void Crop(int x, int y, int cropW, int cropH, int w, int h);
+
+	// The stored width and height to the size shown.
+	void MapSize(int& w, int& h) const																					{ if (IsCropped()) { w = CropW; h = CropH; } if (Transposed) tMath::tSwap(w, h); }
+
+	// The pixel at x,y of the oriented w by h picture to where it is stored.
+	void MapPixel(int& x, int& y, int w, int h) const;
+
+	// The uv of the oriented picture to the stored one, which is w by h.
+	void MapUV(float& u, float& v, int w, int h) const;
+
+	// A column-major matrix turning and flipping about cx,cy. It takes a quad drawn the stored way round to the
+	// oriented one.
+	void GetMatrix(float matrix[16], float cx, float cy) const;
+
+	bool Transposed		= false;
+	bool FlipX			= false;
+	bool FlipY			= false;
+
+	// The window in stored pixels. A width of zero is the whole picture.
+	int CropX			= 0;
+	int CropY			= 0;
+	int CropW			= 0;
+	int CropH			= 0;
+};
+
+// Bakes the orientation into the pixels.
+void Apply(tImage::tPicture&, const Orientation&);
+
+
+}
@@ -13,35 +13,541 @@
 // AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
 // PERFORMANCE OF THIS SOFTWARE.
 
+#include <cstring>
+#include <cstdint>
+#include <unordered_set>
+#include <algorithm>
 #include "Undo.h"
 #include "Image.h"
 #include "Settings.h"
+#include "Compress.h"
+#include "Transpose.h"
+#include "WorkerPool.h"
 using namespace tStd;
 using namespace tMath;
 using namespace tSystem;
 using namespace tImage;
+namespace Viewer { extern Worker::Pool WorkerPool; }
 
 
-Undo::Step_PictureList::Step_PictureList(const tString& desc, bool dirty, const tList<tImage::tPicture>& pics) :
-	Step(desc, dirty)
+namespace Undo
 {
+	// Everything here is only touched on the main thread. Compression jobs hold references to the tiles they work on
+	// so the tiles outlive them, and only read the raw pixels, which don't change until the job completes.
+	std::unordered_set<Tile*> Tiles;
+	std::vector<Stack*> Stacks;
+	SpillFile ScratchFile;
+	bool ScratchFailed					= false;
+	uint64 NextTileSerial				= 1;
+	uint64 NextStepSerial				= 1;
+	int64 MemoryBytes					= 0;
+	int NumCompressJobs					= 0;
+
+	const int CompressBatch				= 64;				// Tiles per job. About 4MB of pixels.
+	const int CompressPriority			= -0x40000000;		// Behind all thumbnails.
+	const int DiskBudgetScale			= 4;				// The scratch file may be this many times the memory budget.
+
+	class CompressJob;
+	void CollectHistory(std::vector<Tile*>&);
+	bool SpillTile(Tile&, int64 diskBudget);
+}
+
+
+class Undo::CompressJob : public Worker::Job
+{
+public:
+	void Execute() override;
+	void OnComplete() override;
+
+	std::vector<TileRef> Tiles;
+	std::vector<std::vector<uint8>> Packed;
+};
+
+
+void Undo::CompressJob::Execute()
+{
+	Packed.resize(Tiles.size());
+	for (int t = 0; t < int(Tiles.size()); t++)
+	{
+		const Tile& tile = *Tiles[t];
+		tPicture picture(tile.Width, tile.Height, (tPixel*)tile.Pixels.data(), true);
+		Compress::EncodePicture(Packed[t], picture, Compress::Method::Lossless);
+	}
+}
+
+
+void Undo::CompressJob::OnComplete()
+{
+	for (int t = 0; t < int(Tiles.size()); t++)
+	{
+		Tile& tile = *Tiles[t];
+		tile.Compressing = false;
+		if ((tile.Kept != Tile::Storage::Raw) || Packed[t].empty())
+			continue;
+
+		tile.Packed.swap(Packed[t]);
+		tile.Kept = Tile::Storage::Packed;
+		std::vector<tPixel>().swap(tile.Pixels);
+	}
+
+	// Tiles nothing else refers to any more go now, on the main thread.
+	Tiles.clear();
+	NumCompressJobs--;
+	if (NumCompressJobs == 0)
+		Maintain();
+}
+
+
+Undo::Tile::Tile(int width, int height, const tPixel* src, int srcStride) :
+	Width(width),
+	Height(height),
+	Serial(NextTileSerial++)
+{
+	Pixels.resize(Width*Height);
+	for (int y = 0; y < Height; y++)
+		std::memcpy(Pixels.data() + y*Width, src + y*srcStride, Width*sizeof(tPixel));
+	Tiles.insert(this);
+}
+
+
+Undo::Tile::~Tile()
+{
+	if (Kept == Storage::Spilled)
+		ScratchFile.Free(Spill, SpillSize);
+	Tiles.erase(this);
+}
+
+
+int64 Undo::Tile::GetMemoryBytes() const
+{
+	switch (Kept)
+	{
+		case Storage::Raw:		return int64(Pixels.size()) * sizeof(tPixel);
+		case Storage::Packed:	return int64(Packed.size());
+		default:				return 0;
+	}
+}
+
+
+void Undo::Tile::Read(tPixel* dst, int dstStride) const
+{
+	const tPixel* src = Pixels.data();
+	tPicture picture;
+	if (Kept != Storage::Raw)
+	{
+		bool packed = (Kept == Storage::Packed);
+		const uint8* data = packed ? Packed.data() : ScratchFile.GetData(Spill);
+		int size = packed ? int(Packed.size()) : SpillSize;
+		if (!Compress::DecodePicture(picture, data, size) || (picture.GetWidth() != Width) || (picture.GetHeight() != Height))
+			picture.Set(Width, Height, tPixel::black);
+		src = picture.GetPixels();
+	}
+
+	for (int y = 0; y < Height; y++)
+		std::memcpy(dst + y*dstStride, src + y*Width, Width*sizeof(tPixel));
+}
+
+
+void Undo::CollectHistory(std::vector<Tile*>& history)
+{
+	// Every tile belongs to a step. The current pictures are never copied.
+	history.clear();
+	MemoryBytes = 0;
+	for (Tile* tile : Tiles)
+	{
+		history.push_back(tile);
+		MemoryBytes += tile->GetMemoryBytes();
+	}
+
+	std::sort(history.begin(), history.end(), [](const Tile* a, const Tile* b) { return a->Serial < b->Serial; });
+}
+
+
+bool Undo::SpillTile(Tile& tile, int64 diskBudget)
+{
+	if (!ScratchFile.IsOpen() && !ScratchFailed)
+		ScratchFailed = !ScratchFile.Open(Viewer::Image::ThumbCacheDir);
+
+	int size = int(tile.Packed.size());
+	SpillFile::Location location;
+	if (!ScratchFile.Allocate(size, diskBudget, location))
+		return false;
+
+	std::memcpy(ScratchFile.GetData(location), tile.Packed.data(), size);
+	std::vector<uint8>().swap(tile.Packed);
+	tile.Spill = location;
+	tile.SpillSize = size;
+	tile.Kept = Tile::Storage::Spilled;
+	MemoryBytes -= size;
+	return true;
+}
+
+
+void Undo::Maintain()
+{
+	std::vector<Tile*> history;
+	CollectHistory(history);
+
+	// Everything only history refers to is compressed in the background, oldest first.
+	if (Viewer::WorkerPool.IsRunning())
+	{
+		CompressJob* job = nullptr;
+		for (Tile* tile : history)
+		{
+			if ((tile->Kept != Tile::Storage::Raw) || tile->Compressing)
+				continue;
+
+			if (!job)
+				job = new CompressJob;
+			tile->Compressing = true;
+			job->Tiles.push_back(tile->shared_from_this());
+			if (int(job->Tiles.size()) == CompressBatch)
+			{
+				Viewer::WorkerPool.Submit(job, CompressPriority);
+				NumCompressJobs++;
+				job = nullptr;
+			}
+		}
+
+		if (job)
+		{
+			Viewer::WorkerPool.Submit(job, CompressPriority);
+			NumCompressJobs++;
+		}
+	}
+
+	// Over budget the oldest packed tiles go to disk. If the disk is full too, steps are dropped until the budget is met,
+	// redo steps first, but not while compression that might bring things under budget is still going.
+	int64 budget = int64(Viewer::Config.UndoBudgetMB) * 1024 * 1024;
+	int64 diskBudget = budget * DiskBudgetScale;
+	while (MemoryBytes > budget)
+	{
+		for (Tile* tile : history)
+		{
+			if (MemoryBytes <= budget)
+				break;
+			if ((tile->Kept == Tile::Storage::Packed) && !SpillTile(*tile, diskBudget))
+				break;
+		}
+
+		if ((MemoryBytes <= budget) || (NumCompressJobs > 0))
+			break;
+
+		Stack* oldest = nullptr;
+		for (Stack* stack : Stacks)
+			if (stack->GetOldestSerial() < (oldest ? oldest->GetOldestSerial() : UINT64_MAX))
+				oldest = stack;
+		if (!oldest)
+			break;
+
+		oldest->DropOldest();
+		CollectHistory(history);
+	}
+}
+
+
+int64 Undo::GetMemoryBytes()
+{
+	return MemoryBytes;
+}
+
+
+int64 Undo::GetDiskBytes()
+{
+	return ScratchFile.GetUsedBytes();
+}
+
+
+void Undo::Shutdown()
+{
+	ScratchFile.Close();
+}
+
+
+Undo::Stack::Stack()
+{
+	Stacks.push_back(this);
+}
+
+
+Undo::Stack::~Stack()
+{
+	Stacks.erase(std::find(Stacks.begin(), Stacks.end(), this));
+}
+
+
+uint64 Undo::Stack::GetOldestSerial() const
+{
+	// Redo steps are the least likely to be wanted, so they go before any undo step.
+	if (!RedoSteps.IsEmpty())
+		return 0;
+
+	return UndoSteps.IsEmpty() ? UINT64_MAX : UndoSteps.Tail()->Serial;
+}
+
+
+void Undo::Stack::DropOldest()
+{
+	// Redo steps are dropped from the far end, leaving the next redo for last.
+	if (!RedoSteps.IsEmpty())
+		delete RedoSteps.Drop();
+	else if (!UndoSteps.IsEmpty())
+		delete UndoSteps.Drop();
+}
+
+
+void Undo::Snapshot::Restore(tList<tImage::tPicture>& pics) const
+{
+	// Existing pictures are reused so whatever else they hold, like the filename, survives the undo.
+	tPicture* pic = pics.First();
+	for (const Frame& frame : Frames)
+	{
+		if (!pic)
+			pic = pics.Append(new tPicture());
+
+		if ((frame.Width > 0) && (frame.Height > 0))
+		{
+			// A picture the same size has the tiles written over it. The op only changed those. Otherwise the snapshot
+			// has every tile of the frame.
+			bool sameSize = pic->IsValid() && (pic->GetWidth() == frame.Width) && (pic->GetHeight() == frame.Height);
+			tPixel* pixels = sameSize ? pic->GetPixels() : new tPixel[frame.Width*frame.Height];
+			int numTilesX = (frame.Width + Stack::TileSize - 1) / Stack::TileSize;
+			for (int t = 0; t < int(frame.Tiles.size()); t++)
+			{
+				if (!frame.Tiles[t])
+					continue;
+
+				int x0 = (t % numTilesX) * Stack::TileSize;
+				int y0 = (t / numTilesX) * Stack::TileSize;
+				frame.Tiles[t]->Read(pixels + y0*frame.Width + x0, frame.Width);
+			}
+			if (!sameSize)
+				pic->Set(frame.Width, frame.Height, pixels, false);
+		}
+		else
+		{
+			pic->Clear();
+		}
+		pic->Duration = frame.Duration;
+		pic = pic->Next();
+	}
+
+	while (pic)
+	{
+		tPicture* next = pic->Next();
+		delete pics.Remove(pic);
+		pic = next;
+	}
+}
+
+
+// The frames of an animation are independent, so each one is its own chunk.
+static void ForEachFrame(tList<tImage::tPicture>& pics, const std::function<void(tPicture&)>& op)
+{
+	std::vector<tPicture*> frames;
 	for (tPicture* pic = pics.First(); pic; pic = pic->Next())
-		Pictures.Append(new tPicture(*pic));
+		frames.push_back(pic);
+
+	Viewer::WorkerPool.ParallelFor
+	(
+		int(frames.size()), 1,
+		[&frames, &op](int begin, int end) { for (int f = begin; f < end; f++) op(*frames[f]); }
+	);
+}
+
+
+void Undo::Step_Rotate90::Revert(tList<tImage::tPicture>& pics) const
+{
+	bool antiClockwise = !AntiClockwise;
+	ForEachFrame(pics, [antiClockwise](tPicture& pic) { Transpose::Rotate90(pic, antiClockwise); });
+}
+
+
+void Undo::Step_Rotate90::Reapply(tList<tImage::tPicture>& pics) const
+{
+	bool antiClockwise = AntiClockwise;
+	ForEachFrame(pics, [antiClockwise](tPicture& pic) { Transpose::Rotate90(pic, antiClockwise); });
+}
+
+
+void Undo::Step_Flip::Reapply(tList<tImage::tPicture>& pics) const
+{
+	bool horizontal = Horizontal;
+	ForEachFrame(pics, [horizontal](tPicture& pic) { Transpose::Flip(pic, horizontal); });
+}
+
+
+bool Undo::Step_Crop::Reorient(Transpose::Orientation& orientation, bool revert) const
+{
+	// Turns and flips since the crop don't move the window, so only the window is set.
+	if (!Base.Frames.empty())
+		return false;
+
+	const Transpose::Orientation& to = revert ? Before : After;
+	orientation.CropX = to.CropX;
+	orientation.CropY = to.CropY;
+	orientation.CropW = to.CropW;
+	orientation.CropH = to.CropH;
+	return true;
+}
+
+
+void Undo::Step_Crop::Rebuild(tList<tImage::tPicture>& pics, const Transpose::Orientation& orientation) const
+{
+	// The pictures are wanted as shown, so the whole orientation is baked into the copy.
+	Base.Restore(pics);
+	ForEachFrame(pics, [&orientation](tPicture& pic) { Transpose::Apply(pic, orientation); });
+}
+
+
+void Undo::Step_FrameDuration::SetDurations(tList<tImage::tPicture>& pics, const std::vector<float>& durations)
+{
+	int frameNum = 0;
+	for (tPicture* pic = pics.First(); pic && (frameNum < int(durations.size())); pic = pic->Next(), frameNum++)
+		pic->Duration = durations[frameNum];
+}
+
+
+void Undo::Stack::Describe(Snapshot& snapshot, const tList<tImage::tPicture>& pics)
+{
+	snapshot.Frames.clear();
+	snapshot.Frames.resize(pics.Count());
+	int frameNum = 0;
+	for (tPicture* pic = pics.First(); pic; pic = pic->Next(), frameNum++)
+	{
+		Frame& frame = snapshot.Frames[frameNum];
+		frame.Duration = pic->Duration;
+		frame.Width = pic->IsValid() ? pic->GetWidth() : 0;
+		frame.Height = pic->IsValid() ? pic->GetHeight() : 0;
+		frame.Tiles.assign(((frame.Width + TileSize - 1) / TileSize) * ((frame.Height + TileSize - 1) / TileSize), TileRef());
+	}
+}
+
+
+void Undo::Stack::Capture(Snapshot& snapshot, const tList<tImage::tPicture>& pics, const Region& region)
+{
+	if (region.IsEmpty())
+		return;
+
+	int frameNum = 0;
+	for (tPicture* pic = pics.First(); pic && (frameNum < int(snapshot.Frames.size())); pic = pic->Next(), frameNum++)
+	{
+		if ((region.Frame >= 0) && (region.Frame != frameNum))
+			continue;
+
+		Frame& frame = snapshot.Frames[frameNum];
+		int width = pic->IsValid() ? pic->GetWidth() : 0;
+		int height = pic->IsValid() ? pic->GetHeight() : 0;
+		if ((frame.Width != width) || (frame.Height != height))
+			continue;
+
+		int x0 = tMax(region.X, 0);		int x1 = (region.W < 0) ? width : tMin(region.X + region.W, width);
+		int y0 = tMax(region.Y, 0);		int y1 = (region.H < 0) ? height : tMin(region.Y + region.H, height);
+		if ((x0 < x1) && (y0 < y1))
+			Capture(frame, *pic, x0, y0, x1, y1);
+	}
+}
+
+
+void Undo::Stack::Capture(Frame& frame, const tPicture& pic, int x0, int y0, int x1, int y1)
+{
+	const tPixel* src = pic.GetPixels();
+	int numTilesX = (frame.Width + TileSize - 1) / TileSize;
+	for (int ty = y0 / TileSize; ty <= (y1-1) / TileSize; ty++)
+	{
+		for (int tx = x0 / TileSize; tx <= (x1-1) / TileSize; tx++)
+		{
+			TileRef& ref = frame.Tiles[ty*numTilesX + tx];
+			if (ref)
+				continue;
+
+			int tileX = tx*TileSize;		int tileW = tMin(TileSize, frame.Width - tileX);
+			int tileY = ty*TileSize;		int tileH = tMin(TileSize, frame.Height - tileY);
+			ref = TileRef(new Tile(tileW, tileH, src + tileY*frame.Width + tileX, frame.Width));
+		}
+	}
+}
+
+
+void Undo::Stack::Push(tList<tImage::tPicture>& preOpState, const tString& desc, bool dirty, const Region& region)
+{
+	Step_Snapshot* step = new Step_Snapshot(desc, dirty, Snapshot());
+	Describe(step->State, preOpState);
+	Capture(step->State, preOpState, region);
+	Insert(step);
+	Maintain();
 }
 
 
-void Undo::Step_PictureList::Restore(tList<tImage::tPicture>& pics)
+void Undo::Stack::Touch(const tList<tImage::tPicture>& preOpState, const Region& region)
 {
-	pics.Clear();
-	for (tPicture* restorePic = Pictures.First(); restorePic; restorePic = restorePic->Next())
-		pics.Append(new tPicture(*restorePic));
+	// Anything the last step doesn't have is still as it was before its op, as every change since was touched first.
+	Step_Snapshot* step = dynamic_cast<Step_Snapshot*>(UndoSteps.First());
+	if (!step || region.IsEmpty())
+		return;
+
+	Capture(step->State, preOpState, region);
+	Maintain();
+}
+
+
+void Undo::Stack::KeepBase(const tList<tImage::tPicture>& pictures)
+{
+	// Any crop step still without a copy is a window on these pictures, so they all share the one.
+	Snapshot base;
+	tList<Undo::Step>* lists[] = { &UndoSteps, &RedoSteps };
+	for (tList<Undo::Step>* steps : lists)
+	{
+		for (Undo::Step* step = steps->First(); step; step = step->Next())
+		{
+			Step_Crop* crop = dynamic_cast<Step_Crop*>(step);
+			if (!crop || !crop->Base.Frames.empty())
+				continue;
+
+			if (base.Frames.empty())
+			{
+				Describe(base, pictures);
+				Capture(base, pictures, Region());
+			}
+			crop->Base = base;
+		}
+	}
+
+	if (!base.Frames.empty())
+		Maintain();
 }
 
 
-void Undo::Stack::Push(tList<tImage::tPicture>& preOpState, const tString& desc, bool dirty)
+bool Undo::Stack::Push(Step_Operation* step, Transpose::Orientation* orientation)
 {
-	// Create the undo step.
-	Undo::Step_PictureList* step = new Undo::Step_PictureList(desc, dirty, preOpState);
+	Insert(step);
+	return orientation && step->Reorient(*orientation, false);
+}
+
+
+bool Undo::Stack::NeedsPixels(const Undo::Step* step)
+{
+	// Snapshot steps compare and restore tiles. Operations that change nothing, like frame durations, leave the pixels
+	// alone. Reorienting a copy tells us about the rest without changing anything.
+	if (!step)
+		return false;
+
+	const Step_Operation* operation = dynamic_cast<const Step_Operation*>(step);
+	if (!operation)
+		return true;
+
+	Transpose::Orientation orientation;
+	return !operation->Changed.IsEmpty() && !operation->Reorient(orientation, false);
+}
+
+
+void Undo::Stack::Insert(Undo::Step* step)
+{
+	// Redo steps only hold what they change, so they can't be applied on top of anything new.
+	while (!RedoSteps.IsEmpty())
+		delete RedoSteps.Remove();
+
+	step->Serial = NextStepSerial++;
 	UndoSteps.Insert(step);
 
 	// Drop one from the end if we've reached the limit.
@@ -51,37 +557,78 @@ void Undo::Stack::Push(tList<tImage::tPicture>& preOpState, const tString& desc,
 }
 
 
-void Undo::Stack::Undo(tList<tImage::tPicture>& currPics, bool& dirty)
+void Undo::Stack::Apply(tList<Undo::Step>& from, tList<Undo::Step>& to, tList<tImage::tPicture>& currPics, bool& dirty, Transpose::Orientation* orientation)
 {
-	if (UndoSteps.IsEmpty())
+	if (from.IsEmpty())
 		return;
 
-	Step* undoStep = UndoSteps.Remove();
+	Undo::Step* removed = from.Remove();
+	if (Step_Operation* operation = dynamic_cast<Step_Operation*>(removed))
+	{
+		bool revert = (&from == &UndoSteps);
+		if (!orientation || !operation->Reorient(*orientation, revert))
+		{
+			if (revert)
+				operation->Revert(currPics);
+			else
+				operation->Reapply(currPics);
+		}
 
-	// We're going to need a redo step to get to current state. Prepare it first.
-	Step* redoStep = new Step_PictureList(undoStep->Description, dirty, currPics);
+		// The step now takes us back the other way, so it holds the dirty state from before this.
+		tSwap(operation->Dirty, dirty);
+		to.Insert(operation);
+		return;
+	}
 
-	((Step_PictureList*)undoStep)->Restore(currPics);
-	dirty = undoStep->Dirty;
-	delete undoStep;
+	Step_Snapshot* step = (Step_Snapshot*)removed;
 
-	RedoSteps.Insert(redoStep);
-}
+	// We're going to need a step to get back to the current state. Prepare it first. Where the frame count or a frame's
+	// size differs, the step has all of the frame and so does the way back.
+	Step_Snapshot* back = new Step_Snapshot(step->Description, dirty, Snapshot());
+	Describe(back->State, currPics);
+	bool sameCount = (back->State.Frames.size() == step->State.Frames.size());
+	int frameNum = 0;
+	for (tPicture* pic = currPics.First(); pic; pic = pic->Next(), frameNum++)
+	{
+		Frame& frame = back->State.Frames[frameNum];
+		if ((frame.Width <= 0) || (frame.Height <= 0))
+			continue;
 
+		const Frame* restored = sameCount ? &step->State.Frames[frameNum] : nullptr;
+		if (!restored || (restored->Width != frame.Width) || (restored->Height != frame.Height))
+		{
+			Capture(frame, *pic, 0, 0, frame.Width, frame.Height);
+			continue;
+		}
 
-void Undo::Stack::Redo(tList<tImage::tPicture>& currPics, bool& dirty)
-{
-	if (RedoSteps.IsEmpty())
-		return;
+		int numTilesX = (frame.Width + TileSize - 1) / TileSize;
+		for (int t = 0; t < int(frame.Tiles.size()); t++)
+		{
+			if (!restored->Tiles[t])
+				continue;
+
+			int x0 = (t % numTilesX) * TileSize;
+			int y0 = (t / numTilesX) * TileSize;
+			Capture(frame, *pic, x0, y0, tMin(x0 + TileSize, frame.Width), tMin(y0 + TileSize, frame.Height));
+		}
+	}
+	back->Serial = NextStepSerial++;
+	to.Insert(back);
 
-	Step* redoStep = RedoSteps.Remove();
+	step->Restore(currPics);
+	dirty = step->Dirty;
+	delete step;
+	Maintain();
+}
 
-	// We're going to need an undo step to get to current state. Prepare it first.
-	Step* undoStep = new Step_PictureList(redoStep->Description, dirty, currPics);
 
-	((Step_PictureList*)redoStep)->Restore(currPics);
-	dirty = redoStep->Dirty;
-	delete redoStep;
+void Undo::Stack::Undo(tList<tImage::tPicture>& currPics, bool& dirty, Transpose::Orientation* orientation)
+{
+	Apply(UndoSteps, RedoSteps, currPics, dirty, orientation);
+}
 
-	UndoSteps.Insert(undoStep);
+
+void Undo::Stack::Redo(tList<tImage::tPicture>& currPics, bool& dirty, Transpose::Orientation* orientation)
+{
+	Apply(RedoSteps, UndoSteps, currPics, dirty, orientation);
 }
@@ -14,13 +14,29 @@
 // PERFORMANCE OF THIS SOFTWARE.
 
 #pragma once
+#include <vector>
+#include <memory>
 #include <Foundation/tList.h>
 #include <Foundation/tString.h>
 #include <Image/tPicture.h>
+#include "Transpose.h"
+#include "UndoSpill.h"
 namespace Undo
 {
 
 
+// Undo history across every image is kept under Config.UndoBudgetMB of memory. Tiles that only undo steps refer to
+// are compressed on the workers. When that isn't enough the oldest are moved to a memory-mapped scratch file in the
+// cache dir, and if that fills up too the oldest steps are dropped. Maintain does all this and is called by the
+// stacks after every change. It only queues work so it is quick. Main thread only.
+void Maintain();
+int64 GetMemoryBytes();				// Undo history in memory.
+int64 GetDiskBytes();				// In the scratch file.
+
+// Closes and deletes the scratch file. Call after every image and the worker pool are gone.
+void Shutdown();
+
+
 // An Step is is capable of undoing (or redoing) an operation.
 class Step : public tLink<Step>
 {
@@ -30,39 +46,219 @@ public:
 
 	tString Description;					// A biref description of the operation that this step undoes.
 	bool Dirty;								// The dirty state prior to the operation.
+	uint64 Serial = 0;						// Push order across all stacks. The lowest is dropped first.
+};
+
+
+// Pixels are kept in square tiles that are reference counted and never modified once made. A step only holds the
+// tiles the operation after it changed. How the pixels are stored changes as the tile ages, but never what they are.
+struct Tile : public std::enable_shared_from_this<Tile>
+{
+	Tile(int width, int height, const tPixel* src, int srcStride);
+	~Tile();
+
+	// Works whatever the storage.
+	void Read(tPixel* dst, int dstStride) const;
+	int64 GetMemoryBytes() const;
+
+	enum class Storage
+	{
+		Raw,
+		Packed,								// Compress::Method::Lossless in memory.
+		Spilled								// The same in the scratch file.
+	};
+
+	int Width							= 0;
+	int Height							= 0;
+	Storage Kept						= Storage::Raw;
+	std::vector<tPixel> Pixels;
+	std::vector<uint8> Packed;
+	SpillFile::Location Spill;
+	int SpillSize						= 0;
+	uint64 Serial						= 0;		// Creation order.
+	bool Compressing					= false;
+};
+typedef std::shared_ptr<Tile> TileRef;
+
+
+// The tiles are row-major, starting at the bottom-left like the picture's pixels. They are null where the step leaves
+// the pixels alone.
+struct Frame
+{
+	int Width							= 0;
+	int Height							= 0;
+	float Duration						= 0.0f;
+	std::vector<TileRef> Tiles;
+};
+
+
+// Only the frame count, sizes, durations, and pixels are restored. Everything else about the pictures is kept. Frames
+// that are still the snapshot's size only get the tiles it has written back.
+struct Snapshot
+{
+	void Restore(tList<tImage::tPicture>&) const;
+	std::vector<Frame> Frames;
+};
+
+
+// The part of the pictures an operation changes. The default is every pixel of every frame.
+struct Region
+{
+	Region()																											{ }
+	Region(int frame, int x, int y, int w, int h)																		: Frame(frame), X(x), Y(y), W(w), H(h) { }
+	bool IsEmpty() const																								{ return (W == 0) || (H == 0); }
+
+	int Frame							= -1;		// -1 for every frame.
+	int X								= 0;
+	int Y								= 0;
+	int W								= -1;		// -1 for the full width or height.
+	int H								= -1;
+};
+
+
+// Records a lossless operation instead of the pixels. Undo applies the inverse to the current pictures and redo
+// applies the operation again, so the same step moves between the undo and redo lists. Changed is the region the
+// operation alters either way. Turns, flips, and crops can change an orientation instead of the pixels, and Reorient
+// returns false when a step can't.
+class Step_Operation : public Step
+{
+public:
+	Step_Operation(const tString& desc, bool dirty, const Region& changed)												: Step(desc, dirty), Changed(changed) { }
+	virtual void Revert(tList<tImage::tPicture>&) const = 0;
+	virtual void Reapply(tList<tImage::tPicture>&) const = 0;
+	virtual bool Reorient(Transpose::Orientation&, bool revert) const													{ return false; }
+
+	Region Changed;
+};
+
+
+class Step_Rotate90 : public Step_Operation
+{
+public:
+	Step_Rotate90(const tString& desc, bool dirty, bool antiClockwise)													: Step_Operation(desc, dirty, Region()), AntiClockwise(antiClockwise) { }
+	void Revert(tList<tImage::tPicture>&) const override;
+	void Reapply(tList<tImage::tPicture>&) const override;
+	bool Reorient(Transpose::Orientation& orientation, bool revert) const override										{ orientation.Rotate90(revert ? !AntiClockwise : AntiClockwise); return true; }
+
+	bool AntiClockwise;
+};
+
+
+class Step_Flip : public Step_Operation
+{
+public:
+	Step_Flip(const tString& desc, bool dirty, bool horizontal)															: Step_Operation(desc, dirty, Region()), Horizontal(horizontal) { }
+	void Revert(tList<tImage::tPicture>& pics) const override															{ Reapply(pics); }
+	void Reapply(tList<tImage::tPicture>&) const override;
+	bool Reorient(Transpose::Orientation& orientation, bool revert) const override										{ orientation.Flip(Horizontal); return true; }
+
+	bool Horizontal;
+};
+
+
+// A crop inside the picture only changes the orientation's window, so undo and redo just set it back. Before and
+// After are the whole orientation either side of the crop. Once the window is baked the pixels outside it are gone, so
+// the bake gives the step a copy of the stored pictures it was on, and from then on the step builds the pictures from
+// that instead.
+class Step_Crop : public Step_Operation
+{
+public:
+	Step_Crop(const tString& desc, bool dirty, const Transpose::Orientation& before, const Transpose::Orientation& after) : Step_Operation(desc, dirty, Region()), Before(before), After(after) { }
+	void Revert(tList<tImage::tPicture>& pics) const override															{ Rebuild(pics, Before); }
+	void Reapply(tList<tImage::tPicture>& pics) const override															{ Rebuild(pics, After); }
+	bool Reorient(Transpose::Orientation&, bool revert) const override;
+
+	Transpose::Orientation Before;
+	Transpose::Orientation After;
+	Snapshot Base;
+
+private:
+	void Rebuild(tList<tImage::tPicture>&, const Transpose::Orientation&) const;
+};
+
+
+// Durations are kept for every frame, before and after, so it doesn't matter which frames were set.
+class Step_FrameDuration : public Step_Operation
+{
+public:
+	Step_FrameDuration(const tString& desc, bool dirty, const std::vector<float>& before, const std::vector<float>& after) : Step_Operation(desc, dirty, Region(-1, 0, 0, 0, 0)), Before(before), After(after) { }
+	void Revert(tList<tImage::tPicture>& pics) const override															{ SetDurations(pics, Before); }
+	void Reapply(tList<tImage::tPicture>& pics) const override															{ SetDurations(pics, After); }
+
+	std::vector<float> Before;
+	std::vector<float> After;
+
+private:
+	static void SetDurations(tList<tImage::tPicture>&, const std::vector<float>&);
 };
 
 
-// A particular type of restore step. This one is simple but takes quite a lot of memory. Good one to use while trying
-// to get this running.
-class Step_PictureList : public Step
+// Restores the pictures from a snapshot.
+class Step_Snapshot : public Step
 {
 public:
-	Step_PictureList(const tString& desc, bool dirty, const tList<tImage::tPicture>& pics);
-	virtual ~Step_PictureList()																							{ Pictures.Empty(); }
-	void Restore(tList<tImage::tPicture>& pics);
+	Step_Snapshot(const tString& desc, bool dirty, const Snapshot& state)												: Step(desc, dirty), State(state) { }
+	void Restore(tList<tImage::tPicture>& pics) const																	{ State.Restore(pics); }
 
-	tList<tImage::tPicture> Pictures;
+	Snapshot State;
 };
 
 
 class Stack
 {
 public:
-	// Call push before doing whatever op you are doing.
-	void Push(tList<tImage::tPicture>& preOpState, const tString& desc, bool dirty);
+	Stack();
+	~Stack();
+
+	// Call push before doing whatever op you are doing, with the region it's going to change. Only the tiles of the
+	// pre-op state inside the region are copied. Pushing clears the redo steps. Touch is for changes that belong to the
+	// last step pushed, and must also come before the pictures change. The tiles it covers that the last step doesn't
+	// have yet are added to it.
+	void Push(tList<tImage::tPicture>& preOpState, const tString& desc, bool dirty, const Region& region = Region());
+	void Touch(const tList<tImage::tPicture>& preOpState, const Region& region);
+
+	// Lossless operations push a step describing themselves instead. The stack owns the step. Given an orientation, a
+	// step that can reorient does so and returns true, and the pictures are left as they are.
+	bool Push(Step_Operation*, Transpose::Orientation* orientation = nullptr);
+
+	// Call before a bake changes the stored pictures. Crop steps that are still windows on them get a copy.
+	void KeepBase(const tList<tImage::tPicture>& pictures);
 
-	void Undo(tList<tImage::tPicture>& currPics, bool& dirty);
-	void Redo(tList<tImage::tPicture>& currPics, bool& dirty);
+	// With an orientation, undoing or redoing a turn or flip only changes it. Check UndoNeedsPixels or RedoNeedsPixels
+	// first. A step that reads or writes pixels needs the orientation baked into the pictures.
+	void Undo(tList<tImage::tPicture>& currPics, bool& dirty, Transpose::Orientation* orientation = nullptr);
+	void Redo(tList<tImage::tPicture>& currPics, bool& dirty, Transpose::Orientation* orientation = nullptr);
 
 	bool UndoAvailable() const { return !UndoSteps.IsEmpty(); }
 	bool RedoAvailable() const { return !RedoSteps.IsEmpty(); }
+	bool UndoNeedsPixels() const { return NeedsPixels(UndoSteps.First()); }
+	bool RedoNeedsPixels() const { return NeedsPixels(RedoSteps.First()); }
 	tString GetUndoDesc() const;
 	tString GetRedoDesc() const;
 
+	const static int TileSize = 128;
+
 private:
-	tList<Step> UndoSteps;
-	tList<Step> RedoSteps;
+	// Sizes the snapshot's frames like the pictures, with no tiles yet. Capture copies the tiles the region covers
+	// that the snapshot doesn't have. Frames that aren't the size of their picture any more are left alone.
+	static void Describe(Snapshot&, const tList<tImage::tPicture>&);
+	static void Capture(Snapshot&, const tList<tImage::tPicture>&, const Region&);
+	static void Capture(Frame&, const tImage::tPicture&, int x0, int y0, int x1, int y1);
+
+	// Restores the state at the head of from and puts the current state on to, which is how undo and redo both work.
+	// The way back holds the current tiles wherever the step is about to write, and all of any frame that changes size.
+	// Operation steps are simply moved across after being reverted or reapplied.
+	void Apply(tList<Undo::Step>& from, tList<Undo::Step>& to, tList<tImage::tPicture>& currPics, bool& dirty, Transpose::Orientation*);
+	void Insert(Undo::Step*);
+	static bool NeedsPixels(const Undo::Step*);
+
+	tList<Undo::Step> UndoSteps;
+	tList<Undo::Step> RedoSteps;
+
+	// Maintain drops the oldest step of whichever stack has it. Any redo step counts as older than every undo step.
+	friend void Maintain();
+	uint64 GetOldestSerial() const;
+	void DropOldest();
 };
 
 
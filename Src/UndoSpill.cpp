@@ -0,0 +1,219 @@
+// UndoSpill.cpp
+//
+// A scratch file that compressed undo tiles are moved to when undo history goes over its memory budget. The file is
+// memory mapped in fixed-size segments so spilled tiles are read back by simply touching the mapping. It is deleted
+// when closed, and by the OS if the process dies.
+//
+// Copyright (c) 2021 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#ifdef PLATFORM_WINDOWS
+#include <Windows.h>
+#endif
+#ifdef PLATFORM_LINUX
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+#include <Foundation/tFundamentals.h>
+#include "UndoSpill.h"
+
+
+#ifdef PLATFORM_WINDOWS
+
+
+bool Undo::SpillFile::Open(const tString& dir)
+{
+	Close();
+	tString path; tsPrintf(path, "%sUndo%u.spill", dir.Chars(), uint(GetCurrentProcessId()));
+	HANDLE file = CreateFileA
+	(
+		path.Chars(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+		FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, nullptr
+	);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	File = file;
+	return true;
+}
+
+
+bool Undo::SpillFile::IsOpen() const
+{
+	return File != nullptr;
+}
+
+
+void Undo::SpillFile::Close()
+{
+	for (Segment& segment : Segments)
+		UnmapSegment(segment);
+	Segments.clear();
+	Current = -1;
+	UsedBytes = 0;
+
+	if (File)
+		CloseHandle(HANDLE(File));
+	File = nullptr;
+}
+
+
+bool Undo::SpillFile::AddSegment()
+{
+	// Creating a mapping larger than the file extends the file, and fails if the disk can't hold it. View offsets are multiples of the segment size, which
+	// is a multiple of the allocation granularity.
+	uint64 offset = uint64(Segments.size()) * SegmentSize;
+	uint64 end = offset + SegmentSize;
+	Segment segment;
+	segment.Mapping = CreateFileMappingA(HANDLE(File), nullptr, PAGE_READWRITE, DWORD(end >> 32), DWORD(end & 0xFFFFFFFF), nullptr);
+	if (!segment.Mapping)
+		return false;
+
+	segment.Data = (uint8*)MapViewOfFile(HANDLE(segment.Mapping), FILE_MAP_ALL_ACCESS, DWORD(offset >> 32), DWORD(offset & 0xFFFFFFFF), SIZE_T(SegmentSize));
+	if (!segment.Data)
+	{
+		CloseHandle(HANDLE(segment.Mapping));
+		return false;
+	}
+
+	Segments.push_back(segment);
+	return true;
+}
+
+
+void Undo::SpillFile::UnmapSegment(Segment& segment)
+{
+	if (segment.Data)
+		UnmapViewOfFile(segment.Data);
+	if (segment.Mapping)
+		CloseHandle(HANDLE(segment.Mapping));
+	segment.Data = nullptr;
+	segment.Mapping = nullptr;
+}
+
+
+#else
+
+
+bool Undo::SpillFile::Open(const tString& dir)
+{
+	Close();
+	tString path; tsPrintf(path, "%sUndo%d.spill", dir.Chars(), int(getpid()));
+	int file = open(path.Chars(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (file < 0)
+		return false;
+
+	// The open descriptor keeps the file alive, so it can go from the directory straight away.
+	unlink(path.Chars());
+	File = file;
+	return true;
+}
+
+
+bool Undo::SpillFile::IsOpen() const
+{
+	return File >= 0;
+}
+
+
+void Undo::SpillFile::Close()
+{
+	for (Segment& segment : Segments)
+		UnmapSegment(segment);
+	Segments.clear();
+	Current = -1;
+	UsedBytes = 0;
+
+	if (File >= 0)
+		close(File);
+	File = -1;
+}
+
+
+bool Undo::SpillFile::AddSegment()
+{
+	// The segment's blocks are reserved up front. Grown with ftruncate the file would be sparse, and writing through the
+	// mapping to a full disk raises SIGBUS instead of failing here. Anything partly reserved is given back.
+	uint64 offset = uint64(Segments.size()) * SegmentSize;
+	if (posix_fallocate(File, off_t(offset), off_t(SegmentSize)) != 0)
+	{
+		int truncated = ftruncate(File, off_t(offset));
+		(void)truncated;
+		return false;
+	}
+
+	void* data = mmap(nullptr, size_t(SegmentSize), PROT_READ | PROT_WRITE, MAP_SHARED, File, off_t(offset));
+	if (data == MAP_FAILED)
+		return false;
+
+	Segment segment;
+	segment.Data = (uint8*)data;
+	Segments.push_back(segment);
+	return true;
+}
+
+
+void Undo::SpillFile::UnmapSegment(Segment& segment)
+{
+	if (segment.Data)
+		munmap(segment.Data, size_t(SegmentSize));
+	segment.Data = nullptr;
+}
+
+
+#endif
+
+
+bool Undo::SpillFile::Allocate(int numBytes, int64 maxBytes, Location& location)
+{
+	if (!IsOpen() || (numBytes <= 0) || (numBytes > SegmentSize))
+		return false;
+
+	// The current segment first, then any segment that has emptied, and only then a new one.
+	if ((Current < 0) || (Segments[Current].Used + numBytes > SegmentSize))
+	{
+		Current = -1;
+		for (int s = 0; (s < int(Segments.size())) && (Current < 0); s++)
+			if (Segments[s].LiveBytes == 0)
+				Current = s;
+
+		if (Current < 0)
+		{
+			if ((int64(Segments.size()) + 1) * SegmentSize > maxBytes)
+				return false;
+			if (!AddSegment())
+				return false;
+			Current = int(Segments.size()) - 1;
+		}
+		Segments[Current].Used = 0;
+	}
+
+	Segment& segment = Segments[Current];
+	location.Segment = Current;
+	location.Offset = segment.Used;
+	segment.Used += numBytes;
+	segment.LiveBytes += numBytes;
+	UsedBytes += numBytes;
+	return true;
+}
+
+
+void Undo::SpillFile::Free(const Location& location, int numBytes)
+{
+	if ((location.Segment < 0) || (location.Segment >= int(Segments.size())))
+		return;
+
+	Segment& segment = Segments[location.Segment];
+	segment.LiveBytes -= numBytes;
+	UsedBytes -= numBytes;
+	if ((segment.LiveBytes == 0) && (location.Segment != Current))
+		segment.Used = 0;
+}
@@ -0,0 +1,77 @@
+// UndoSpill.h
+//
+// A scratch file that compressed undo tiles are moved to when undo history goes over its memory budget. The file is
+// memory mapped in fixed-size segments so spilled tiles are read back by simply touching the mapping. It is deleted
+// when closed, and by the OS if the process dies.
+//
+// Copyright (c) 2021 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <vector>
+#include <Foundation/tPlatform.h>
+#include <Foundation/tString.h>
+namespace Undo
+{
+
+
+class SpillFile
+{
+public:
+	SpillFile()																											{ }
+	~SpillFile()																										{ Close(); }
+
+	// Creates a new scratch file in dir, named after the process so several instances can share a cache dir.
+	bool Open(const tString& dir);
+	void Close();
+	bool IsOpen() const;
+
+	struct Location
+	{
+		int Segment			= -1;
+		int Offset			= 0;
+	};
+
+	// Reserves numBytes, growing the file a segment at a time up to maxBytes. Returns false if there's no room, either
+	// under maxBytes or on the disk. A segment's disk space is committed when it's added.
+	// Segments are bump allocated and reused once everything in them has been freed.
+	bool Allocate(int numBytes, int64 maxBytes, Location&);
+	void Free(const Location&, int numBytes);
+	uint8* GetData(const Location& location) const																		{ return Segments[location.Segment].Data + location.Offset; }
+
+	// Bytes allocated and not yet freed.
+	int64 GetUsedBytes() const																							{ return UsedBytes; }
+
+	const static int SegmentSize = 64*1024*1024;
+
+private:
+	struct Segment
+	{
+		uint8* Data			= nullptr;
+		void* Mapping		= nullptr;		// Windows only.
+		int Used			= 0;			// Bump pointer.
+		int LiveBytes		= 0;
+	};
+
+	bool AddSegment();
+	void UnmapSegment(Segment&);
+
+	#ifdef PLATFORM_WINDOWS
+	void* File				= nullptr;
+	#else
+	int File				= -1;
+	#endif
+	std::vector<Segment> Segments;
+	int Current				= -1;
+	int64 UsedBytes			= 0;
+};
+
+
+}
@@ -0,0 +1,380 @@
+// WorkerPool.cpp
+//
+// A shared pool of worker threads for background jobs like thumbnail generation. Each worker owns a priority queue
+// and idle workers steal from the others. Completed jobs are handed back to the main thread through a lock-free
+// queue that is drained once per frame.
+//
+// Copyright (c) 2021 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <algorithm>
+#include <Foundation/tAssert.h>
+#include "WorkerPool.h"
+using namespace Worker;
+
+
+namespace Worker
+{
+	thread_local bool OnWorkerThread = false;
+}
+
+
+// Shared by the caller and the helper jobs. Helpers hold a reference so one that only starts running after the caller
+// has returned finds no chunks left and does nothing.
+struct Pool::ParallelForState
+{
+	std::function<void(int, int)> Body;
+	int Count									= 0;
+	int GrainSize								= 1;
+	int NumChunks								= 0;
+	std::atomic<int> NextChunk					= 0;
+	std::atomic<int> NumDone					= 0;
+};
+
+
+class Pool::ParallelForJob : public Job
+{
+public:
+	ParallelForJob(const std::shared_ptr<ParallelForState>& state)														: State(state) { }
+	void Execute() override																								{ RunChunks(*State); }
+	std::shared_ptr<ParallelForState> State;
+};
+
+
+bool Pool::HeapLess(const Job* a, const Job* b)
+{
+	int pa = a->GetPriority();
+	int pb = b->GetPriority();
+	if (pa != pb)
+		return pa < pb;
+
+	// Older jobs (smaller sequence) are 'bigger' so they come out first.
+	return a->Sequence > b->Sequence;
+}
+
+
+void Pool::Startup(int numThreads)
+{
+	if (IsRunning())
+		return;
+
+	if (numThreads < 1)
+		numThreads = 1;
+
+	Stopping = false;
+	for (int q = 0; q < numThreads; q++)
+		Queues.push_back(new Queue);
+
+	for (int w = 0; w < numThreads; w++)
+		Workers.push_back(std::thread([this, w] { WorkerLoop(w); }));
+}
+
+
+void Pool::Shutdown()
+{
+	if (!IsRunning())
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(SleepMutex);
+		Stopping = true;
+	}
+	SleepCondition.notify_all();
+	for (std::thread& worker : Workers)
+		worker.join();
+	Workers.clear();
+
+	for (Queue* queue : Queues)
+	{
+		for (Job* job : queue->Heap)
+			delete job;
+		delete queue;
+	}
+	Queues.clear();
+	NumQueued = 0;
+
+	Job* job = Completed.exchange(nullptr, std::memory_order_acquire);
+	while (job)
+	{
+		Job* next = job->NextCompleted;
+		delete job;
+		job = next;
+	}
+}
+
+
+void Pool::Submit(Job* job, int priority)
+{
+	tAssert(!IsWorkerThread());
+	if (!job)
+		return;
+
+	// With no workers there is nowhere to run it. Complete it inline so owners see the same sequence of calls.
+	if (!IsRunning())
+	{
+		job->JobState = Job::State::Running;
+		job->Execute();
+		job->JobState = Job::State::Done;
+		PushCompleted(job);
+		return;
+	}
+
+	job->Priority = priority;
+	job->Sequence = NextSequence++;
+	job->QueueIndex = NextQueue;
+	NextQueue = (NextQueue + 1) % int(Queues.size());
+
+	Queue& queue = *Queues[job->QueueIndex];
+	{
+		std::lock_guard<std::mutex> lock(queue.Mutex);
+		job->JobState = Job::State::Queued;
+		queue.Heap.push_back(job);
+		std::push_heap(queue.Heap.begin(), queue.Heap.end(), HeapLess);
+		UpdateTop(queue);
+	}
+
+	// Incrementing under the sleep mutex means a worker about to wait cannot miss the notify.
+	{
+		std::lock_guard<std::mutex> lock(SleepMutex);
+		NumQueued++;
+	}
+	SleepCondition.notify_one();
+}
+
+
+bool Pool::Reprioritize(Job* job, int priority)
+{
+	if (!job || (job->QueueIndex < 0) || !IsRunning())
+		return false;
+
+	Queue& queue = *Queues[job->QueueIndex];
+	std::lock_guard<std::mutex> lock(queue.Mutex);
+	if (job->GetState() != Job::State::Queued)
+		return false;
+
+	if (job->GetPriority() == priority)
+		return true;
+
+	job->Priority = priority;
+	std::make_heap(queue.Heap.begin(), queue.Heap.end(), HeapLess);
+	UpdateTop(queue);
+	return true;
+}
+
+
+bool Pool::Cancel(Job* job)
+{
+	if (!job || (job->QueueIndex < 0) || !IsRunning())
+		return false;
+
+	Queue& queue = *Queues[job->QueueIndex];
+	{
+		std::lock_guard<std::mutex> lock(queue.Mutex);
+		if (job->GetState() != Job::State::Queued)
+			return false;
+
+		auto found = std::find(queue.Heap.begin(), queue.Heap.end(), job);
+		if (found == queue.Heap.end())
+			return false;
+
+		queue.Heap.erase(found);
+		std::make_heap(queue.Heap.begin(), queue.Heap.end(), HeapLess);
+		UpdateTop(queue);
+		NumQueued--;
+	}
+
+	delete job;
+	return true;
+}
+
+
+int Pool::DrainCompleted()
+{
+	Job* job = Completed.exchange(nullptr, std::memory_order_acquire);
+
+	// The stack hands them back newest first. Reverse so OnComplete is called in completion order.
+	Job* ordered = nullptr;
+	while (job)
+	{
+		Job* next = job->NextCompleted;
+		job->NextCompleted = ordered;
+		ordered = job;
+		job = next;
+	}
+
+	int count = 0;
+	while (ordered)
+	{
+		Job* next = ordered->NextCompleted;
+		ordered->OnComplete();
+		delete ordered;
+		ordered = next;
+		count++;
+	}
+
+	return count;
+}
+
+
+bool Pool::IsWorkerThread()
+{
+	return OnWorkerThread;
+}
+
+
+void Pool::RunChunks(ParallelForState& state)
+{
+	while (true)
+	{
+		int chunk = state.NextChunk++;
+		if (chunk >= state.NumChunks)
+			return;
+
+		int begin = chunk * state.GrainSize;
+		int end = std::min(begin + state.GrainSize, state.Count);
+		state.Body(begin, end);
+		state.NumDone.fetch_add(1, std::memory_order_release);
+	}
+}
+
+
+void Pool::ParallelFor(int count, int grainSize, const std::function<void(int begin, int end)>& body)
+{
+	if (count <= 0)
+		return;
+
+	grainSize = std::max(grainSize, 1);
+	int numChunks = (count + grainSize - 1) / grainSize;
+
+	// Submitting from a worker would race the main thread, and a worker waiting on other workers can deadlock.
+	if (!IsRunning() || IsWorkerThread() || (numChunks == 1))
+	{
+		body(0, count);
+		return;
+	}
+
+	std::shared_ptr<ParallelForState> state = std::make_shared<ParallelForState>();
+	state->Body = body;
+	state->Count = count;
+	state->GrainSize = grainSize;
+	state->NumChunks = numChunks;
+
+	// Workers busy with long jobs won't pick up a helper, but the caller keeps going on its own so that is only slower.
+	int numHelpers = std::min(GetNumThreads(), numChunks - 1);
+	std::vector<Job*> helpers;
+	for (int h = 0; h < numHelpers; h++)
+	{
+		Job* helper = new ParallelForJob(state);
+		helpers.push_back(helper);
+		Submit(helper, ParallelForPriority);
+	}
+
+	RunChunks(*state);
+	while (state->NumDone.load(std::memory_order_acquire) < numChunks)
+		std::this_thread::yield();
+
+	// Helpers that never started are removed so they don't hold up other work. Finished ones are still in the completed
+	// list and are deleted by the next DrainCompleted.
+	for (Job* helper : helpers)
+		Cancel(helper);
+}
+
+
+void Pool::UpdateTop(Queue& queue)
+{
+	// Must be called with the queue mutex held.
+	queue.TopPriority.store(queue.Heap.empty() ? IdlePriority : queue.Heap.front()->GetPriority(), std::memory_order_relaxed);
+}
+
+
+Job* Pool::PopFrom(int index)
+{
+	Queue& queue = *Queues[index];
+	std::lock_guard<std::mutex> lock(queue.Mutex);
+	if (queue.Heap.empty())
+		return nullptr;
+
+	std::pop_heap(queue.Heap.begin(), queue.Heap.end(), HeapLess);
+	Job* job = queue.Heap.back();
+	queue.Heap.pop_back();
+	UpdateTop(queue);
+
+	// The state change happens under the lock so Cancel and Reprioritize see a consistent view.
+	job->JobState = Job::State::Running;
+	NumRunning++;
+	NumQueued--;
+	return job;
+}
+
+
+Job* Pool::FindJob(int index)
+{
+	// Take from our own queue unless another queue has strictly more important work at the top. That keeps the pool
+	// close to a global priority order while most pops stay uncontended.
+	int numQueues = int(Queues.size());
+	int best = index;
+	int bestPriority = Queues[index]->TopPriority.load(std::memory_order_relaxed);
+	for (int offset = 1; offset < numQueues; offset++)
+	{
+		int victim = (index + offset) % numQueues;
+		int priority = Queues[victim]->TopPriority.load(std::memory_order_relaxed);
+		if (priority > bestPriority)
+		{
+			best = victim;
+			bestPriority = priority;
+		}
+	}
+
+	if (Job* job = PopFrom(best))
+		return job;
+
+	// The top we saw may have been taken already. Fall back to any non-empty queue.
+	for (int offset = 0; offset < numQueues; offset++)
+		if (Job* job = PopFrom((index + offset) % numQueues))
+			return job;
+
+	return nullptr;
+}
+
+
+void Pool::PushCompleted(Job* job)
+{
+	Job* head = Completed.load(std::memory_order_relaxed);
+	do
+	{
+		job->NextCompleted = head;
+	}
+	while (!Completed.compare_exchange_weak(head, job, std::memory_order_release, std::memory_order_relaxed));
+
+	void (*callback)() = CompletedCallback.load(std::memory_order_acquire);
+	if (callback)
+		callback();
+}
+
+
+void Pool::WorkerLoop(int index)
+{
+	OnWorkerThread = true;
+	while (!Stopping)
+	{
+		Job* job = FindJob(index);
+		if (job)
+		{
+			job->Execute();
+			job->JobState.store(Job::State::Done, std::memory_order_release);
+			PushCompleted(job);
+			NumRunning--;
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(SleepMutex);
+		SleepCondition.wait(lock, [this] { return Stopping || (NumQueued > 0); });
+	}
+}
@@ -0,0 +1,146 @@
+// WorkerPool.h
+//
+// A shared pool of worker threads for background jobs like thumbnail generation. Each worker owns a priority queue
+// and idle workers steal from the others. Completed jobs are handed back to the main thread through a lock-free
+// queue that is drained once per frame.
+//
+// Copyright (c) 2021 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <Foundation/tPlatform.h>
+namespace Worker
+{
+
+
+class Pool;
+
+
+// Derive from Job to put work on the pool. Execute runs on a worker thread and must not touch anything the main thread
+// may be modifying. OnComplete runs on the main thread from inside Pool::DrainCompleted, so it is the place to hand
+// results back to their owner. Once submitted, the pool owns the job and deletes it after OnComplete or on a
+// successful Cancel.
+class Job
+{
+public:
+	Job()																												{ }
+	virtual ~Job()																										{ }
+
+	virtual void Execute() = 0;
+	virtual void OnComplete()																							{ }
+
+	enum class State
+	{
+		Queued,
+		Running,
+		Done
+	};
+	State GetState() const																								{ return JobState.load(std::memory_order_acquire); }
+	int GetPriority() const																								{ return Priority.load(std::memory_order_relaxed); }
+
+private:
+	friend class Pool;
+	std::atomic<int> Priority					= 0;		// Higher runs first.
+	std::atomic<State> JobState					= State::Queued;
+	int QueueIndex								= -1;		// The worker queue the job was submitted to.
+	uint64 Sequence								= 0;		// Breaks priority ties so equal priorities run in submit order.
+	Job* NextCompleted							= nullptr;	// Intrusive link for the completion queue.
+};
+
+
+class Pool
+{
+public:
+	Pool()																												{ }
+	~Pool()																												{ Shutdown(); }
+
+	// Starts numThreads workers. Calling it on a running pool does nothing.
+	void Startup(int numThreads);
+
+	// Waits for running jobs to finish and stops all workers. Jobs still queued, and completed jobs that were never
+	// drained, are deleted without calling OnComplete.
+	void Shutdown();
+	bool IsRunning() const																								{ return !Workers.empty(); }
+	int GetNumThreads() const																							{ return int(Workers.size()); }
+
+	// Queues the job and takes ownership of it. Main thread only. Asserts if called from a worker.
+	void Submit(Job*, int priority = 0);
+
+	// Changes the priority of a job that has not started yet. Returns false if the job is already running or done.
+	bool Reprioritize(Job*, int priority);
+
+	// Removes a job that has not started yet and deletes it. Returns false if the job is already running or done, in
+	// which case it will still arrive through DrainCompleted. Main thread only.
+	bool Cancel(Job*);
+
+	// Calls OnComplete for every finished job and deletes them. Call once per frame from the main thread. Returns the
+	// number of jobs drained.
+	int DrainCompleted();
+
+	// Splits [0, count) into chunks of grainSize and runs body(begin, end) on them in parallel. The calling thread
+	// works on chunks too and returns when all are done, so body may reference locals. Called from a worker thread, or
+	// with the pool not running, the whole range runs on the calling thread. Main thread only otherwise.
+	void ParallelFor(int count, int grainSize, const std::function<void(int begin, int end)>& body);
+	static bool IsWorkerThread();
+
+	int GetNumQueued() const																							{ return NumQueued.load(std::memory_order_relaxed); }
+	int GetNumRunning() const																							{ return NumRunning.load(std::memory_order_relaxed); }
+	bool IsBusy() const																									{ return (GetNumQueued() + GetNumRunning()) > 0; }
+	bool HasCompleted() const																							{ return Completed.load(std::memory_order_acquire) != nullptr; }
+
+	// Called each time a job finishes, usually on a worker thread, so it must be thread-safe. Used to wake a main loop
+	// that sleeps while waiting for events.
+	void SetCompletedCallback(void (*callback)())																		{ CompletedCallback.store(callback, std::memory_order_release); }
+
+private:
+	// Each queue is a binary max-heap ordered by priority then sequence. TopPriority mirrors the priority at the top of
+	// the heap so workers can decide who to steal from without taking every lock.
+	struct Queue
+	{
+		std::mutex Mutex;
+		std::vector<Job*> Heap;
+		std::atomic<int> TopPriority				= IdlePriority;
+	};
+	static const int IdlePriority				= -0x7FFFFFFF;
+	static const int ParallelForPriority		= 0x7FFFFFFF;	// Helpers jump any queued work.
+
+	struct ParallelForState;
+	class ParallelForJob;
+	static void RunChunks(ParallelForState&);
+	static bool HeapLess(const Job* a, const Job* b);
+
+	void WorkerLoop(int index);
+	Job* PopFrom(int index);
+	Job* FindJob(int index);
+	void UpdateTop(Queue&);
+	void PushCompleted(Job*);
+
+	std::vector<std::thread> Workers;
+	std::vector<Queue*> Queues;
+	std::mutex SleepMutex;
+	std::condition_variable SleepCondition;
+	std::atomic<bool> Stopping					= false;
+	std::atomic<int> NumQueued					= 0;
+	std::atomic<int> NumRunning					= 0;
+	std::atomic<Job*> Completed					= nullptr;	// Head of a lock-free intrusive stack.
+	std::atomic<void (*)()> CompletedCallback	= nullptr;
+	uint64 NextSequence							= 0;
+	int NextQueue								= 0;
+};
+
+
+}